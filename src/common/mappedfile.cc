@@ -0,0 +1,151 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "common/mappedfile.h"
+
+#include "common/logger.h"
+
+MappedFile::MappedFile() {
+  data_ = NULL;
+  size_ = 0;
+#ifdef WIN32
+  file_mapping_ = NULL;
+#endif
+}
+
+MappedFile::~MappedFile() {
+  Unmap();
+}
+
+bool MappedFile::Open(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    Logger::Log(EVENT_ERROR, "Failed to open [%s] to map.", path);
+    return false;
+  }
+
+  bool result = Map(file);
+  fclose(file);
+  return result;
+}
+
+#ifdef WIN32
+#include <io.h>
+
+bool MappedFile::Map(FILE* file) {
+  Unmap();
+
+  HANDLE handle = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(file)));
+  LARGE_INTEGER size;
+  if (handle == INVALID_HANDLE_VALUE || !GetFileSizeEx(handle, &size)) {
+    Logger::Log(EVENT_ERROR, "Failed to get size of mapped file. (%d)",
+                GetLastError());
+    return false;
+  }
+
+  // Empty file can't be mapped.
+  if (size.QuadPart == 0) {
+    return true;
+  }
+
+  file_mapping_ = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (file_mapping_ == NULL) {
+    Logger::Log(EVENT_ERROR, "Failed to create file mapping. (%d)",
+                GetLastError());
+    return false;
+  }
+
+  data_ = static_cast<const char*>(
+    MapViewOfFile(file_mapping_, FILE_MAP_READ, 0, 0, 0));
+  if (data_ == NULL) {
+    Logger::Log(EVENT_ERROR, "Failed to map view of file. (%d)",
+                GetLastError());
+    CloseHandle(file_mapping_);
+    file_mapping_ = NULL;
+    return false;
+  }
+
+  size_ = size.QuadPart;
+  return true;
+}
+
+void MappedFile::Unmap() {
+  if (data_ != NULL) {
+    UnmapViewOfFile(data_);
+    data_ = NULL;
+  }
+
+  if (file_mapping_ != NULL) {
+    CloseHandle(file_mapping_);
+    file_mapping_ = NULL;
+  }
+
+  size_ = 0;
+}
+
+void MappedFile::AdviseSequential() {
+  // Windows reads ahead on page faults by itself, and there is no way to
+  // give a hint on an existing view.
+}
+
+#else // __linux__ || __unix__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <errno.h>
+
+bool MappedFile::Map(FILE* file) {
+  Unmap();
+
+  int fd = fileno(file);
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    Logger::Log(EVENT_ERROR, "Failed to get size of mapped file. (%d)", errno);
+    return false;
+  }
+
+  // Empty file can't be mapped.
+  if (st.st_size == 0) {
+    return true;
+  }
+
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    Logger::Log(EVENT_ERROR, "Failed to map file. (%d)", errno);
+    return false;
+  }
+
+  data_ = static_cast<const char*>(data);
+  size_ = st.st_size;
+  return true;
+}
+
+void MappedFile::Unmap() {
+  if (data_ != NULL) {
+    munmap(const_cast<char*>(data_), static_cast<size_t>(size_));
+    data_ = NULL;
+  }
+
+  size_ = 0;
+}
+
+void MappedFile::AdviseSequential() {
+  if (data_ != NULL) {
+    madvise(const_cast<char*>(data_), static_cast<size_t>(size_),
+            MADV_SEQUENTIAL);
+  }
+}
+
+#endif
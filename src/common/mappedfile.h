@@ -0,0 +1,73 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// MappedFile maps a whole file into memory for reading, with a unified
+// interface across different platforms.
+// The mapped data stays valid until Unmap is called, even if the file is
+// closed or renamed.
+
+#ifndef COMMON_MAPPEDFILE_H__
+#define COMMON_MAPPEDFILE_H__
+
+#include <stdio.h>
+#include "common/basictypes.h"
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  // Map the file with given path.
+  bool Open(const char* path);
+
+  // Map the file underlying an opened stdio stream.
+  // The stream can be closed after this call.
+  bool Map(FILE* file);
+
+  // Unmap the file, and release related system resources.
+  void Unmap();
+
+  // Tell the system the data will be read sequentially, so it can read
+  // ahead aggressively, and drop pages which are already read.
+  // It is only a hint, and does nothing on some platforms.
+  void AdviseSequential();
+
+  // Returns the mapped data, or NULL if nothing is mapped.
+  // Data of an empty file is also NULL.
+  const char* data() const {
+    return data_;
+  }
+
+  // Returns size of the mapped file.
+  int64 size() const {
+    return size_;
+  }
+
+ private:
+  const char* data_;
+  int64 size_;
+
+#ifdef WIN32
+  HANDLE file_mapping_;
+#endif
+
+  DISALLOW_EVIL_CONSTRUCTORS(MappedFile);
+};
+
+#endif // COMMON_MAPPEDFILE_H__
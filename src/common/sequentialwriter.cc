@@ -0,0 +1,231 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "common/sequentialwriter.h"
+
+#include <string.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include "common/port.h"
+#include "common/criticalsection.h"
+
+namespace {
+
+// Lock for the rate limit, which may be changed when settings are reloaded,
+// and the budget shared by all throttled writers.
+CriticalSection rate_limit_lock;
+
+// Bytes throttled writers could write now without waiting, which is negative
+// if they have written more than the limit, and the time in milliseconds
+// when it is counted. Unused budget is kept for at most one second.
+int64 rate_budget = 0;
+int64 rate_budget_time = 0;
+
+// Whether current thread is throttled.
+#ifdef WIN32
+__declspec(thread) bool thread_throttled = false;
+#else
+__thread bool thread_throttled = false;
+#endif
+
+// Get current time in milliseconds, for measuring intervals.
+int64 GetMilliseconds() {
+#ifdef WIN32
+  return static_cast<int64>(GetTickCount());
+#else
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return static_cast<int64>(now.tv_sec) * 1000 + now.tv_usec / 1000;
+#endif
+}
+
+// Write back data in range [begin, end) of the file, and drop it from cache.
+// If "wait" is false, the write back is only started.
+void WriteBack(FILE* file, int64 begin, int64 end, bool wait) {
+#ifdef __linux__
+  if (end <= begin) return;
+
+  int fd = fileno(file);
+  if (!wait) {
+    sync_file_range(fd, begin, end - begin, SYNC_FILE_RANGE_WRITE);
+    return;
+  }
+
+  // Dirty pages can't be dropped, so wait for them to be written first.
+  sync_file_range(fd, begin, end - begin, SYNC_FILE_RANGE_WAIT_BEFORE
+                  | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+  posix_fadvise(fd, begin, end - begin, POSIX_FADV_DONTNEED);
+#endif
+}
+
+}  // namespace
+
+int64 SequentialWriter::rate_limit_ = 0;
+
+SequentialWriter::SequentialWriter() {
+  Init(kBufferSize);
+}
+
+SequentialWriter::SequentialWriter(int buffer_size) {
+  Init(buffer_size);
+}
+
+void SequentialWriter::Init(int buffer_size) {
+  file_ = NULL;
+  buffer_ = NULL;
+  buffer_size_ = buffer_size;
+  buffer_used_ = 0;
+  start_offset_ = 0;
+  written_ = 0;
+  dropped_offset_ = 0;
+  pending_offset_ = 0;
+  throttled_ = false;
+}
+
+SequentialWriter::~SequentialWriter() {
+  Close();
+}
+
+void SequentialWriter::SetRateLimit(int64 bytes_per_second) {
+  rate_limit_lock.Enter(true);
+  rate_limit_ = bytes_per_second;
+  rate_budget = 0;
+  rate_budget_time = GetMilliseconds();
+  rate_limit_lock.Leave();
+}
+
+void SequentialWriter::SetThreadThrottled(bool throttled) {
+  thread_throttled = throttled;
+}
+
+bool SequentialWriter::IsThreadThrottled() {
+  return thread_throttled;
+}
+
+void SequentialWriter::Attach(FILE* file) {
+  Close();
+
+  file_ = file;
+  buffer_ = new char[buffer_size_];
+  buffer_used_ = 0;
+
+  start_offset_ = ftell(file_);
+  if (start_offset_ < 0) start_offset_ = 0;
+  written_ = 0;
+  dropped_offset_ = start_offset_;
+  pending_offset_ = start_offset_;
+  throttled_ = thread_throttled;
+}
+
+bool SequentialWriter::Write(const void* data, size_t size) {
+  if (file_ == NULL) return false;
+
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0) {
+    size_t length = buffer_size_ - buffer_used_;
+    if (length > size) length = size;
+
+    memcpy(buffer_ + buffer_used_, bytes, length);
+    buffer_used_ += static_cast<int>(length);
+    bytes += length;
+    size -= length;
+
+    if (buffer_used_ == buffer_size_ && !WriteChunk(false)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SequentialWriter::WriteAt(int64 offset, const void* data, size_t size) {
+  if (file_ == NULL) return false;
+
+  // Buffered data should be written before it is overwritten.
+  bool result = WriteChunk(false)
+    && fseek(file_, static_cast<long>(offset), SEEK_SET) == 0
+    && fwrite(data, 1, size, file_) == size
+    && fflush(file_) == 0;
+
+  // Always go back to the end, so later writes are still appended.
+  if (fseek(file_, 0, SEEK_END) != 0) {
+    result = false;
+  }
+  return result;
+}
+
+bool SequentialWriter::WriteChunk(bool final) {
+  size_t length = static_cast<size_t>(buffer_used_);
+  buffer_used_ = 0;
+  if (fwrite(buffer_, 1, length, file_) != length || fflush(file_) != 0) {
+    return false;
+  }
+  written_ += length;
+
+  // Write back of current chunk is only started, and the previous chunk,
+  // which is very likely on disk now, is dropped. So writing and write back
+  // are overlapped. The last chunk is not waited for when the file is
+  // closed, so closing a small file, like a journal or a statistics file,
+  // never waits for the disk.
+  int64 end = start_offset_ + written_;
+  WriteBack(file_, pending_offset_, end, false);
+  WriteBack(file_, dropped_offset_, pending_offset_, true);
+  dropped_offset_ = pending_offset_;
+  pending_offset_ = end;
+
+  if (!throttled_ || final) return true;
+
+  // The chunk is taken from the shared budget, and the writer sleeps until
+  // the budget is paid back, so the debt of all writers is paid in turn.
+  int64 wait = 0;
+  rate_limit_lock.Enter(true);
+  if (rate_limit_ > 0) {
+    int64 now = GetMilliseconds();
+    rate_budget += (now - rate_budget_time) * rate_limit_ / 1000;
+    if (rate_budget > rate_limit_) rate_budget = rate_limit_;
+    rate_budget_time = now;
+
+    rate_budget -= static_cast<int64>(length);
+    if (rate_budget < 0) {
+      wait = -rate_budget * 1000 / rate_limit_;
+    }
+  }
+  rate_limit_lock.Leave();
+
+  if (wait > 0) {
+    Sleep(static_cast<int>(wait));
+  }
+  return true;
+}
+
+bool SequentialWriter::Close() {
+  if (file_ == NULL) return true;
+
+  bool result = WriteChunk(true);
+  if (fclose(file_) != 0) {
+    result = false;
+  }
+  file_ = NULL;
+
+  delete[] buffer_;
+  buffer_ = NULL;
+  return result;
+}
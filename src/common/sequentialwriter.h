@@ -0,0 +1,120 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// SequentialWriter writes a large file from beginning to end, like merged
+// database files, without disturbing other programs on the same machine.
+// Data is collected in a large buffer, and written to the stream in big
+// chunks. Every time a chunk is written, its write back to disk is started,
+// and the pages of the previous chunk are dropped from system cache, because
+// these files are not read again soon, and they should not evict hot pages
+// of the web server. The last chunk is left in cache when the file is closed,
+// so closing doesn't wait for the disk.
+// Optionally, the total write speed of writers in background threads, like
+// the compaction, is limited. They share one budget, so parallel writers
+// together don't exceed the limit. Writers in other threads, like flushing
+// of memory data, are never slowed down.
+// Write back and cache dropping are only done on linux. Other platforms
+// only get the large buffer and the rate limit.
+// This class is not thread safe, except its static methods.
+
+#ifndef COMMON_SEQUENTIALWRITER_H__
+#define COMMON_SEQUENTIALWRITER_H__
+
+#include <stdio.h>
+#include "common/basictypes.h"
+
+class SequentialWriter {
+ public:
+  // Default size of the buffer, which is also the chunk size to write back.
+  static const int kBufferSize = 4 * 1024 * 1024;
+
+  SequentialWriter();
+
+  // Use a smaller buffer, if many files are written together.
+  explicit SequentialWriter(int buffer_size);
+  ~SequentialWriter();
+
+  // Take an opened stream, which is written from its current position.
+  // The stream is closed by this object.
+  void Attach(FILE* file);
+
+  // Write data at the end of the stream.
+  // Returns false if it fails.
+  bool Write(const void* data, size_t size);
+
+  // Overwrite data at given offset of the file, for example to update a
+  // header. The stream is still positioned at the end after this call.
+  bool WriteAt(int64 offset, const void* data, size_t size);
+
+  // Flush and close the stream.
+  // Returns false if any data can't be written.
+  bool Close();
+
+  bool is_open() const {
+    return file_ != NULL;
+  }
+
+  // Returns offset of the end of written data, including buffered data.
+  int64 position() const {
+    return start_offset_ + written_ + buffer_used_;
+  }
+
+  // Limit total write speed of the writers in throttled threads, in bytes
+  // per second. Zero means no limit.
+  static void SetRateLimit(int64 bytes_per_second);
+
+  // Set whether the calling thread is throttled by the rate limit. It takes
+  // effect on the streams attached after this call.
+  static void SetThreadThrottled(bool throttled);
+
+  // Whether the calling thread is throttled. A thread working for a
+  // throttled one should be throttled as well.
+  static bool IsThreadThrottled();
+
+ private:
+  // Write the buffer to the stream as a chunk. The data is flushed, and its
+  // write back is started, while the previous chunk is dropped from cache.
+  // The writer sleeps if it is too fast, unless it is the "final" chunk.
+  bool WriteChunk(bool final);
+
+  // Initialize members. Called by constructors.
+  void Init(int buffer_size);
+
+  FILE* file_;
+
+  // Data not written to the stream yet.
+  char* buffer_;
+  int buffer_size_;
+  int buffer_used_;
+
+  // Offset where this writer started, and number of bytes written to the
+  // stream since.
+  int64 start_offset_;
+  int64 written_;
+
+  // Written bytes before this offset are already dropped from cache, and
+  // bytes before pending_offset_ have been sent to disk.
+  int64 dropped_offset_;
+  int64 pending_offset_;
+
+  // Whether the stream is attached in a throttled thread.
+  bool throttled_;
+
+  static int64 rate_limit_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(SequentialWriter);
+};
+
+#endif // COMMON_SEQUENTIALWRITER_H__
@@ -34,6 +34,7 @@ void SiteSetting::ResetToDefault() {
   enabled_ = true;
   max_url_in_disk_ = 5 * 1000 * 1000;
   max_url_in_memory_ = 100 * 1000;
+  memory_eviction_policy_ = "oldest_access";
   max_url_life_ = 365;
   add_generator_info_ = true;
 
@@ -82,6 +83,7 @@ bool SiteSetting::LoadSetting(TiXmlElement* element) {
   LoadAttribute("log_path", log_path_);
 
   LoadAttribute("max_url_in_memory", max_url_in_memory_);
+  LoadAttribute("memory_eviction_policy", memory_eviction_policy_);
   LoadAttribute("max_url_in_disk", max_url_in_disk_);
   LoadAttribute("max_url_life_in_days", max_url_life_);
 
@@ -150,6 +152,10 @@ bool SiteSetting::Validate() const {
   if (max_url_in_memory_ <= 0)
     return false;
 
+  if (memory_eviction_policy_ != "oldest_access" &&
+      memory_eviction_policy_ != "least_accessed")
+    return false;
+
   if (max_url_life_ <= 0)
     return false;
 
@@ -191,6 +197,7 @@ TiXmlElement* SiteSetting::SaveSetting() {
   SaveAttribute("enabled", enabled_);
   SaveAttribute("max_url_in_disk", max_url_in_disk_);
   SaveAttribute("max_url_in_memory", max_url_in_memory_);
+  SaveAttribute("memory_eviction_policy", memory_eviction_policy_);
   SaveAttribute("max_url_life_in_days", max_url_life_);
   SaveAttribute("add_generator_info", add_generator_info_);
 
@@ -228,6 +235,8 @@ TiXmlElement* SiteSetting::SaveSetting(const BaseSetting* global) {
   SaveAttribute("max_url_in_disk", max_url_in_disk_, another->max_url_in_disk_);
   SaveAttribute("max_url_in_memory", max_url_in_memory_,
     another->max_url_in_memory_);
+  SaveAttribute("memory_eviction_policy", memory_eviction_policy_,
+    another->memory_eviction_policy_);
   SaveAttribute("max_url_life_in_days", max_url_life_,
     another->max_url_life_);
   SaveAttribute("add_generator_info", add_generator_info_,
@@ -286,6 +295,7 @@ bool SiteSetting::Equals(const BaseSetting* a) const {
     site_id_ != another.site_id_ ||
     max_url_in_disk_ != another.max_url_in_disk_ ||
     max_url_in_memory_ != another.max_url_in_memory_ ||
+    memory_eviction_policy_ != another.memory_eviction_policy_ ||
     max_url_life_ != another.max_url_life_ ||
     host_url_.url() != another.host_url_.url() ||
     physical_path_ != another.physical_path_ ||
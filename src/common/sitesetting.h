@@ -123,6 +123,15 @@ class SiteSetting : public BaseSetting {
     max_url_in_memory_ = max_url_in_memory;
   }
 
+  // get/set policy to evict urls when memory is full.
+  // The value is "oldest_access" or "least_accessed".
+  const std::string& memory_eviction_policy() const {
+    return memory_eviction_policy_;
+  }
+  void set_memory_eviction_policy(const std::string& policy) {
+    memory_eviction_policy_ = policy;
+  }
+
   // get/set UrlReplacement
   const UrlReplacements& url_replacements() const {
     return url_replacements_;
@@ -246,6 +255,9 @@ class SiteSetting : public BaseSetting {
   // Max url number cached in memory.
   int                         max_url_in_memory_;
 
+  // Which urls are evicted first when memory is full.
+  std::string                 memory_eviction_policy_;
+
   // Max url life.
   // Url which is not accessed in the latest "max_url_life_" days is discarded.
   int                         max_url_life_;
@@ -38,6 +38,11 @@ void SiteSettings::ResetToDefault() {
   // Initialize attributes to default values first.
   xml_node_ = NULL;
   backup_duration_ = 600;
+  max_memory_in_mb_ = 0;
+  max_disk_write_in_kb_ = 0;
+  compact_temp_files_ = 8;
+  compact_temp_size_in_mb_ = 256;
+  compact_interval_ = 3600;
   auto_add_ = true;
 
   remote_admin_ = false;
@@ -102,6 +107,11 @@ bool SiteSettings::LoadSetting(TiXmlElement* element) {
 
   // Load attributes from XML if it exists.
   LoadAttribute("backup_duration_in_seconds", backup_duration_);
+  LoadAttribute("max_memory_in_mb", max_memory_in_mb_);
+  LoadAttribute("max_disk_write_in_kb", max_disk_write_in_kb_);
+  LoadAttribute("compact_temp_files", compact_temp_files_);
+  LoadAttribute("compact_temp_size_in_mb", compact_temp_size_in_mb_);
+  LoadAttribute("compact_interval_in_seconds", compact_interval_);
   LoadAttribute("auto_add", auto_add_);
 
   // load admin related info.
@@ -137,6 +147,11 @@ TiXmlElement* SiteSettings::SaveSetting() {
 
   SaveAttribute("auto_add", auto_add_);
   SaveAttribute("backup_duration_in_seconds", backup_duration_);
+  SaveAttribute("max_memory_in_mb", max_memory_in_mb_);
+  SaveAttribute("max_disk_write_in_kb", max_disk_write_in_kb_);
+  SaveAttribute("compact_temp_files", compact_temp_files_);
+  SaveAttribute("compact_temp_size_in_mb", compact_temp_size_in_mb_);
+  SaveAttribute("compact_interval_in_seconds", compact_interval_);
 
   SaveAttribute("remote_admin", remote_admin_);
   SaveAttribute("admin_name", admin_name_);
@@ -201,6 +216,16 @@ bool SiteSettings::Validate() const {
   if (backup_duration_ <= 0)
     return false;
 
+  if (max_memory_in_mb_ < 0)
+    return false;
+
+  if (max_disk_write_in_kb_ < 0)
+    return false;
+
+  if (compact_temp_files_ < 0 || compact_temp_size_in_mb_ < 0
+      || compact_interval_ < 0)
+    return false;
+
   if (logging_level_ < 0) {
     return false;
   }
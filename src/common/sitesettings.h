@@ -102,6 +102,38 @@ class SiteSettings : public BaseSetting {
     backup_duration_ = backup_duration;
   }
 
+  // get/set max memory used by in-memory data of all sites.
+  const int max_memory_in_mb() const { return max_memory_in_mb_; }
+  void set_max_memory_in_mb(int max_memory_in_mb) {
+    max_memory_in_mb_ = max_memory_in_mb;
+  }
+
+  // get/set max speed to write large data files.
+  const int max_disk_write_in_kb() const { return max_disk_write_in_kb_; }
+  void set_max_disk_write_in_kb(int max_disk_write_in_kb) {
+    max_disk_write_in_kb_ = max_disk_write_in_kb;
+  }
+
+  // get/set number of temp files to compact a site database.
+  const int compact_temp_files() const { return compact_temp_files_; }
+  void set_compact_temp_files(int compact_temp_files) {
+    compact_temp_files_ = compact_temp_files;
+  }
+
+  // get/set size of temp files to compact a site database.
+  const int compact_temp_size_in_mb() const {
+    return compact_temp_size_in_mb_;
+  }
+  void set_compact_temp_size_in_mb(int compact_temp_size_in_mb) {
+    compact_temp_size_in_mb_ = compact_temp_size_in_mb;
+  }
+
+  // get/set max time before changes are compacted into a site database.
+  const int compact_interval() const { return compact_interval_; }
+  void set_compact_interval(int compact_interval) {
+    compact_interval_ = compact_interval;
+  }
+
   // get/set auto_add.
   const bool auto_add() const { return auto_add_; }
   void set_auto_add(bool auto_add) {
@@ -161,6 +193,24 @@ class SiteSettings : public BaseSetting {
   // Unit is second.
   int                           backup_duration_;
 
+  // Memory budget shared by in-memory data of all sites. When it is
+  // exceeded, data of some site is flushed to disk.
+  // Unit is MB, and zero means no limit.
+  int                           max_memory_in_mb_;
+
+  // Max speed of writing database files in background compaction, so it
+  // doesn't starve the web server of disk bandwidth.
+  // Unit is KB per second, and zero means no limit.
+  int                           max_disk_write_in_kb_;
+
+  // Site databases are compacted in background, when there are so many
+  // temp files, or temp files are so large, or there are changes not
+  // compacted for so long. Units are file, MB and second, and zero means
+  // the condition is not used.
+  int                           compact_temp_files_;
+  int                           compact_temp_size_in_mb_;
+  int                           compact_interval_;
+
   // Whether automatically add new website even if it's not defined in
   // setting file, but exists in web server configuration file. 
   bool                          auto_add_;
@@ -171,9 +171,15 @@ void Thread::Join() {
   if (WaitForSingleObject(thread_, INFINITE) == WAIT_FAILED) {
     Logger::Log(EVENT_ERROR, "Failed to wait thread exit, ignore.");
   }
+  CloseHandle(stop_event_);
+  CloseHandle(thread_);
 #elif defined(__linux__) || defined(__unix__)
   // All kinds of errors could be ignored.
   void* thread_return;
   pthread_join(thread_, &thread_return);
 #endif
+
+  // The thread is released, so it can't be stopped or joined again.
+  // It also allows this object to be started again.
+  thread_ = 0;
 }
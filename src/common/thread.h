@@ -62,6 +62,7 @@ public:
   void Stop();
 
   // Wait the thread to die.
+  // After that, the thread can be started again.
   void Join();
 
 protected:
@@ -40,7 +40,8 @@ void ApplicationInfo::Reset() {
   }
 }
 
-// TODO: caculate disk and memory usage.
+// TODO: caculate disk usage.
+// Memory usage of sites is reported by their data managers.
 void ApplicationInfo::AutomaticUpdate() {
   memory_used_ = 0;
   disk_used_ = 0;
@@ -49,7 +50,6 @@ void ApplicationInfo::AutomaticUpdate() {
   std::map<std::string, SiteInfo>::iterator itr = site_infos_.begin();
   for (; itr != site_infos_.end(); ++itr) {
     SiteInfo& info = itr->second;
-    info.set_memory_used(entry_size * info.url_in_memory());
     info.set_disk_used(entry_size * (info.url_in_database() + info.url_in_tempfile()));
 
     memory_used_ += info.memory_used();
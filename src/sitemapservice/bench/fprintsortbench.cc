@@ -0,0 +1,117 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Benchmark of FprintSorter against std::sort, on the record pointers which
+// RecordTable sorts when it is saved. It is built by "make bench", and not
+// by default.
+// Usage: fprintsortbench [thread_count [entry_count ...]]
+// By default, the number of processors is used, with 1M and 10M entries.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <vector>
+
+#include "common/url.h"
+#include "sitemapservice/fprintsorter.h"
+#include "sitemapservice/visitingrecord.h"
+
+namespace {
+
+// Runs of every sort, and the best one is reported.
+const int kRounds = 3;
+
+// Get current time in milliseconds.
+int64 GetMilliseconds() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return static_cast<int64>(now.tv_sec) * 1000 + now.tv_usec / 1000;
+}
+
+bool FprintLess(const VisitingRecord* a, const VisitingRecord* b) {
+  return a->fingerprint() < b->fingerprint();
+}
+
+// Sorts "count" records of made up urls both ways, and reports the time.
+// Returns false if the results are different.
+bool RunBenchmark(int count, int thread_count) {
+  std::vector<VisitingRecord> records(count);
+  char url[64];
+  for (int i = 0; i < count; ++i) {
+    sprintf(url, "/dir%d/page%d.html", i % 1000, i);
+    records[i].set_fingerprint(Url::FingerPrint(url));
+  }
+  std::vector<const VisitingRecord*> input(count);
+  for (int i = 0; i < count; ++i) {
+    input[i] = &records[i];
+  }
+  std::random_shuffle(input.begin(), input.end());
+
+  int64 std_best = -1, radix_best = -1;
+  std::vector<const VisitingRecord*> std_sorted, radix_sorted;
+  for (int round = 0; round < kRounds; ++round) {
+    std_sorted = input;
+    int64 start = GetMilliseconds();
+    std::sort(std_sorted.begin(), std_sorted.end(), FprintLess);
+    int64 elapsed = GetMilliseconds() - start;
+    if (std_best < 0 || elapsed < std_best) std_best = elapsed;
+
+    radix_sorted = input;
+    FprintSorter sorter(thread_count);
+    start = GetMilliseconds();
+    sorter.Sort(&radix_sorted);
+    elapsed = GetMilliseconds() - start;
+    if (radix_best < 0 || elapsed < radix_best) radix_best = elapsed;
+  }
+
+  for (int i = 0; i < count; ++i) {
+    if (std_sorted[i]->fingerprint() != radix_sorted[i]->fingerprint()) {
+      fprintf(stderr, "Results differ at [%d] of [%d] entries.\n", i, count);
+      return false;
+    }
+  }
+
+  printf("%10d entries: std::sort %6lld ms, FprintSorter %6lld ms\n",
+         count, static_cast<long long>(std_best),
+         static_cast<long long>(radix_best));
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int thread_count = argc > 1 ? atoi(argv[1]) : 0;
+  if (thread_count <= 0) {
+    thread_count = FprintSorter::GetProcessorCount();
+  }
+
+  std::vector<int> counts;
+  for (int i = 2; i < argc; ++i) {
+    counts.push_back(atoi(argv[i]));
+  }
+  if (counts.empty()) {
+    counts.push_back(1000000);
+    counts.push_back(10000000);
+  }
+
+  printf("FprintSorter with %d threads.\n", thread_count);
+  for (int i = 0; i < static_cast<int>(counts.size()); ++i) {
+    if (!RunBenchmark(counts[i], thread_count)) {
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,181 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Benchmark of the k-way merges of RecordMerger, with different numbers of
+// inputs of the same total size. It is built by "make bench", and not by
+// default.
+// Usage: recordmergebench dir [record_count [input_count ...]]
+// Input files are written to "dir", which should exist, and they are
+// removed at the end. By default, 1M records are merged from 2, 16 and 128
+// inputs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "common/fileutil.h"
+#include "common/url.h"
+#include "sitemapservice/recordfilestat.h"
+#include "sitemapservice/recordmerger.h"
+#include "sitemapservice/recordtable.h"
+#include "sitemapservice/urlfprintio.h"
+
+namespace {
+
+// Runs of every merge, and the best one is reported.
+const int kRounds = 3;
+
+// Get current time in milliseconds.
+int64 GetMilliseconds() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return static_cast<int64>(now.tv_sec) * 1000 + now.tv_usec / 1000;
+}
+
+// Writes "input_count" record files and finger print files to "dir", with
+// "record_count" records in total. Urls are picked at random, so some of
+// them are in several files, like the same url visited in different temp
+// files.
+// Returns false if a file can't be written.
+bool WriteInputs(const std::string& dir, int record_count, int input_count,
+                 std::vector<std::string>* records,
+                 std::vector<std::string>* fprints) {
+  char name[1024];
+  for (int i = 0; i < input_count; ++i) {
+    RecordTable table("www.example.com", record_count);
+    std::vector<UrlFprint> fps;
+    for (int j = 0; j < record_count / input_count; ++j) {
+      char url[64];
+      sprintf(url, "/dir%d/page%d.html", j % 1000, rand() % record_count);
+      table.AddRecord(url, 1000 + rand() % 100000, rand() % 5, -1);
+      fps.push_back(Url::FingerPrint(url));
+    }
+
+    sprintf(name, "%s/records_%d", dir.c_str(), i);
+    records->push_back(name);
+    if (table.Flush(name) != 0) {
+      fprintf(stderr, "Failed to write [%s].\n", name);
+      return false;
+    }
+
+    std::sort(fps.begin(), fps.end());
+    fps.erase(std::unique(fps.begin(), fps.end()), fps.end());
+    sprintf(name, "%s/fprints_%d", dir.c_str(), i);
+    fprints->push_back(name);
+    UrlFprintWriter writer;
+    if (!writer.Open(name)) {
+      fprintf(stderr, "Failed to open [%s].\n", name);
+      return false;
+    }
+    for (int j = 0; j < static_cast<int>(fps.size()); ++j) {
+      writer.Write(fps[j]);
+    }
+    if (!writer.Close()) {
+      fprintf(stderr, "Failed to write [%s].\n", name);
+      return false;
+    }
+  }
+  return true;
+}
+
+void RemoveFiles(const std::vector<std::string>& files) {
+  for (int i = 0; i < static_cast<int>(files.size()); ++i) {
+    RecordMerger::RemoveDatabaseFile(files[i]);
+  }
+}
+
+// Merges "record_count" records from "input_count" files both as records
+// and as finger prints, and reports the time.
+// Returns false if a merge fails.
+bool RunBenchmark(const std::string& dir, int record_count,
+                  int input_count) {
+  std::vector<std::string> records, fprints;
+  bool result = WriteInputs(dir, record_count, input_count,
+                            &records, &fprints);
+
+  std::string destination = dir + "/merged";
+  std::string fp_dest = dir + "/merged_fp";
+  std::string fp_merged = dir + "/merged_fprints";
+  std::vector<std::string> tombstones;
+  RecordMerger merger;
+  RecordFileStat stat;
+  int64 merge_best = -1, fprint_best = -1;
+  for (int round = 0; result && round < kRounds; ++round) {
+    int64 start = GetMilliseconds();
+    if (merger.Merge(destination, fp_dest, records, tombstones, 0,
+                     &stat) != 0) {
+      fprintf(stderr, "Failed to merge records.\n");
+      result = false;
+      break;
+    }
+    int64 elapsed = GetMilliseconds() - start;
+    if (merge_best < 0 || elapsed < merge_best) merge_best = elapsed;
+
+    start = GetMilliseconds();
+    if (!merger.MergeUrlFprint(fp_merged, fprints, tombstones)) {
+      fprintf(stderr, "Failed to merge finger prints.\n");
+      result = false;
+      break;
+    }
+    elapsed = GetMilliseconds() - start;
+    if (fprint_best < 0 || elapsed < fprint_best) fprint_best = elapsed;
+  }
+
+  if (result) {
+    printf("%4d inputs: %d urls, Merge %6lld ms, MergeUrlFprint %6lld ms\n",
+           input_count, stat.GetTotalCount(),
+           static_cast<long long>(merge_best),
+           static_cast<long long>(fprint_best));
+  }
+
+  RemoveFiles(records);
+  RemoveFiles(fprints);
+  RecordMerger::RemoveDatabaseFile(destination);
+  remove(fp_merged.c_str());
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2 || !FileUtil::Exists(argv[1])) {
+    fprintf(stderr,
+            "Usage: %s dir [record_count [input_count ...]]\n", argv[0]);
+    return 1;
+  }
+  std::string dir(argv[1]);
+  int record_count = argc > 2 ? atoi(argv[2]) : 1000000;
+
+  std::vector<int> input_counts;
+  for (int i = 3; i < argc; ++i) {
+    input_counts.push_back(atoi(argv[i]));
+  }
+  if (input_counts.empty()) {
+    input_counts.push_back(2);
+    input_counts.push_back(16);
+    input_counts.push_back(128);
+  }
+
+  srand(0);
+  for (int i = 0; i < static_cast<int>(input_counts.size()); ++i) {
+    if (!RunBenchmark(dir, record_count, input_counts[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -83,12 +83,6 @@ void BlogSearchPingService::Run() {
   time_t cut_down = last_run_;
   time(&last_run_);
 
-  // Update the database.
-  if (!data_manager_->UpdateDatabase()) {
-    Logger::Log(EVENT_ERROR, "Failed to update database for blog ping.");
-    return;
-  }
-
   // Get host name for the site.
   std::string hostname;
   if (!data_manager_->GetHostName(&hostname)) {
@@ -96,35 +90,30 @@ void BlogSearchPingService::Run() {
     return;
   }
 
-  // Lock data base to read.
-  if (!data_manager_->LockDiskData(true)) {
-    Logger::Log(EVENT_ERROR, "Failed to lock site data for blog ping.");
-    return;
-  }
-
+  // Data base is updated in background by the compactor, so current files
+  // are read without merging. Only a few records are changed since last run,
+  // so only they are read if possible.
   bool result = false;
   RecordFileReader* reader = NULL;
   do {
-    // Open data base to read.
-    std::string data_base = data_manager_->GetFileManager()->GetBaseFile();
-    reader = RecordFileIOFactory::CreateReader(data_base);
+    reader = data_manager_->CreateChangeReader(cut_down);
     if (reader == NULL) {
       Logger::Log(EVENT_ERROR, "Failed to open data base to read for ping.");
       break;
     }
 
     // Process url one by one.
-    VisitingRecord record;
+    const VisitingRecord* record = NULL;
     int ping_count = 0;
-    while (reader->Read(&record) == 0) {
+    while ((record = reader->Next()) != NULL) {
       // Next round is coming, exit this round.
       if (GetWaitTime() <= 0) {
         Logger::Log(EVENT_NORMAL, "Next ping round begins. Skip this round.");
         break;
       }
 
-      if (!Check(record, cut_down)) {
-        Logger::Log(EVENT_NORMAL, "Skip to ping [%s].", record.url());
+      if (!Check(*record, cut_down)) {
+        Logger::Log(EVENT_NORMAL, "Skip to ping [%s].", record->url());
         continue;
       }
 
@@ -135,7 +124,7 @@ void BlogSearchPingService::Run() {
       }
 
       std::string full_url(hostname);
-      full_url.append(record.url());
+      full_url.append(record->url());
       bool success = Ping(full_url.c_str());
 
       // Update runtime info
@@ -157,7 +146,6 @@ void BlogSearchPingService::Run() {
   } while (false);
 
   if (reader != NULL) delete reader;
-  data_manager_->UnlockDiskData();
 }
 
 bool BlogSearchPingService::Check(const VisitingRecord& record, time_t cut_down) {
@@ -0,0 +1,198 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "sitemapservice/compactor.h"
+
+#include <vector>
+
+#include "common/logger.h"
+#include "common/port.h"
+#include "common/sequentialwriter.h"
+
+std::map<Compactor::Database*, Compactor::State> Compactor::databases_;
+Compactor::Database* Compactor::last_ = NULL;
+Compactor::Triggers Compactor::triggers_ = {0, 0, 0};
+bool Compactor::running_ = false;
+bool Compactor::stopping_ = false;
+CriticalSection Compactor::lock_;
+CriticalSection Compactor::compact_lock_;
+Thread Compactor::thread_(Thread::PRIORITY_LOW);
+
+void Compactor::SetTriggers(const Triggers& triggers) {
+  lock_.Enter(true);
+  triggers_ = triggers;
+  lock_.Leave();
+}
+
+Compactor::Triggers Compactor::GetTriggers() {
+  lock_.Enter(true);
+  Triggers triggers = triggers_;
+  lock_.Leave();
+  return triggers;
+}
+
+bool Compactor::Start() {
+  lock_.Enter(true);
+  AutoLeave autoleave(&lock_);
+  if (running_) return true;
+
+  stopping_ = false;
+  if (!thread_.Start(&ThreadEntry, NULL)) {
+    Logger::Log(EVENT_ERROR, "Failed to start compaction thread.");
+    return false;
+  }
+  running_ = true;
+  return true;
+}
+
+void Compactor::Stop() {
+  lock_.Enter(true);
+  stopping_ = true;
+  lock_.Leave();
+
+  // The thread checks stopping_ between compactions, so it is not cancelled
+  // in the middle of a merge.
+  thread_.Join();
+
+  lock_.Enter(true);
+  running_ = false;
+  lock_.Leave();
+}
+
+void Compactor::Register(Database* database) {
+  State state;
+  state.requested = false;
+  state.failures = 0;
+  state.retry_time = 0;
+
+  lock_.Enter(true);
+  databases_[database] = state;
+  lock_.Leave();
+}
+
+void Compactor::Unregister(Database* database) {
+  // Wait if the database is being compacted.
+  compact_lock_.Enter(true);
+  lock_.Enter(true);
+  databases_.erase(database);
+  if (last_ == database) last_ = NULL;
+  lock_.Leave();
+  compact_lock_.Leave();
+}
+
+bool Compactor::Request(Database* database) {
+  lock_.Enter(true);
+  AutoLeave autoleave(&lock_);
+  if (!running_ || stopping_) return false;
+
+  std::map<Database*, State>::iterator itr = databases_.find(database);
+  if (itr == databases_.end()) return false;
+
+  itr->second.requested = true;
+  return true;
+}
+
+void* Compactor::ThreadEntry(void* /* param */) {
+  Logger::Log(EVENT_NORMAL, "Compaction thread is started.");
+  SequentialWriter::SetThreadThrottled(true);
+
+  int idle = kCheckInterval;
+  while (true) {
+    lock_.Enter(true);
+    bool stopping = stopping_;
+    bool requested = false;
+    std::map<Database*, State>::iterator itr = databases_.begin();
+    for (; itr != databases_.end(); ++itr) {
+      requested = requested || itr->second.requested;
+    }
+    lock_.Leave();
+    if (stopping) break;
+
+    // Keep compacting while any database needs it. A requested database
+    // may be waiting to retry, so the thread sleeps if nothing is done.
+    if (requested || idle >= kCheckInterval) {
+      if (CompactNext()) {
+        idle = kCheckInterval;
+        continue;
+      }
+      idle = 0;
+    }
+    Sleep(1000);
+    ++idle;
+  }
+
+  Logger::Log(EVENT_NORMAL, "Compaction thread is stopped.");
+  return NULL;
+}
+
+bool Compactor::CompactNext() {
+  compact_lock_.Enter(true);
+  lock_.Enter(true);
+  Database* database = ChooseDatabase(time(NULL));
+  if (database != NULL) last_ = database;
+  lock_.Leave();
+
+  // The database can't be unregistered until compact_lock_ is released.
+  if (database != NULL) {
+    bool success = database->Compact();
+
+    // Requests during the compaction are satisfied by it. After a failure,
+    // it is retried later, instead of merging again at once.
+    lock_.Enter(true);
+    std::map<Database*, State>::iterator itr = databases_.find(database);
+    if (itr != databases_.end()) {
+      State& state = itr->second;
+      state.requested = false;
+      if (success) {
+        state.failures = 0;
+        state.retry_time = 0;
+      } else {
+        int interval = kCheckInterval;
+        for (int i = 0; i < state.failures && interval < kMaxRetryInterval;
+             ++i) {
+          interval *= 2;
+        }
+        if (interval > kMaxRetryInterval) interval = kMaxRetryInterval;
+        ++state.failures;
+        state.retry_time = time(NULL) + interval;
+      }
+    }
+    lock_.Leave();
+  }
+  compact_lock_.Leave();
+
+  return database != NULL;
+}
+
+Compactor::Database* Compactor::ChooseDatabase(time_t now) {
+  // Databases in the order to check, starting after last_.
+  std::vector<Database*> order;
+  std::map<Database*, State>::iterator start = databases_.upper_bound(last_);
+  std::map<Database*, State>::iterator itr = start;
+  for (; itr != databases_.end(); ++itr) {
+    if (itr->second.retry_time <= now) order.push_back(itr->first);
+  }
+  for (itr = databases_.begin(); itr != start; ++itr) {
+    if (itr->second.retry_time <= now) order.push_back(itr->first);
+  }
+
+  for (int i = 0; i < static_cast<int>(order.size()); ++i) {
+    if (databases_[order[i]].requested) return order[i];
+  }
+  for (int i = 0; i < static_cast<int>(order.size()); ++i) {
+    if (order[i]->NeedCompaction(triggers_)) return order[i];
+  }
+  return NULL;
+}
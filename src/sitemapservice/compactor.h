@@ -0,0 +1,143 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Compactor updates the databases of all sites in a background thread, so
+// the sitemap services don't trigger merges, but read whatever database is
+// current. A database is compacted when any of the triggers is hit: too
+// many temp files, too large temp files, or changes not merged for too long.
+// A site could also request to be compacted, for example when its temp files
+// exceed the limit of the file manager.
+// The thread runs with low priority, and sites are compacted one at a time,
+// in turn. A database which fails to be compacted is retried later, with a
+// longer interval after every failure.
+// The thread is throttled by SequentialWriter, so merged files are written
+// within its rate limit, see SequentialWriter::SetRateLimit.
+// Like MemoryBudget, this class is not implemented as a singleton, and all
+// its methods are declared as static.
+// This class is thread-safe.
+
+#ifndef SITEMAPSERVICE_COMPACTOR_H__
+#define SITEMAPSERVICE_COMPACTOR_H__
+
+#include <time.h>
+#include <map>
+#include "common/basictypes.h"
+#include "common/criticalsection.h"
+#include "common/thread.h"
+
+class Compactor {
+ public:
+  // Conditions to compact a database. Zero means the condition is disabled.
+  struct Triggers {
+    // Number of temp files.
+    int temp_files;
+
+    // Total size of temp files in bytes.
+    int64 temp_bytes;
+
+    // Seconds since the database is updated, if there is any change.
+    int interval;
+  };
+
+  // Interface of databases compacted in background.
+  class Database {
+   public:
+    virtual ~Database() {}
+
+    // Returns whether the database should be compacted with "triggers".
+    // It should be quick, because it is called for every database
+    // periodically.
+    virtual bool NeedCompaction(const Triggers& triggers) = 0;
+
+    // Merge changes into the database.
+    // Returns false if it fails.
+    virtual bool Compact() = 0;
+  };
+
+  // Databases are checked every so many seconds.
+  static const int kCheckInterval = 10;
+
+  // Max seconds to wait before retrying a database which failed.
+  static const int kMaxRetryInterval = 3600;
+
+  // Set the conditions to compact databases.
+  static void SetTriggers(const Triggers& triggers);
+
+  static Triggers GetTriggers();
+
+  // Start the background thread.
+  static bool Start();
+
+  // Stop the background thread. It waits for the compaction in progress.
+  static void Stop();
+
+  // Register a database to compact.
+  static void Register(Database* database);
+
+  // Unregister a database. It is ensured that the database is not being
+  // compacted, or compacted anymore, after this method returns.
+  static void Unregister(Database* database);
+
+  // Ask to compact a registered database as soon as possible.
+  // Returns false if the thread is not running, in which case the caller
+  // should merge the data itself.
+  static bool Request(Database* database);
+
+ private:
+  // Entry point of thread_.
+  static void* ThreadEntry(void* param);
+
+  // Compact the next database which needs it.
+  // Returns false if no database is compacted.
+  static bool CompactNext();
+
+  // State of a registered database.
+  struct State {
+    // Whether compaction is requested.
+    bool requested;
+
+    // Number of failures in a row, and the time to retry after them.
+    int failures;
+    time_t retry_time;
+  };
+
+  // Choose a database to compact. lock_ should be held.
+  // Requested databases are chosen first. Databases are checked from the
+  // one after last_, and those waiting to retry are skipped.
+  // Returns NULL if no database needs compaction.
+  static Database* ChooseDatabase(time_t now);
+
+  // All registered databases.
+  static std::map<Database*, State> databases_;
+
+  // The database compacted last time.
+  static Database* last_;
+
+  static Triggers triggers_;
+
+  // Whether thread_ is started, and whether it is asked to stop.
+  static bool running_;
+  static bool stopping_;
+
+  // Lock for all data above.
+  static CriticalSection lock_;
+
+  // Held while compacting a database, so Unregister could wait for it.
+  static CriticalSection compact_lock_;
+
+  static Thread thread_;
+};
+
+#endif // SITEMAPSERVICE_COMPACTOR_H__
@@ -0,0 +1,178 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "sitemapservice/fprintfilter.h"
+
+#include <algorithm>
+#include "common/logger.h"
+#include "common/fileutil.h"
+#include "common/mappedfile.h"
+#include "third_party/zlib/zlib.h"
+
+namespace {
+
+uint32 Checksum(const void* data, uint64 size) {
+  const Bytef* bytes = static_cast<const Bytef*>(data);
+  uLong crc = crc32(0L, Z_NULL, 0);
+  while (size > 0) {
+    uInt length = size > 0x40000000 ? 0x40000000 : static_cast<uInt>(size);
+    crc = crc32(crc, bytes, length);
+    bytes += length;
+    size -= length;
+  }
+  return static_cast<uint32>(crc);
+}
+
+}  // namespace
+
+FprintFilter::FprintFilter() {
+  Reset(0);
+}
+
+void FprintFilter::Reset(int64 capacity) {
+  // At least one word is used, so no special case is needed for empty filter.
+  uint64 words = (capacity * kBitsPerFprint + 63) / 64;
+  if (words == 0) words = 1;
+
+  bits_.assign(static_cast<size_t>(words), 0);
+  bit_count_ = words * 64;
+  count_ = 0;
+}
+
+bool FprintFilter::Build(const char* fp_file, int64 capacity) {
+  if (!FileUtil::Exists(fp_file)) {
+    Reset(capacity);
+    return true;
+  }
+
+  // The finger print file is a plain array of finger prints.
+  MappedFile file;
+  if (!file.Open(fp_file)) {
+    return false;
+  }
+
+  int64 n = file.size() / sizeof(UrlFprint);
+  Reset(n > capacity ? n : capacity);
+
+  const UrlFprint* fprints = reinterpret_cast<const UrlFprint*>(file.data());
+  for (int64 i = 0; i < n; ++i) {
+    Add(fprints[i]);
+  }
+  return true;
+}
+
+bool FprintFilter::Load(const char* path) {
+  if (!FileUtil::Exists(path)) {
+    return false;
+  }
+
+  MappedFile file;
+  if (!file.Open(path)) {
+    return false;
+  }
+
+  const FileHeader* header = reinterpret_cast<const FileHeader*>(file.data());
+  if (file.size() < static_cast<int64>(sizeof(FileHeader))
+      || header->version != kVersion
+      || header->header_crc != Checksum(header, sizeof(FileHeader)
+                                        - sizeof(header->header_crc))
+      || header->bit_count == 0 || header->bit_count % 64 != 0
+      || static_cast<uint64>(file.size())
+         != sizeof(FileHeader) + header->bit_count / 8) {
+    Logger::Log(EVENT_ERROR, "Invalid finger print filter [%s].", path);
+    return false;
+  }
+
+  const uint64* bits = reinterpret_cast<const uint64*>(header + 1);
+  if (header->bits_crc != Checksum(bits, header->bit_count / 8)) {
+    Logger::Log(EVENT_ERROR, "Corrupted finger print filter [%s].", path);
+    return false;
+  }
+
+  bits_.assign(bits, bits + header->bit_count / 64);
+  bit_count_ = header->bit_count;
+  count_ = header->count;
+  return true;
+}
+
+bool FprintFilter::Save(const char* path) const {
+  FileHeader header;
+  memset(&header, 0, sizeof(header));
+  header.version = kVersion;
+  header.bit_count = bit_count_;
+  header.count = count_;
+  header.bits_crc = Checksum(&bits_[0], bits_.size() * sizeof(uint64));
+  header.header_crc = Checksum(&header, sizeof(FileHeader)
+                               - sizeof(header.header_crc));
+
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) {
+    Logger::Log(EVENT_ERROR, "Failed to open [%s] to write.", path);
+    return false;
+  }
+
+  bool result = fwrite(&header, sizeof(header), 1, file) == 1
+    && fwrite(&bits_[0], sizeof(uint64), bits_.size(), file) == bits_.size();
+  if (fclose(file) != 0) {
+    result = false;
+  }
+
+  if (!result) {
+    Logger::Log(EVENT_ERROR, "Failed to save finger print filter [%s].", path);
+  }
+  return result;
+}
+
+void FprintFilter::GetHashes(const UrlFprint& fprint,
+                             uint64* h1, uint64* h2) const {
+  // Finger print is not well distributed, so it is mixed first.
+  uint64 hash = fprint;
+  hash ^= hash >> 33;
+  hash *= 0xFF51AFD7ED558CCDULL;
+  hash ^= hash >> 33;
+  hash *= 0xC4CEB9FE1A85EC53ULL;
+  hash ^= hash >> 33;
+
+  *h1 = hash;
+  *h2 = (hash >> 32 | hash << 32) | 1;
+}
+
+bool FprintFilter::Contains(const UrlFprint& fprint) const {
+  uint64 h1, h2;
+  GetHashes(fprint, &h1, &h2);
+  for (int i = 0; i < kHashCount; ++i) {
+    uint64 bit = (h1 + i * h2) % bit_count_;
+    if ((bits_[bit >> 6] & (1ULL << (bit & 63))) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void FprintFilter::Add(const UrlFprint& fprint) {
+  uint64 h1, h2;
+  GetHashes(fprint, &h1, &h2);
+  for (int i = 0; i < kHashCount; ++i) {
+    uint64 bit = (h1 + i * h2) % bit_count_;
+    bits_[bit >> 6] |= 1ULL << (bit & 63);
+  }
+  ++count_;
+}
+
+void FprintFilter::Swap(FprintFilter* another) {
+  bits_.swap(another->bits_);
+  std::swap(bit_count_, another->bit_count_);
+  std::swap(count_, another->count_);
+}
@@ -0,0 +1,95 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// FprintFilter is a Bloom filter of url finger prints, which is used to tell
+// whether a url is new to the site without scanning the files on disk.
+// It is rebuilt from the finger print files of database after the base file
+// is merged, which may remove urls. Finger prints flushed to temporary files
+// and merged into new level files are added incrementally, so it contains
+// all urls known by the site.
+// The bits are kept in memory, and counted in the memory usage of the site.
+// A url which is not contained is definitely new. A contained url may be new
+// with a small probability (about 1% when the filter is not over filled).
+// This class is not thread-safe.
+
+#ifndef SITEMAPSERVICE_FPRINTFILTER_H__
+#define SITEMAPSERVICE_FPRINTFILTER_H__
+
+#include <vector>
+#include "common/basictypes.h"
+#include "common/url.h"
+
+class FprintFilter {
+ public:
+  // Number of bits per finger print, and number of hash functions.
+  static const int kBitsPerFprint = 10;
+  static const int kHashCount = 7;
+
+  // Version of the filter file.
+  static const uint64 kVersion = 200910011500ULL;
+
+  FprintFilter();
+  ~FprintFilter() {}
+
+  // Clears the filter, and resizes it to hold "capacity" finger prints.
+  void Reset(int64 capacity);
+
+  // Rebuilds the filter from a finger print file.
+  // The filter is sized for the larger one of "capacity" and number of
+  // finger prints in the file. A missing file results an empty filter.
+  bool Build(const char* fp_file, int64 capacity);
+
+  // Loads and saves the filter.
+  // Load returns false if the file is missing or corrupted.
+  bool Load(const char* path);
+  bool Save(const char* path) const;
+
+  // Returns false if the finger print is definitely not added.
+  bool Contains(const UrlFprint& fprint) const;
+
+  // Adds a finger print.
+  void Add(const UrlFprint& fprint);
+
+  // Returns number of finger prints added.
+  int64 count() const { return count_; }
+
+  // Returns memory used by the bits.
+  int64 MemoryUsage() const {
+    return static_cast<int64>(bits_.size() * sizeof(uint64));
+  }
+
+  void Swap(FprintFilter* another);
+
+ private:
+  // Header of the filter file, followed by the bits.
+  struct FileHeader {
+    uint64 version;
+    uint64 bit_count;
+    int64 count;
+    uint32 bits_crc;
+    uint32 header_crc;
+  };
+
+  // Gets the two hash values, used to derive all kHashCount bit positions.
+  void GetHashes(const UrlFprint& fprint, uint64* h1, uint64* h2) const;
+
+  std::vector<uint64> bits_;
+  uint64 bit_count_;
+  int64 count_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(FprintFilter);
+};
+
+#endif // SITEMAPSERVICE_FPRINTFILTER_H__
@@ -0,0 +1,191 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "sitemapservice/fprintsorter.h"
+
+#include "common/thread.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+enum Phase {
+  PHASE_HISTOGRAM,
+  PHASE_SCATTER
+};
+
+}  // namespace
+
+// A thread working on a slice of the input in one phase.
+class FprintSorter::Worker : public Thread {
+ public:
+  Worker() {}
+
+  void Initialize(int phase, int begin, int end, int shift,
+                  const UrlFprint* keys, const VisitingRecord* const* records,
+                  UrlFprint* dest_keys, const VisitingRecord** dest_records,
+                  int* histogram) {
+    phase_ = phase;
+    begin_ = begin;
+    end_ = end;
+    shift_ = shift;
+    keys_ = keys;
+    records_ = records;
+    dest_keys_ = dest_keys;
+    dest_records_ = dest_records;
+    histogram_ = histogram;
+  }
+
+  virtual void Run() {
+    const UrlFprint mask = kBucketCount - 1;
+    if (phase_ == PHASE_HISTOGRAM) {
+      for (int i = 0; i < kBucketCount; ++i) {
+        histogram_[i] = 0;
+      }
+      for (int i = begin_; i < end_; ++i) {
+        ++histogram_[(keys_[i] >> shift_) & mask];
+      }
+    } else {
+      // histogram_ contains the offsets of every digit for this slice.
+      for (int i = begin_; i < end_; ++i) {
+        int position = histogram_[(keys_[i] >> shift_) & mask]++;
+        dest_keys_[position] = keys_[i];
+        dest_records_[position] = records_[i];
+      }
+    }
+  }
+
+ private:
+  int phase_;
+  int begin_;
+  int end_;
+  int shift_;
+  const UrlFprint* keys_;
+  const VisitingRecord* const* records_;
+  UrlFprint* dest_keys_;
+  const VisitingRecord** dest_records_;
+  int* histogram_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(Worker);
+};
+
+FprintSorter::FprintSorter(int thread_count) {
+  if (thread_count <= 0) {
+    thread_count = GetProcessorCount();
+  }
+  if (thread_count > kMaxThreadCount) {
+    thread_count = kMaxThreadCount;
+  }
+  thread_count_ = thread_count;
+  source_ = 0;
+  shift_ = 0;
+}
+
+int FprintSorter::GetProcessorCount() {
+#ifdef WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  int count = static_cast<int>(info.dwNumberOfProcessors);
+#else
+  int count = static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+  return count > 0 ? count : 1;
+}
+
+void FprintSorter::Sort(std::vector<const VisitingRecord*>* records) {
+  int size = static_cast<int>(records->size());
+  if (size < 2) return;
+
+  int thread_count = size < kParallelThreshold ? 1 : thread_count_;
+  histograms_.assign(thread_count, std::vector<int>(kBucketCount));
+
+  // Extract the keys.
+  source_ = 0;
+  keys_[0].resize(size);
+  keys_[1].resize(size);
+  records_[0].swap(*records);
+  records_[1].resize(size);
+  for (int i = 0; i < size; ++i) {
+    keys_[0][i] = records_[0][i]->fingerprint();
+  }
+
+  for (shift_ = 0; shift_ < 64; shift_ += kRadixBits) {
+    RunPhase(PHASE_HISTOGRAM, thread_count);
+
+    // Turn histograms into offsets, where slices of same digit are placed
+    // in slice order, so the sort is stable.
+    // The pass is skipped if all keys have the same digit.
+    int offset = 0;
+    bool trivial = false;
+    for (int digit = 0; digit < kBucketCount && !trivial; ++digit) {
+      int count = 0;
+      for (int t = 0; t < thread_count; ++t) {
+        int value = histograms_[t][digit];
+        histograms_[t][digit] = offset;
+        offset += value;
+        count += value;
+      }
+      trivial = count == size;
+    }
+    if (trivial) continue;
+
+    RunPhase(PHASE_SCATTER, thread_count);
+    source_ = 1 - source_;
+  }
+
+  records->swap(records_[source_]);
+
+  // Release the buffers.
+  std::vector<UrlFprint>().swap(keys_[0]);
+  std::vector<UrlFprint>().swap(keys_[1]);
+  std::vector<const VisitingRecord*>().swap(records_[0]);
+  std::vector<const VisitingRecord*>().swap(records_[1]);
+}
+
+void FprintSorter::RunPhase(int phase, int thread_count) {
+  int size = static_cast<int>(keys_[source_].size());
+  int target = 1 - source_;
+
+  std::vector<Worker*> workers(thread_count);
+  for (int t = 0; t < thread_count; ++t) {
+    int begin = static_cast<int>(static_cast<int64>(size) * t / thread_count);
+    int end = static_cast<int>(static_cast<int64>(size) * (t + 1)
+                               / thread_count);
+    workers[t] = new Worker();
+    workers[t]->Initialize(phase, begin, end, shift_,
+                           &keys_[source_][0], &records_[source_][0],
+                           &keys_[target][0], &records_[target][0],
+                           &histograms_[t][0]);
+  }
+
+  // The first slice is always done by calling thread.
+  for (int t = 1; t < thread_count; ++t) {
+    if (!workers[t]->Start()) {
+      workers[t]->Run();
+    }
+  }
+  workers[0]->Run();
+  for (int t = 1; t < thread_count; ++t) {
+    workers[t]->Join();
+  }
+
+  for (int t = 0; t < thread_count; ++t) {
+    delete workers[t];
+  }
+}
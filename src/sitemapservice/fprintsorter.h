@@ -0,0 +1,77 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// FprintSorter sorts visiting records by url finger print, with a parallel
+// LSD radix sort. The finger prints are extracted to a separate key array,
+// so every pass only touches keys and record pointers sequentially, and no
+// comparison is needed.
+// Each pass is split into a histogram phase and a scatter phase, both of
+// which are done by several threads on contiguous slices of the input.
+
+#ifndef SITEMAPSERVICE_FPRINTSORTER_H__
+#define SITEMAPSERVICE_FPRINTSORTER_H__
+
+#include <vector>
+#include "common/basictypes.h"
+#include "common/url.h"
+#include "sitemapservice/visitingrecord.h"
+
+class FprintSorter {
+ public:
+  // Number of bits sorted in one pass.
+  static const int kRadixBits = 11;
+  static const int kBucketCount = 1 << kRadixBits;
+
+  // Inputs smaller than this are sorted in calling thread.
+  static const int kParallelThreshold = 1 << 16;
+
+  // Max number of sorting threads.
+  static const int kMaxThreadCount = 8;
+
+  // If "thread_count" is not positive, the number of processors is used.
+  explicit FprintSorter(int thread_count);
+  ~FprintSorter() {}
+
+  // Sorts records in ascending order by finger print.
+  void Sort(std::vector<const VisitingRecord*>* records);
+
+  // Returns the number of processors, which is at least 1.
+  static int GetProcessorCount();
+
+ private:
+  class Worker;
+
+  // Runs one phase for current pass on all slices.
+  void RunPhase(int phase, int thread_count);
+
+  int thread_count_;
+
+  // Keys and records being sorted, and buffers for the next pass.
+  std::vector<UrlFprint> keys_[2];
+  std::vector<const VisitingRecord*> records_[2];
+
+  // Index of buffers used as source in current pass.
+  int source_;
+
+  // Shift of the digit sorted in current pass.
+  int shift_;
+
+  // Per slice histograms, which are turned into scatter offsets.
+  std::vector<std::vector<int> > histograms_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(FprintSorter);
+};
+
+#endif // SITEMAPSERVICE_FPRINTSORTER_H__
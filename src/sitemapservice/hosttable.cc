@@ -15,8 +15,14 @@
 
 #include "sitemapservice/hosttable.h"
 
-HostTable::HostTable(const char* siteid)
+#include <cassert>
+#include <algorithm>
+
+HostTable::HostTable(const char* siteid, int capacity)
   : siteid_(siteid) {
+  assert(capacity > 0);
+  capacity_ = capacity;
+  best_ = 0;
 }
 
 HostTable::~HostTable() {
@@ -24,54 +30,90 @@ HostTable::~HostTable() {
 }
 
 std::vector<HostInfo> HostTable::GetAllHosts() const {
-  // Iterate through the hash table to get host name.
+  // Iterate through the heap to get host name.
   std::vector<HostInfo> infos;
-  HashTable::const_iterator itr = hosts_.begin();
-  for (; itr != hosts_.end(); ++itr) {
-    infos.push_back(itr->second);
+  for (int i = 0; i < static_cast<int>(hosts_.size()); ++i) {
+    infos.push_back(hosts_[i].info);
   }
   return infos;
 }
 
 int HostTable::VisitHost(const char* host, int count) {
   if (host == NULL || host[0] == '\0') return 0;
+  assert(count >= 0);
 
   // Try to find the corresponding table entry.
   HostFprint fprint = Url::FingerPrint(host);
-  HashTable::iterator itr = hosts_.find(fprint);
+  HashTable::iterator itr = index_.find(fprint);
 
-  if (itr == hosts_.end()) {
-    // Add a new table entry.
-    HostInfo info;
-    strncpy(info.name, host, kMaxHostLength - 1);
-    info.name[kMaxHostLength-1] = '\0';
-    info.visit_count = count;
-    hosts_[fprint] = info;
-    return count;
+  int pos = 0;
+  if (itr != index_.end()) {
+    pos = itr->second;
+    hosts_[pos].info.visit_count += count;
   } else {
-    itr->second.visit_count += count;
-    return itr->second.visit_count;
+    if (static_cast<int>(hosts_.size()) < capacity_) {
+      // Add a new table entry.
+      pos = static_cast<int>(hosts_.size());
+      hosts_.push_back(Entry());
+      hosts_[pos].info.visit_count = count;
+    } else {
+      // Replace the least visited host, and inherit its count.
+      pos = 0;
+      index_.erase(hosts_[pos].fprint);
+      hosts_[pos].info.visit_count += count;
+    }
+
+    Entry& entry = hosts_[pos];
+    entry.fprint = fprint;
+    strncpy(entry.info.name, host, kMaxHostLength - 1);
+    entry.info.name[kMaxHostLength-1] = '\0';
+    index_[fprint] = pos;
   }
+
+  int visit_count = hosts_[pos].info.visit_count;
+  UpdateBest(pos);
+
+  // Count is only increased, so the entry may only move down.
+  // New entry is at the bottom of heap, so it may only move up.
+  SiftDown(pos);
+  SiftUp(pos);
+  return visit_count;
 }
 
 int HostTable::GetVisitCount(const char* host) {
   HostFprint fprint = Url::FingerPrint(host);
-  HashTable::iterator itr = hosts_.find(fprint);
+  HashTable::iterator itr = index_.find(fprint);
 
-  if (itr == hosts_.end()) {
+  if (itr == index_.end()) {
     return -1;
   } else {
-    return itr->second.visit_count;
+    return hosts_[itr->second].info.visit_count;
   }
 }
 
 void HostTable::RemoveHost(const char* host) {
   HostFprint fprint = Url::FingerPrint(host);
-  hosts_.erase(fprint);
+  HashTable::iterator itr = index_.find(fprint);
+  if (itr == index_.end()) return;
+
+  // Move the last entry to the removed position.
+  int pos = itr->second;
+  int last = static_cast<int>(hosts_.size()) - 1;
+  SwapEntries(pos, last);
+  index_.erase(fprint);
+  hosts_.pop_back();
+  if (pos < last) {
+    SiftDown(pos);
+    SiftUp(pos);
+  }
+
+  if (fprint == best_) FindBest();
 }
 
 void HostTable::Clear() {
   hosts_.clear();
+  index_.clear();
+  best_ = 0;
 }
 
 // Writes this table to a file.
@@ -79,10 +121,9 @@ bool HostTable::Save(const char* path) const {
   FILE* file = fopen(path, "wb");
   if (file == NULL) return false;
 
-  // Write hashtable entry to file.
-  HashTable::const_iterator itr = hosts_.begin();
-  for (; itr != hosts_.end(); ++itr) {
-    if (fwrite(&(itr->second), sizeof(HostInfo), 1, file) != 1) {
+  // Write heap entry to file.
+  for (int i = 0; i < static_cast<int>(hosts_.size()); ++i) {
+    if (fwrite(&(hosts_[i].info), sizeof(HostInfo), 1, file) != 1) {
       fclose(file);
       return false;
     }
@@ -100,10 +141,11 @@ bool HostTable::Load(const char* path) {
   // Clear previous records first.
   Clear();
 
-  // Read hostinfo from file and inserted it into hashtable.
+  // Read hostinfo from file and inserted it into heap.
   HostInfo info;
   while (fread(&info, sizeof(HostInfo), 1, file) == 1) {
-    VisitHost(info.name, info.visit_count);
+    info.name[kMaxHostLength-1] = '\0';
+    VisitHost(info.name, std::max(info.visit_count, 0));
   }
 
   fclose(file);
@@ -111,18 +153,67 @@ bool HostTable::Load(const char* path) {
 }
 
 const std::string HostTable::GetBestHost() const {
-  // Iterate through hashtable to find largest visiting count.
-  HashTable::const_iterator itr = hosts_.begin(), best = hosts_.begin();
-  for (; itr != hosts_.end(); ++itr) {
-    if (best->second.visit_count < itr->second.visit_count) {
-      best = itr;
+  if (hosts_.empty()) {
+    return std::string();
+  }
+
+  HashTable::const_iterator itr = index_.find(best_);
+  assert(itr != index_.end());
+  return hosts_[itr->second].info.name;
+}
+
+void HostTable::SiftUp(int pos) {
+  while (pos > 0) {
+    int parent = (pos - 1) / 2;
+    if (hosts_[parent].info.visit_count <= hosts_[pos].info.visit_count) {
+      break;
     }
+    SwapEntries(pos, parent);
+    pos = parent;
   }
+}
 
-  if (best != hosts_.end()) {
-    return best->second.name;
-  } else {
-    return std::string();
+void HostTable::SiftDown(int pos) {
+  int size = static_cast<int>(hosts_.size());
+  while (true) {
+    int child = pos * 2 + 1;
+    if (child >= size) break;
+    if (child + 1 < size &&
+        hosts_[child + 1].info.visit_count < hosts_[child].info.visit_count) {
+      ++child;
+    }
+    if (hosts_[pos].info.visit_count <= hosts_[child].info.visit_count) {
+      break;
+    }
+    SwapEntries(pos, child);
+    pos = child;
   }
 }
 
+void HostTable::SwapEntries(int a, int b) {
+  if (a == b) return;
+  std::swap(hosts_[a], hosts_[b]);
+  index_[hosts_[a].fprint] = a;
+  index_[hosts_[b].fprint] = b;
+}
+
+void HostTable::UpdateBest(int pos) {
+  // The best host may be replaced, whose count is inherited by this one.
+  HashTable::const_iterator itr = index_.find(best_);
+  if (itr == index_.end() ||
+      hosts_[itr->second].info.visit_count < hosts_[pos].info.visit_count) {
+    best_ = hosts_[pos].fprint;
+  }
+}
+
+void HostTable::FindBest() {
+  // Iterate through heap to find largest visiting count.
+  best_ = 0;
+  int best_count = -1;
+  for (int i = 0; i < static_cast<int>(hosts_.size()); ++i) {
+    if (hosts_[i].info.visit_count > best_count) {
+      best_ = hosts_[i].fprint;
+      best_count = hosts_[i].info.visit_count;
+    }
+  }
+}
@@ -20,6 +20,14 @@
 // Besides the add/remove operations, this class also provides method to
 // load/save host informations from/to file.
 //
+// The table has a fixed capacity, so clients sending random host names can't
+// make it grow without limit. It is maintained as a Space-Saving summary:
+// when the table is full, a new host name replaces the least visited one, and
+// inherits its visiting count. So visiting counts are over-estimated, but
+// any host visited more than total/capacity times is always kept.
+// Hosts are kept in a min-heap by visiting count, and the best host is
+// maintained incrementally.
+//
 // Note, this class is not thread safe.
 
 #ifndef SITEMAPSERVICR_HOSTTABLE_H__
@@ -46,12 +54,22 @@ struct HostInfo {
 
 // Table used to hold all HostInfo for a single site.
 class HostTable {
-  // Data structure used to hold HostInfo.
-  typedef HashMap<HostFprint, HostInfo>::Type HashTable;
+  // A host in the table.
+  struct Entry {
+    HostFprint fprint;
+    HostInfo info;
+  };
+
+  // Data structure used to find position of a host in heap.
+  typedef HashMap<HostFprint, int>::Type HashTable;
 
  public:
+  // Default max number of hosts in a table.
+  static const int kDefaultCapacity = 100;
+
   // non-null, non-empty, unique website id is required.
-  explicit HostTable(const char* siteid);
+  // "capacity" is the max number of hosts in this table.
+  explicit HostTable(const char* siteid, int capacity = kDefaultCapacity);
 
   ~HostTable();
 
@@ -63,6 +81,8 @@ class HostTable {
 
   // Visit specified "host" for "count" times. In other words,
   // the visting times of given "host" name is increased by "count".
+  // If the table is full, the least visited host is replaced.
+  // "count" should not be negative.
   //
   // Returns the total visting count of "host"
   int VisitHost(const char* host, int count);
@@ -71,6 +91,7 @@ class HostTable {
   // The most popular host is the host which has the biggest visiting count.
   // If two host name has same visiting count, the result is undetermined.
   // An empty string would be returned when this table is empty.
+  // It takes constant time.
   const std::string GetBestHost() const;
 
   // Remove specified "host" from this table.
@@ -83,6 +104,9 @@ class HostTable {
   // Get the number of hosts contained in this table.
   int Size() const { return static_cast<int>(hosts_.size()); }
 
+  // Get the max number of hosts in this table.
+  int capacity() const { return capacity_; }
+
   // Clear all hosts contained in this table.
   void Clear();
 
@@ -91,15 +115,38 @@ class HostTable {
   bool Save(const char* path) const;
 
   // Load a table from file.
+  // If the file contains more hosts than capacity, the least visited ones
+  // are merged as in VisitHost.
   // Return whether loading is successful.
   // NOTE, all old hosts in this table will be cleared.
   bool Load(const char* path);
 
  private:
+  // Move an entry up or down in heap until heap order is restored.
+  void SiftUp(int pos);
+  void SiftDown(int pos);
+
+  // Swap two entries in heap, and update their positions in index_.
+  void SwapEntries(int a, int b);
+
+  // Update best_ after an entry is visited.
+  void UpdateBest(int pos);
+
+  // Find the best host by scanning all hosts, after the best one is removed.
+  void FindBest();
+
+  // Hosts in a min-heap by visit_count. The least visited host is hosts_[0].
+  std::vector<Entry> hosts_;
+
   // Key: finger print of host name.
-  // Value: the actual host information, which are pointers.
-  // The pointers are owned by this table, and may be deleted in Clear() method.
-  HashTable hosts_;
+  // Value: position of the host in hosts_.
+  HashTable index_;
+
+  // Finger print of the most visited host. Only valid if hosts_ is not empty.
+  HostFprint best_;
+
+  // Max number of hosts in this table.
+  int capacity_;
 
   // the id of a website, to which all the hosts in this table belongs.
   std::string siteid_;
@@ -27,6 +27,10 @@ const std::string HttpContext::kPasswordParamName = "password";
 const std::string HttpContext::kOldPasswordParamName = "opswd";
 const std::string HttpContext::kNewPasswordParamName = "npswd";
 const std::string HttpContext::kSIDParamName = "sid";
+const std::string HttpContext::kSiteIdParamName = "siteid";
+const std::string HttpContext::kPrefixParamName = "prefix";
+const std::string HttpContext::kStartParamName = "start";
+const std::string HttpContext::kCountParamName = "count";
 
 HttpContext::HttpContext() {
   // does nothing.
@@ -73,6 +73,10 @@ public:
   static const std::string kSIDParamName;
   static const std::string kOldPasswordParamName;
   static const std::string kNewPasswordParamName;
+  static const std::string kSiteIdParamName;
+  static const std::string kPrefixParamName;
+  static const std::string kStartParamName;
+  static const std::string kCountParamName;
 
 private:
   // Parse params from a param tring.
@@ -0,0 +1,138 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "sitemapservice/memorybudget.h"
+
+#include "common/logger.h"
+
+std::map<MemoryBudget::Consumer*, MemoryBudget::Usage>
+  MemoryBudget::consumers_;
+int64 MemoryBudget::total_usage_ = 0;
+int64 MemoryBudget::limit_ = 0;
+CriticalSection MemoryBudget::lock_;
+CriticalSection MemoryBudget::release_lock_;
+
+void MemoryBudget::SetLimit(int64 limit) {
+  lock_.Enter(true);
+  limit_ = limit;
+  lock_.Leave();
+}
+
+int64 MemoryBudget::GetLimit() {
+  lock_.Enter(true);
+  int64 limit = limit_;
+  lock_.Leave();
+  return limit;
+}
+
+int64 MemoryBudget::GetTotalUsage() {
+  lock_.Enter(true);
+  int64 usage = total_usage_;
+  lock_.Leave();
+  return usage;
+}
+
+void MemoryBudget::Register(Consumer* consumer) {
+  Usage usage;
+  usage.bytes = 0;
+  usage.last_grow = time(NULL);
+  usage.last_release = 0;
+
+  lock_.Enter(true);
+  consumers_[consumer] = usage;
+  lock_.Leave();
+}
+
+void MemoryBudget::Unregister(Consumer* consumer) {
+  // Wait if the consumer is releasing memory.
+  release_lock_.Enter(true);
+  lock_.Enter(true);
+  std::map<Consumer*, Usage>::iterator itr = consumers_.find(consumer);
+  if (itr != consumers_.end()) {
+    total_usage_ -= itr->second.bytes;
+    consumers_.erase(itr);
+  }
+  lock_.Leave();
+  release_lock_.Leave();
+}
+
+void MemoryBudget::Update(Consumer* consumer, int64 bytes) {
+  time_t now = time(NULL);
+
+  lock_.Enter(true);
+  std::map<Consumer*, Usage>::iterator itr = consumers_.find(consumer);
+  if (itr == consumers_.end()) {
+    lock_.Leave();
+    return;
+  }
+
+  Usage& usage = itr->second;
+  if (bytes > usage.bytes) {
+    usage.last_grow = now;
+  }
+  total_usage_ += bytes - usage.bytes;
+  usage.bytes = bytes;
+
+  bool exceeded = limit_ > 0 && total_usage_ > limit_;
+  lock_.Leave();
+
+  if (!exceeded) return;
+
+  // Skip if another consumer is releasing memory. It is also the case that
+  // ReleaseMemory reports usage, which should not release memory again.
+  if (!release_lock_.Enter(false)) return;
+
+  lock_.Enter(true);
+  Consumer* victim = ChooseVictim(now);
+  if (victim != NULL) {
+    consumers_[victim].last_release = now;
+    Logger::Log(EVENT_NORMAL, "Memory budget (%lld bytes) is exceeded (%lld "
+              "bytes), release memory of the coldest consumer.", limit_,
+              total_usage_);
+  }
+  lock_.Leave();
+
+  // The victim can't be unregistered until release_lock_ is released.
+  if (victim != NULL) {
+    victim->ReleaseMemory();
+  }
+  release_lock_.Leave();
+}
+
+MemoryBudget::Consumer* MemoryBudget::ChooseVictim(time_t now) {
+  Consumer* coldest = NULL;
+  Consumer* largest = NULL;
+  time_t coldest_grow = now - kColdSeconds;
+  int64 largest_bytes = 0;
+
+  std::map<Consumer*, Usage>::iterator itr = consumers_.begin();
+  for (; itr != consumers_.end(); ++itr) {
+    const Usage& usage = itr->second;
+    if (usage.bytes == 0 || usage.last_release + kReleaseInterval > now) {
+      continue;
+    }
+
+    if (usage.last_grow < coldest_grow) {
+      coldest = itr->first;
+      coldest_grow = usage.last_grow;
+    }
+    if (usage.bytes > largest_bytes) {
+      largest = itr->first;
+      largest_bytes = usage.bytes;
+    }
+  }
+
+  return coldest != NULL ? coldest : largest;
+}
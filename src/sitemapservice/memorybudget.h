@@ -0,0 +1,107 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// MemoryBudget limits the total memory used by in-memory data of all sites.
+// Every site registers itself as a consumer, and reports its memory usage
+// from time to time. When the total usage exceeds the limit, a consumer is
+// asked to release its memory, usually by flushing its records to a temp
+// file. The coldest consumer (which has not grown for a while) is chosen
+// first, or else the largest one.
+// Like RuntimeInfoManager, this class is not implemented as a singleton, and
+// all its methods are declared as static.
+// This class is thread-safe.
+
+#ifndef SITEMAPSERVICE_MEMORYBUDGET_H__
+#define SITEMAPSERVICE_MEMORYBUDGET_H__
+
+#include <time.h>
+#include <map>
+#include "common/basictypes.h"
+#include "common/criticalsection.h"
+
+class MemoryBudget {
+ public:
+  // Interface of objects drawing memory from the budget.
+  class Consumer {
+   public:
+    virtual ~Consumer() {}
+
+    // Release memory held by this consumer.
+    // It should not block for long, and new usage should be reported by
+    // Update after the memory is released.
+    virtual void ReleaseMemory() = 0;
+  };
+
+  // A consumer is considered cold if it has not grown for this many seconds.
+  static const int kColdSeconds = 60;
+
+  // A consumer is not asked to release memory again within this many
+  // seconds, so it has time to release the memory and report it.
+  static const int kReleaseInterval = 10;
+
+  // Set the limit in bytes. Zero means no limit.
+  static void SetLimit(int64 limit);
+
+  // Get the limit in bytes.
+  static int64 GetLimit();
+
+  // Get total bytes reported by all consumers.
+  static int64 GetTotalUsage();
+
+  // Register a consumer, whose usage is zero initially.
+  static void Register(Consumer* consumer);
+
+  // Unregister a consumer. It is ensured that ReleaseMemory of this consumer
+  // is not being called, or called anymore, after this method returns.
+  static void Unregister(Consumer* consumer);
+
+  // Update memory usage of a registered consumer.
+  // If the limit is exceeded, a consumer is chosen to release memory.
+  static void Update(Consumer* consumer, int64 usage);
+
+ private:
+  // Usage information of a consumer.
+  struct Usage {
+    int64 bytes;
+
+    // Last time when the usage grew.
+    time_t last_grow;
+
+    // Last time when the consumer is asked to release memory.
+    time_t last_release;
+  };
+
+  // Choose a consumer to release memory. lock_ should be held.
+  // Returns NULL if no consumer is available.
+  static Consumer* ChooseVictim(time_t now);
+
+  // Usage of all registered consumers.
+  static std::map<Consumer*, Usage> consumers_;
+
+  // Sum of usage of all consumers.
+  static int64 total_usage_;
+
+  // Limit of total usage.
+  static int64 limit_;
+
+  // Lock for all data above.
+  static CriticalSection lock_;
+
+  // Held while calling ReleaseMemory, so Unregister could wait for it.
+  // Only one consumer is releasing memory at a time.
+  static CriticalSection release_lock_;
+};
+
+#endif // SITEMAPSERVICE_MEMORYBUDGET_H__
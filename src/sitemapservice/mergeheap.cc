@@ -0,0 +1,64 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "sitemapservice/mergeheap.h"
+
+void MergeHeap::Push(int source, const UrlFprint& key) {
+  Entry entry;
+  entry.key = key;
+  entry.source = source;
+
+  // Move the new entry up to its place.
+  int position = static_cast<int>(entries_.size());
+  entries_.push_back(entry);
+  while (position > 0) {
+    int parent = (position - 1) / 2;
+    if (!(entry < entries_[parent])) break;
+
+    entries_[position] = entries_[parent];
+    position = parent;
+  }
+  entries_[position] = entry;
+}
+
+void MergeHeap::Pop() {
+  entries_[0] = entries_.back();
+  entries_.pop_back();
+  if (!entries_.empty()) {
+    SiftDown(0);
+  }
+}
+
+void MergeHeap::ReplaceTop(const UrlFprint& key) {
+  entries_[0].key = key;
+  SiftDown(0);
+}
+
+void MergeHeap::SiftDown(int position) {
+  int size = static_cast<int>(entries_.size());
+  Entry entry = entries_[position];
+  while (true) {
+    int child = position * 2 + 1;
+    if (child >= size) break;
+    if (child + 1 < size && entries_[child + 1] < entries_[child]) {
+      ++child;
+    }
+    if (!(entries_[child] < entry)) break;
+
+    entries_[position] = entries_[child];
+    position = child;
+  }
+  entries_[position] = entry;
+}
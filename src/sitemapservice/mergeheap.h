@@ -0,0 +1,85 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// MergeHeap is a binary min-heap used for k-way merges of sorted sources,
+// like record files or finger print files. Every source is identified by
+// its index, and ordered by the finger print it currently points to.
+// Sources with the same finger print are ordered by their index, so the
+// records of a url are always merged in the order of the sources.
+// Finding the minimum is O(1), and advancing a source is O(log n), instead
+// of O(n) for scanning all the sources.
+
+#ifndef SITEMAPSERVICE_MERGEHEAP_H__
+#define SITEMAPSERVICE_MERGEHEAP_H__
+
+#include <vector>
+
+#include "common/basictypes.h"
+#include "common/url.h"
+
+class MergeHeap {
+ public:
+  MergeHeap() {}
+  ~MergeHeap() {}
+
+  bool empty() const {
+    return entries_.empty();
+  }
+
+  int size() const {
+    return static_cast<int>(entries_.size());
+  }
+
+  // Returns index of the source with the minimum finger print.
+  // The heap should not be empty.
+  int top() const {
+    return entries_[0].source;
+  }
+
+  // Returns the minimum finger print.
+  const UrlFprint& top_key() const {
+    return entries_[0].key;
+  }
+
+  // Adds a source which points to "key".
+  void Push(int source, const UrlFprint& key);
+
+  // Removes the top source, usually because it reaches the end.
+  void Pop();
+
+  // Updates the finger print of the top source after it moves forward.
+  // It is cheaper than Pop followed by Push.
+  void ReplaceTop(const UrlFprint& key);
+
+ private:
+  struct Entry {
+    UrlFprint key;
+    int source;
+
+    bool operator<(const Entry& another) const {
+      if (key != another.key) return key < another.key;
+      return source < another.source;
+    }
+  };
+
+  // Moves the entry at "position" down to its place.
+  void SiftDown(int position);
+
+  std::vector<Entry> entries_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(MergeHeap);
+};
+
+#endif // SITEMAPSERVICE_MERGEHEAP_H__
@@ -16,9 +16,11 @@
 #include "sitemapservice/newsdatamanager.h"
 
 #include <errno.h>
+#include <algorithm>
 #include "common/logger.h"
 #include "common/fileutil.h"
 #include "sitemapservice/urlfprintio.h"
+#include "sitemapservice/mergeheap.h"
 
 const std::string NewsDataManager::kDataFile = "new_entries";
 const std::string NewsDataManager::kFprintFile = "old_fprint";
@@ -59,14 +61,20 @@ bool NewsDataManager::UpdateData() {
     return false;
   }
 
-  if (!sitedata_manager_->LockDiskData(true)) {
-    Logger::Log(EVENT_ERROR, "Failed to lock site data to update news data.");
-    return false;
-  }
-
+  // Temp files may be merged in background, so they are held by a snapshot
+  // while they are read. Files merged before the snapshot are skipped.
   RecordfileManager* filemanager = sitedata_manager_->GetFileManager();
-  std::vector<std::string> current_temps =
+  RecordfileManager::Snapshot* snapshot = filemanager->AcquireSnapshot();
+  std::vector<std::string> new_temps =
     filemanager->GetTempFiles(last_update_, time(NULL));
+  std::vector<std::string> current_temps;
+  for (int i = 0; i < static_cast<int>(new_temps.size()); ++i) {
+    if (std::find(snapshot->temp_files().begin(),
+                  snapshot->temp_files().end(),
+                  new_temps[i]) != snapshot->temp_files().end()) {
+      current_temps.push_back(new_temps[i]);
+    }
+  }
 
   std::string old_entries(data_dir_);
   old_entries.append(kDataFile);
@@ -119,7 +127,7 @@ bool NewsDataManager::UpdateData() {
     result = true;
   } while (false);
 
-  sitedata_manager_->UnlockDiskData();
+  snapshot->Release();
   time(&last_update_);
 
   return result;
@@ -139,9 +147,9 @@ bool NewsDataManager::AddRecordToHeap(const std::string& file, Heap* heap) {
     return false;
   }
 
-  VisitingRecord record;
-  while (reader->Read(&record) == 0) {
-    heap->push(record);
+  const VisitingRecord* record = NULL;
+  while ((record = reader->Next()) != NULL) {
+    heap->push(*record);
     if (heap->size() > kMaxNewsEntry) {
       heap->pop();
     }
@@ -203,53 +211,51 @@ bool NewsDataManager::MergeUrlFprint(const std::string& newentry,
     return false;
   }
 
-  // Open the new temp files to read.
+  // Open the new temp files to read, and order them by their first records.
   int n = static_cast<int>(srcs.size());
-  std::vector<VisitingRecord> records(n);
+  std::vector<const VisitingRecord*> records(n);
   std::vector<RecordFileReader*> readers(n);
 
-  for (int i = 0, j = 0; i < n; ++i, ++j) {
-    readers[i] = RecordFileIOFactory::CreateReader(srcs[j]);
+  MergeHeap heap;
+  for (int i = 0; i < n; ++i) {
+    readers[i] = RecordFileIOFactory::CreateReader(srcs[i]);
     // No record is availalbe, simply remove the reader.
-    if (readers[i] == NULL || readers[i]->Read(&records[i]) != 0) {
+    if (readers[i] == NULL || (records[i] = readers[i]->Next()) == NULL) {
       if (readers[i] != NULL) {
         delete readers[i];
       }
-      readers.erase(readers.begin() + i);
-      records.erase(records.begin() + i);
-      --i, --n;
+      readers[i] = NULL;
+    } else {
+      heap.Push(i, records[i]->fingerprint());
     }
   }
 
-  UrlFprint fingerprint = 0;
-  VisitingRecord record;
-  while (readers.size() > 0) {
-    fingerprint = records[0].fingerprint();
-    for (int i = 1; i < n; ++i) {
-      if (fingerprint > records[i].fingerprint()) {
-        fingerprint = records[i].fingerprint();
-      }
-    }
-    
-    bool flag = 0;
-    for (int i = 0; i < n; ++i) {
-      if (fingerprint == records[i].fingerprint()) {
-        const VisitingRecord& another = records[i];
-        if (flag) {
-          RecordMerger::Merge(record, another);
-        } else {
-          record = records[i];
-          flag = true;
-        }
+  VisitingRecord merged;
+  while (!heap.empty()) {
+    UrlFprint fingerprint = heap.top_key();
+
+    // The first record is not moved forward until it is written, so its url
+    // is used without copying. See RecordMerger::Merge.
+    int first = heap.top();
+    heap.Pop();
+
+    const VisitingRecord* record = records[first];
+    if (!heap.empty() && heap.top_key() == fingerprint) {
+      merged.ShallowCopy(*record);
+      do {
+        int source = heap.top();
+        RecordMerger::Merge(merged, *records[source]);
 
         // Proceeds to the next record.
-        if (readers[i]->Read(&records[i]) != 0) {
-          delete readers[i];
-          readers.erase(readers.begin() + i);
-          records.erase(records.begin() + i);
-          --i, --n;
+        if ((records[source] = readers[source]->Next()) != NULL) {
+          heap.ReplaceTop(records[source]->fingerprint());
+        } else {
+          delete readers[source];
+          readers[source] = NULL;
+          heap.Pop();
         }
-      }
+      } while (!heap.empty() && heap.top_key() == fingerprint);
+      record = &merged;
     }
 
     while (has_old && old_fprint < fingerprint) {
@@ -258,9 +264,17 @@ bool NewsDataManager::MergeUrlFprint(const std::string& newentry,
     }
     // Only save the entries we've never met before.
     if (has_old == false || old_fprint > fingerprint) {
-      writer->Write(record);
+      writer->Write(*record);
       fp_writer.Write(fingerprint);
     }
+
+    merged.set_url(NULL);
+    if ((records[first] = readers[first]->Next()) != NULL) {
+      heap.Push(first, records[first]->fingerprint());
+    } else {
+      delete readers[first];
+      readers[first] = NULL;
+    }
   }
 
   // Add all the left old fprints.
@@ -196,9 +196,9 @@ bool NewsSitemapService::InternalRun() {
     if (reader == NULL) {
       Logger::Log(EVENT_CRITICAL, "No new record in news URL database.");
     } else {
-      VisitingRecord record;
-      while (reader->Read(&record) == 0) {
-        this->ProcessRecord(record);
+      const VisitingRecord* record = NULL;
+      while ((record = reader->Next()) != NULL) {
+        this->ProcessRecord(*record);
       }
       delete reader;
     }
@@ -32,6 +32,7 @@ const std::string PageController::kLoginAction = "/login";
 const std::string PageController::kMessageBundleAction = "/language.js";
 const std::string PageController::kMainAction = "/main";
 const std::string PageController::kChangePasswordAction = "/chpswd";
+const std::string PageController::kUrlQueryAction = "/queryurls";
 
 PageController PageController::instance_;
 
@@ -106,6 +107,8 @@ bool PageController::Initialize() {
 
   RegisterHandler(kChangePasswordAction, new ChangePasswordHandler(), true);
 
+  RegisterHandler(kUrlQueryAction, new UrlQueryHandler(), true);
+
   return true;
 }
 
@@ -62,6 +62,7 @@ private:
   static const std::string kChangePasswordAction;
   static const std::string kMainAction;
   static const std::string kMessageBundleAction;
+  static const std::string kUrlQueryAction;
 
   // Register an HTTP handler.
   // The "handler" will be used to handle request from the "path".
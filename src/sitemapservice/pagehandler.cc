@@ -23,6 +23,9 @@
 #include "sitemapservice/sessionmanager.h"
 #include "sitemapservice/webpagemanager.h"
 #include "sitemapservice/passwordmanager.h"
+#include "sitemapservice/recordfilemanager.h"
+#include "sitemapservice/recordurlindex.h"
+#include "third_party/tinyxml/tinyxml.h"
 
 #ifdef WIN32
 #include "sitemapservice/mainservice.h"
@@ -307,3 +310,79 @@ void ChangePasswordHandler::Execute(HttpContext *context) {
   response->Reset(HttpConst::kStatus200, "");
 }
 
+void UrlQueryHandler::Execute(HttpContext* context) {
+  HttpResponse* response = context->response();
+
+  std::string site_id = context->GetParam(HttpContext::kSiteIdParamName);
+  std::string prefix = context->GetParam(HttpContext::kPrefixParamName);
+  int64 start = atoi(context->GetParam(HttpContext::kStartParamName).c_str());
+  int count = atoi(context->GetParam(HttpContext::kCountParamName).c_str());
+  if (site_id.length() == 0) {
+    response->Reset(HttpConst::kStatus500, "no site id");
+    return;
+  }
+  if (start < 0) start = 0;
+  if (count <= 0) count = kDefaultPageSize;
+  if (count > kMaxPageSize) count = kMaxPageSize;
+
+  // Urls merged after the base file are in the level files, so all their
+  // indexes are queried. The indexes are mapped, so they are still readable
+  // if the files are replaced by a merge at the same time. A level file
+  // removed by a merge before it is opened is skipped.
+  std::vector<std::string> files =
+    RecordfileManager::GetSiteLevelFiles(site_id.c_str());
+  files.insert(files.begin(),
+               RecordfileManager::GetSiteBaseFile(site_id.c_str()));
+  std::vector<RecordUrlIndex*> indexes;
+  std::vector<const RecordUrlIndex*> opened;
+  for (size_t i = 0; i < files.size(); ++i) {
+    RecordUrlIndex* index = new RecordUrlIndex();
+    indexes.push_back(index);
+    if (index->Open(files[i])) {
+      opened.push_back(index);
+    }
+  }
+
+  std::vector<std::string> urls;
+  int64 total = opened.empty() ? 0
+    : RecordUrlIndex::Query(opened, prefix, start, count, &urls);
+  for (size_t i = 0; i < indexes.size(); ++i) {
+    delete indexes[i];
+  }
+  if (opened.empty()) {
+    response->Reset(HttpConst::kStatus404, "no url index for the site");
+    return;
+  }
+  if (total < 0) {
+    response->Reset(HttpConst::kStatus500, "url index is corrupted");
+    return;
+  }
+
+  TiXmlDocument xmldoc;
+  xmldoc.LinkEndChild(new TiXmlDeclaration("1.0", "utf-8", ""));
+  TiXmlElement* root = new TiXmlElement("UrlQuery");
+  xmldoc.LinkEndChild(root);
+
+  char buffer[32];
+  root->SetAttribute("site_id", site_id.c_str());
+  root->SetAttribute("prefix", prefix.c_str());
+  sprintf(buffer, "%lld", total);
+  root->SetAttribute("total", buffer);
+  sprintf(buffer, "%lld", start);
+  root->SetAttribute("start", buffer);
+  for (size_t i = 0; i < urls.size(); ++i) {
+    TiXmlElement* url = new TiXmlElement("Url");
+    url->SetAttribute("value", urls[i].c_str());
+    root->LinkEndChild(url);
+  }
+
+  TIXML_OSTREAM out;
+  xmldoc.StreamOut(&out);
+
+  response->set_status(HttpConst::kStatus200);
+  response->SetHeader(HttpConst::kHeaderContentType,
+                      "text/xml; charset=utf-8");
+  response->SetHeader(HttpConst::kHeaderCacheControl,
+                      "no-cache, must-revalidate");
+  response->set_message_body(out.c_str());
+}
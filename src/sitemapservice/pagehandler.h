@@ -166,5 +166,22 @@ public:
 
   virtual void Execute(HttpContext* context);
 };
+
+// Handler to list urls of a site with a prefix, like "/products/".
+// The urls are read from the url index of the site's base file, see
+// RecordUrlIndex, and paged by "start" and "count" params.
+class UrlQueryHandler : public PageHandler {
+public:
+  // Max number of urls returned in a page.
+  static const int kMaxPageSize = 1000;
+
+  // Number of urls returned in a page if it is not specified.
+  static const int kDefaultPageSize = 100;
+
+  UrlQueryHandler() {}
+  virtual ~UrlQueryHandler() {}
+
+  virtual void Execute(HttpContext* context);
+};
 #endif // SITEMAPSERVICE_PAGEHANDLER_H__
 
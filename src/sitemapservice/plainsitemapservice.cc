@@ -35,12 +35,6 @@ bool PlainSitemapService::InternalRun() {
     return false;
   }
 
-  // Update the database.
-  if (!data_manager_->UpdateDatabase()) {
-    Logger::Log(EVENT_ERROR, "Failed to update database.");
-    return false;
-  }
-
   // Get host name for the site.
   std::string hostname;
   if (!data_manager_->GetHostName(&hostname)) {
@@ -48,45 +42,25 @@ bool PlainSitemapService::InternalRun() {
     return false;
   }
 
-  // Lock data base to read.
-  if (!data_manager_->LockDiskData(true)) {
-    Logger::Log(EVENT_ERROR, "Failed to lock site data.");
-    return false;
-  }
-
   bool result = false;
-  RecordFileReader* reader = NULL;
   do {
-    // Open data base to read.
-    std::string data_base = data_manager_->GetFileManager()->GetBaseFile();
-    reader = RecordFileIOFactory::CreateReader(data_base);
-    if (reader == NULL) {
-      Logger::Log(EVENT_ERROR, "Failed to open data base to read.");
-      break;
-    }
-
     // Start to generate sitemap file.
     if (!Start(data_manager_->GetRecordFileStata(), hostname.c_str())) {
       Logger::Log(EVENT_ERROR, "Failed to start generate sitemap.");
       break;
     }
 
-    // Process url one by one.
-    VisitingRecord record;
-    while (reader->Read(&record) == 0) {
-      if (!ProcessRecord(record)) {
-        Logger::Log(EVENT_NORMAL, "Failed to process url [%s] for sitemap, ignore.",
-                  record.url());
-      }
+    // Process url one by one, including the records not merged into the
+    // base file yet. If the base file is merged now, urls are processed
+    // while it is written, otherwise a snapshot of current files is read.
+    if (!data_manager_->ProcessDatabase(this)) {
+      Logger::Log(EVENT_ERROR, "Failed to process data base for sitemap.");
+      break;
     }
 
     result = true;
   } while (false);
 
-  // Release resources.
-  if (reader != NULL) delete reader;
-  data_manager_->UnlockDiskData();
-
   if (result == true) {
     return End();
   } else {
@@ -116,6 +90,13 @@ bool PlainSitemapService::ProcessRecord(const VisitingRecord& record) {
   return BaseSitemapService::AddUrl(url);
 }
 
+void PlainSitemapService::OnRecord(const VisitingRecord& record) {
+  if (!ProcessRecord(record)) {
+    Logger::Log(EVENT_NORMAL, "Failed to process url [%s] for sitemap, ignore.",
+              record.url());
+  }
+}
+
 // End generation and inform search engine.
 bool PlainSitemapService::End() {
   if (BaseSitemapService::EndGenerating(true, false)) {
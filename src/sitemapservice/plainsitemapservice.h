@@ -27,10 +27,12 @@
 
 #include "common/sitesetting.h"
 #include "sitemapservice/basesitemapservice.h"
+#include "sitemapservice/recordmerger.h"
 #include "sitemapservice/urlfilter.h"
 #include "sitemapservice/informer.h"
 
-class PlainSitemapService : public BaseSitemapService {
+class PlainSitemapService : public BaseSitemapService,
+                            public RecordMerger::Observer {
  public:
   // "sitemap_name" is used to identify what the sitemap is.
   // "writer" is used to write Url records to a file in specific sitemap format.
@@ -47,10 +49,16 @@ class PlainSitemapService : public BaseSitemapService {
   virtual bool ProcessRecord(const VisitingRecord& record);
   virtual bool End();
 
+  // Passes a record of the database to ProcessRecord.
+  // See RecordMerger::Observer.
+  virtual void OnRecord(const VisitingRecord& record);
+
  protected:
   // Overrides method inherited from base class.
-  // It updates url database for the site, reads url record one by one from
-  // the database, and feeds the url to Start/ProcessRecord/End methods.
+  // It updates url database for the site, and feeds the url records of the
+  // database to Start/ProcessRecord/End methods. When the update merges the
+  // base file, the records are fed while they are merged, so the sitemap is
+  // generated in the same pass. See SiteDataManager::ProcessDatabase.
   virtual bool InternalRun();
 
   // Convert record. All fields of url element is set.
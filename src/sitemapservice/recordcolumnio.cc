@@ -0,0 +1,244 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "sitemapservice/recordcolumnio.h"
+
+#include "common/logger.h"
+#include "common/fileutil.h"
+#include "third_party/zlib/zlib.h"
+
+namespace {
+
+const char* kColumnSuffixes[RecordColumn::FIELD_COUNT] = {
+  "_first_appear",
+  "_last_access",
+  "_last_change",
+  "_count_access",
+  "_count_change"
+};
+
+uint32 TimeValue(time_t value) {
+  return value > 0 ? static_cast<uint32>(value) : 0;
+}
+
+}  // namespace
+
+///////////////////////////////////////////////////////////////////////
+// Implementation of RecordColumn
+
+RecordColumn::RecordColumn() {
+  values_ = NULL;
+  row_count_ = 0;
+}
+
+std::string RecordColumn::GetColumnPath(const std::string& recordfile,
+                                        Field field) {
+  std::string path(recordfile);
+  path.append(kColumnSuffixes[field]);
+  return path;
+}
+
+uint32 RecordColumn::GetValue(const VisitingRecord& record, Field field) {
+  switch (field) {
+    case FIRST_APPEAR:
+      return TimeValue(record.first_appear);
+    case LAST_ACCESS:
+      return TimeValue(record.last_access);
+    case LAST_CHANGE:
+      return TimeValue(record.last_change);
+    case COUNT_ACCESS:
+      return static_cast<uint32>(record.count_access);
+    case COUNT_CHANGE:
+      return static_cast<uint32>(record.count_change);
+    default:
+      return 0;
+  }
+}
+
+bool RecordColumn::Open(const std::string& recordfile, Field field) {
+  Close();
+
+  std::string path = GetColumnPath(recordfile, field);
+  FileAttribute attr;
+  if (!FileUtil::Exists(path.c_str())
+      || !FileUtil::GetFileAttribute(recordfile.c_str(), &attr)
+      || !file_.Open(path.c_str())) {
+    return false;
+  }
+
+  // The column is ignored if it belongs to another version of record file.
+  RecordColumnHeader header;
+  bool result = file_.size() >= static_cast<int64>(sizeof(header));
+  if (result) {
+    memcpy(&header, file_.data(), sizeof(header));
+    int64 values_size = file_.size() - sizeof(header);
+    result = header.version == kVersion
+      && header.field == static_cast<uint32>(field)
+      && header.file_size == static_cast<uint64>(attr.size)
+      && header.row_count * sizeof(uint32) == static_cast<uint64>(values_size);
+  }
+
+  if (result) {
+    const char* values = file_.data() + sizeof(header);
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(values),
+                static_cast<uInt>(header.row_count * sizeof(uint32)));
+    result = static_cast<uint32>(crc) == header.values_crc;
+    values_ = reinterpret_cast<const uint32*>(values);
+    row_count_ = static_cast<int64>(header.row_count);
+  }
+
+  if (!result) {
+    Logger::Log(EVENT_NORMAL, "Ignore invalid record column [%s].",
+              path.c_str());
+    Close();
+  }
+  return result;
+}
+
+void RecordColumn::Close() {
+  file_.Unmap();
+  values_ = NULL;
+  row_count_ = 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Implementation of RecordColumnWriter
+
+RecordColumnWriter::RecordColumnWriter() {
+  for (int i = 0; i < RecordColumn::FIELD_COUNT; ++i) {
+    writers_[i] = NULL;
+    crcs_[i] = 0;
+  }
+  row_count_ = 0;
+}
+
+RecordColumnWriter::~RecordColumnWriter() {
+  Close(0, false);
+}
+
+bool RecordColumnWriter::Open(const std::string& recordfile) {
+  Close(0, false);
+
+  // Space of header is reserved, and the header is written on Close.
+  RecordColumnHeader header;
+  memset(&header, 0, sizeof(header));
+  for (int i = 0; i < RecordColumn::FIELD_COUNT; ++i) {
+    RecordColumn::Field field = static_cast<RecordColumn::Field>(i);
+    paths_[i] = RecordColumn::GetColumnPath(recordfile, field);
+    crcs_[i] = static_cast<uint32>(crc32(0L, Z_NULL, 0));
+
+    FILE* file = fopen(paths_[i].c_str(), "wb");
+    if (file == NULL) {
+      Logger::Log(EVENT_ERROR, "Failed to open [%s] to write.",
+                paths_[i].c_str());
+      Close(0, false);
+      return false;
+    }
+
+    writers_[i] = new SequentialWriter(kBufferSize);
+    writers_[i]->Attach(file);
+    if (!writers_[i]->Write(&header, sizeof(header))) {
+      Close(0, false);
+      return false;
+    }
+  }
+
+  row_count_ = 0;
+  return true;
+}
+
+bool RecordColumnWriter::Write(const VisitingRecord& record) {
+  for (int i = 0; i < RecordColumn::FIELD_COUNT; ++i) {
+    if (writers_[i] == NULL) return false;
+
+    RecordColumn::Field field = static_cast<RecordColumn::Field>(i);
+    uint32 value = RecordColumn::GetValue(record, field);
+    crcs_[i] = static_cast<uint32>(crc32(crcs_[i],
+      reinterpret_cast<const Bytef*>(&value), sizeof(value)));
+    if (!writers_[i]->Write(&value, sizeof(value))) {
+      return false;
+    }
+  }
+
+  ++row_count_;
+  return true;
+}
+
+bool RecordColumnWriter::Append(const std::string& recordfile) {
+  int64 row_count = -1;
+  for (int i = 0; i < RecordColumn::FIELD_COUNT; ++i) {
+    if (writers_[i] == NULL) return false;
+
+    RecordColumn column;
+    RecordColumn::Field field = static_cast<RecordColumn::Field>(i);
+    if (!column.Open(recordfile, field)
+        || (row_count >= 0 && column.row_count() != row_count)) {
+      return false;
+    }
+    row_count = column.row_count();
+    if (row_count == 0) continue;
+
+    const uint32* values = column.values();
+    size_t size = static_cast<size_t>(row_count * sizeof(uint32));
+    crcs_[i] = static_cast<uint32>(crc32(crcs_[i],
+      reinterpret_cast<const Bytef*>(values), static_cast<uInt>(size)));
+    if (!writers_[i]->Write(values, size)) {
+      return false;
+    }
+  }
+
+  row_count_ += row_count;
+  return true;
+}
+
+bool RecordColumnWriter::Close(int64 file_size, bool success) {
+  bool result = success;
+  for (int i = 0; i < RecordColumn::FIELD_COUNT; ++i) {
+    if (writers_[i] == NULL) continue;
+
+    if (result) {
+      RecordColumnHeader header;
+      memset(&header, 0, sizeof(header));
+      header.version = RecordColumn::kVersion;
+      header.file_size = static_cast<uint64>(file_size);
+      header.row_count = static_cast<uint64>(row_count_);
+      header.field = static_cast<uint32>(i);
+      header.values_crc = crcs_[i];
+      result = writers_[i]->WriteAt(0, &header, sizeof(header));
+    }
+    if (!writers_[i]->Close()) {
+      result = false;
+    }
+
+    delete writers_[i];
+    writers_[i] = NULL;
+  }
+
+  // Incomplete columns are removed, so the record file is always scanned.
+  if (!result) {
+    for (int i = 0; i < RecordColumn::FIELD_COUNT; ++i) {
+      if (!paths_[i].empty() && FileUtil::Exists(paths_[i].c_str())) {
+        FileUtil::DeleteFile(paths_[i].c_str());
+      }
+    }
+  }
+
+  for (int i = 0; i < RecordColumn::FIELD_COUNT; ++i) {
+    paths_[i].clear();
+  }
+  row_count_ = 0;
+  return result;
+}
@@ -0,0 +1,144 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Column files hold single fields of all records in a record file, in the
+// same order as the records, so the n-th value in a column belongs to the
+// n-th record. Jobs which only filter records by time or count can scan a
+// column, which is only 4 bytes per record, and then read the records which
+// qualify through RecordOrdinalReader.
+// Every field is stored in a side file, whose name is the record file name
+// with the column suffix. They are written with the index by
+// RecordFileBlockWriter, see RecordFileIOFactory::CreateIndexedWriter.
+// Layout of a column file is:
+//   RecordColumnHeader
+//   uint32[row_count]
+// Times are stored as unsigned seconds, and non-positive (unknown) times
+// are stored as 0.
+
+#ifndef SITEMAPSERVICE_RECORDCOLUMNIO_H__
+#define SITEMAPSERVICE_RECORDCOLUMNIO_H__
+
+#include <string>
+
+#include "common/basictypes.h"
+#include "common/mappedfile.h"
+#include "common/sequentialwriter.h"
+#include "sitemapservice/visitingrecord.h"
+
+struct RecordColumnHeader {
+  // Version of the file, which is RecordColumn::kVersion.
+  uint64 version;
+
+  // Size of the record file which this column belongs to.
+  uint64 file_size;
+
+  uint64 row_count;
+
+  // Which field it is, see RecordColumn::Field.
+  uint32 field;
+
+  // Checksum of all the values.
+  uint32 values_crc;
+};
+
+// A column mapped into memory.
+class RecordColumn {
+ public:
+  static const uint64 kVersion = 200910061200ULL;
+
+  enum Field {
+    FIRST_APPEAR = 0,
+    LAST_ACCESS,
+    LAST_CHANGE,
+    COUNT_ACCESS,
+    COUNT_CHANGE,
+    FIELD_COUNT
+  };
+
+  RecordColumn();
+  ~RecordColumn() {}
+
+  // Get path of a column file for a record file.
+  static std::string GetColumnPath(const std::string& recordfile,
+                                   Field field);
+
+  // Get value of a field from a record.
+  static uint32 GetValue(const VisitingRecord& record, Field field);
+
+  // Maps a column of given record file, and validates it.
+  // Returns false if there is no such column, or it is corrupted, or it
+  // doesn't match the record file.
+  bool Open(const std::string& recordfile, Field field);
+
+  void Close();
+
+  int64 row_count() const {
+    return row_count_;
+  }
+
+  // Returns the value of a row. No bound check is done.
+  uint32 value(int64 row) const {
+    return values_[row];
+  }
+
+  // Returns all the values.
+  const uint32* values() const {
+    return values_;
+  }
+
+ private:
+  MappedFile file_;
+
+  const uint32* values_;
+  int64 row_count_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(RecordColumn);
+};
+
+// Writes all the columns of a record file.
+class RecordColumnWriter {
+ public:
+  // Buffer size of every column file.
+  static const int kBufferSize = 512 * 1024;
+
+  RecordColumnWriter();
+  ~RecordColumnWriter();
+
+  // Open the column files of given record file.
+  bool Open(const std::string& recordfile);
+
+  // Append fields of next record.
+  bool Write(const VisitingRecord& record);
+
+  // Append all the columns of another record file, as if its records are
+  // written. It is used to concatenate record files.
+  // Returns false if the other file has no valid columns.
+  bool Append(const std::string& recordfile);
+
+  // Finish the column files for a record file with given size.
+  // If "success" is false, the column files are removed.
+  bool Close(int64 file_size, bool success);
+
+ private:
+  SequentialWriter* writers_[RecordColumn::FIELD_COUNT];
+  uint32 crcs_[RecordColumn::FIELD_COUNT];
+  std::string paths_[RecordColumn::FIELD_COUNT];
+
+  int64 row_count_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(RecordColumnWriter);
+};
+
+#endif // SITEMAPSERVICE_RECORDCOLUMNIO_H__
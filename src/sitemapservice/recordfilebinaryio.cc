@@ -15,93 +15,135 @@
 
 #include "sitemapservice/recordfilebinaryio.h"
 
+#include "common/logger.h"
+
+namespace {
+
+// Layout of a record in the file, which is the raw VisitingRecord struct.
+// Records are copied out through it field by field, because VisitingRecord
+// owns its url, and it should not be overwritten as raw bytes.
+struct BinaryRecord {
+  time_t first_appear;
+  time_t last_access;
+  time_t last_change;
+  int count_access;
+  int count_change;
+  int64 last_content;
+  char* url;
+  int url_length;
+  UrlFprint fingerprint;
+};
+
+}  // namespace
+
 ///////////////////////////////////////////////////////////////////////////////
 // Implementation of RecordFileBinaryReader
 
 RecordFileBinaryReader::RecordFileBinaryReader() {
-  file_ = NULL;
+  position_ = 0;
 }
 
 RecordFileBinaryReader::~RecordFileBinaryReader() {
-  if (file_ != NULL) {
-    fclose(file_);
-  }
+  // Url of current_ is not owned by it.
+  current_.set_url(NULL);
 }
 
 bool RecordFileBinaryReader::Initialize(FILE* file) {
-  file_ = file;
+  position_ = ftell(file);
+  bool result = file_.Map(file);
+  fclose(file);
+  if (!result) {
+    Logger::Log(EVENT_ERROR, "Failed to map record file.");
+    return false;
+  }
+
+  file_.AdviseSequential();
   return true;
 }
 
-int RecordFileBinaryReader::Read(VisitingRecord *record) {
-  if (record->url() != NULL) {
-    delete record->url();
-    record->set_url(NULL);
+int RecordFileBinaryReader::Decode() {
+  current_.set_url(NULL);
+  if (position_ >= file_.size()) {
+    return 1;
   }
 
-  size_t result = fread(record, sizeof(VisitingRecord), 1, file_);
-  if (result == 1) {
-    char* url = new char[record->url_length() + 1];
-    result = fread(url, sizeof(char), record->url_length() + 1, file_);
-    if (result == record->url_length() + 1) {
-      record->set_url(url);
-      return 0;
-    } else {
-      delete[] url;
-      record->set_url(NULL);
-      return -1;
-    }
-  } else {
+  // The record is followed by its url and a '\0'.
+  int64 url_position = position_ + sizeof(BinaryRecord);
+  if (url_position > file_.size()) {
+    return -1;
+  }
+  BinaryRecord raw;
+  memcpy(&raw, file_.data() + position_, sizeof(BinaryRecord));
+  current_.first_appear = raw.first_appear;
+  current_.last_access = raw.last_access;
+  current_.last_change = raw.last_change;
+  current_.count_access = raw.count_access;
+  current_.count_change = raw.count_change;
+  current_.last_content = raw.last_content;
+  current_.set_url_length(raw.url_length);
+  current_.set_fingerprint(raw.fingerprint);
+
+  int length = current_.url_length();
+  if (length < 0 || url_position + length >= file_.size()
+      || file_.data()[url_position + length] != '\0') {
+    return -1;
+  }
+
+  current_.set_url(const_cast<char*>(file_.data() + url_position));
+  position_ = url_position + length + 1;
+  return 0;
+}
+
+int RecordFileBinaryReader::Read(VisitingRecord *record) {
+  int result = Decode();
+  if (result == 0) {
+    *record = current_;
+  } else if (record->url() != NULL) {
+    delete[] record->url();
     record->set_url(NULL);
-    return 1;
   }
+  return result;
+}
+
+const VisitingRecord* RecordFileBinaryReader::Next() {
+  return Decode() == 0 ? &current_ : NULL;
 }
 
 void RecordFileBinaryReader::Close() {
-  if (file_ != NULL) {
-    fclose(file_);
-    file_ = NULL;
-  }
+  current_.set_url(NULL);
+  file_.Unmap();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Implementation of RecordFileWriter
 
 RecordFileBinaryWriter::RecordFileBinaryWriter() {
-  file_ = NULL;
 }
 
 RecordFileBinaryWriter::~RecordFileBinaryWriter() {
-  if (file_ != NULL) {
-    fclose(file_);
-  }
 }
 
 bool RecordFileBinaryWriter::Initialize(FILE* file) {
-  file_ = file;
+  file_.Attach(file);
   return true;
 }
 
 int RecordFileBinaryWriter::Write(const VisitingRecord& record) {
   if (record.url() == NULL) return 0;
 
-  size_t result = fwrite(&record, sizeof(VisitingRecord), 1, file_);
-  if (result == 1) {
-    result = fwrite(record.url(), sizeof(char), record.url_length() + 1, file_);
-    if (result == record.url_length() + 1) {
-      return 0;
-    } else {
-      return -1;
-    }
-  } else {
+  if (!file_.Write(&record, sizeof(VisitingRecord))) {
     return 1;
   }
+  if (!file_.Write(record.url(), record.url_length() + 1)) {
+    return -1;
+  }
+  return 0;
 }
 
-void RecordFileBinaryWriter::Close() {
-  if (file_ != NULL) {
-    fclose(file_);
-    file_ = NULL;
+bool RecordFileBinaryWriter::Close() {
+  if (!file_.Close()) {
+    Logger::Log(EVENT_ERROR, "Failed to close record file.");
+    return false;
   }
+  return true;
 }
-
@@ -17,11 +17,15 @@
 // The visiting records are written/read in binary form.
 // This is efficient, but may waste some spaces because max length of URL is
 // much larger than actual value.
+// The reader maps the whole file, so Next returns urls pointing into the
+// mapped data directly.
 
 #ifndef SITEMAPSERVICE_RECORDFILEBINARYIO_H__
 #define SITEMAPSERVICE_RECORDFILEBINARYIO_H__
 
 #include "common/url.h"
+#include "common/mappedfile.h"
+#include "common/sequentialwriter.h"
 #include "sitemapservice/visitingrecord.h"
 #include "sitemapservice/recordfileio.h"
 
@@ -31,14 +35,29 @@ public:
   virtual ~RecordFileBinaryReader();
 
   // Overriden methods. See base class.
+  // The file is mapped from current position, and it is closed by this
+  // method.
   virtual bool Initialize(FILE* file);
 
   virtual int Read(VisitingRecord* record);
 
+  virtual const VisitingRecord* Next();
+
   virtual void Close();
 
 private:
-  FILE* file_;
+  // Decode next record to current_.
+  // Returns 0 if successful, 1 at the end of file, or -1 if the file is
+  // corrupted.
+  int Decode();
+
+  MappedFile file_;
+
+  // Offset of next record in the mapped file.
+  int64 position_;
+
+  // Last decoded record, whose url points into the mapped file.
+  VisitingRecord current_;
 
   DISALLOW_EVIL_CONSTRUCTORS(RecordFileBinaryReader);
 };
@@ -53,9 +72,9 @@ public:
 
   virtual int Write(const VisitingRecord& record);
 
-  virtual void Close();
+  virtual bool Close();
 private:
-  FILE* file_;
+  SequentialWriter file_;
 
   DISALLOW_EVIL_CONSTRUCTORS(RecordFileBinaryWriter);
 };
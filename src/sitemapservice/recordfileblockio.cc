@@ -0,0 +1,401 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "sitemapservice/recordfileblockio.h"
+
+#include <string.h>
+
+#include "common/logger.h"
+#include "third_party/zlib/zlib.h"
+
+namespace {
+
+// Append an unsigned varint to "buffer".
+void PutVarint(uint64 value, std::string* buffer) {
+  while (value >= 0x80) {
+    buffer->push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  buffer->push_back(static_cast<char>(value));
+}
+
+// Append a signed varint to "buffer", with zigzag encoding, so small
+// negative values are also encoded in few bytes.
+void PutSignedVarint(int64 value, std::string* buffer) {
+  uint64 zigzag = (static_cast<uint64>(value) << 1)
+    ^ static_cast<uint64>(value >> 63);
+  PutVarint(zigzag, buffer);
+}
+
+// Read an unsigned varint from "buffer" at "*position".
+// Returns false if the buffer ends before the varint.
+bool GetVarint(const std::string& buffer, int* position, uint64* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (*position >= static_cast<int>(buffer.size())) return false;
+
+    uint64 byte = static_cast<unsigned char>(buffer[(*position)++]);
+    *value |= (byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) return true;
+  }
+  return false;
+}
+
+bool GetSignedVarint(const std::string& buffer, int* position, int64* value) {
+  uint64 raw;
+  if (!GetVarint(buffer, position, &raw)) return false;
+  *value = static_cast<int64>(raw >> 1) ^ -static_cast<int64>(raw & 1);
+  return true;
+}
+
+// Checksum of a block, covering the header fields and compressed data.
+uint32 BlockChecksum(const RecordBlockHeader& header, const Bytef* data) {
+  uLong crc = crc32(0L, Z_NULL, 0);
+  crc = crc32(crc, reinterpret_cast<const Bytef*>(&header),
+              reinterpret_cast<const char*>(&header.crc)
+              - reinterpret_cast<const char*>(&header));
+  crc = crc32(crc, data, header.compressed_size);
+  return static_cast<uint32>(crc);
+}
+
+}  // namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementation of RecordFileBlockReader
+
+RecordFileBlockReader::RecordFileBlockReader() {
+  file_position_ = 0;
+  position_ = 0;
+  records_left_ = 0;
+  last_fprint_ = 0;
+  last_access_ = 0;
+}
+
+RecordFileBlockReader::~RecordFileBlockReader() {
+  // Url of current_ is not owned by it.
+  current_.set_url(NULL);
+}
+
+bool RecordFileBlockReader::Initialize(FILE* file) {
+  file_position_ = ftell(file);
+  bool result = file_.Map(file);
+  fclose(file);
+  if (!result) {
+    Logger::Log(EVENT_ERROR, "Failed to map record file.");
+    return false;
+  }
+
+  file_.AdviseSequential();
+  return true;
+}
+
+int RecordFileBlockReader::ReadBlock() {
+  if (file_position_ >= file_.size()) {
+    return 1;
+  }
+
+  if (file_position_ + static_cast<int64>(sizeof(RecordBlockHeader))
+      > file_.size()) {
+    Logger::Log(EVENT_ERROR, "Record block is truncated.");
+    return -1;
+  }
+  RecordBlockHeader header;
+  memcpy(&header, file_.data() + file_position_, sizeof(RecordBlockHeader));
+  file_position_ += sizeof(RecordBlockHeader);
+
+  // A corrupted header should not cause a huge allocation.
+  const uint32 max_size = RecordFileBlockWriter::kMaxBlockSize * 2;
+  if (header.record_count == 0 || header.raw_size > max_size
+      || header.compressed_size > compressBound(max_size)) {
+    Logger::Log(EVENT_ERROR, "Invalid record block header.");
+    return -1;
+  }
+
+  if (file_position_ + header.compressed_size > file_.size()) {
+    Logger::Log(EVENT_ERROR, "Record block is truncated.");
+    return -1;
+  }
+  const Bytef* data =
+    reinterpret_cast<const Bytef*>(file_.data() + file_position_);
+  file_position_ += header.compressed_size;
+
+  if (BlockChecksum(header, data) != header.crc) {
+    Logger::Log(EVENT_ERROR, "Record block checksum mismatch.");
+    return -1;
+  }
+
+  block_.resize(header.raw_size);
+  uLongf raw_size = header.raw_size;
+  if (header.raw_size > 0 &&
+      (uncompress(reinterpret_cast<Bytef*>(&block_[0]), &raw_size,
+                  data, header.compressed_size) != Z_OK
+       || raw_size != header.raw_size)) {
+    Logger::Log(EVENT_ERROR, "Failed to uncompress record block.");
+    return -1;
+  }
+
+  position_ = 0;
+  records_left_ = static_cast<int>(header.record_count);
+  last_fprint_ = 0;
+  last_access_ = 0;
+  return 0;
+}
+
+int RecordFileBlockReader::Decode() {
+  current_.set_url(NULL);
+  if (records_left_ == 0) {
+    int result = ReadBlock();
+    if (result != 0) return result;
+  }
+
+  uint64 fprint_delta, url_length;
+  int64 access_delta, first_appear, last_change;
+  int64 count_access, count_change, last_content;
+  if (!GetVarint(block_, &position_, &fprint_delta)
+      || !GetSignedVarint(block_, &position_, &access_delta)
+      || !GetSignedVarint(block_, &position_, &first_appear)
+      || !GetSignedVarint(block_, &position_, &last_change)
+      || !GetSignedVarint(block_, &position_, &count_access)
+      || !GetSignedVarint(block_, &position_, &count_change)
+      || !GetSignedVarint(block_, &position_, &last_content)
+      || !GetVarint(block_, &position_, &url_length)
+      || url_length > static_cast<uint64>(block_.size() - position_)) {
+    Logger::Log(EVENT_ERROR, "Record block is corrupted.");
+    records_left_ = 0;
+    file_position_ = file_.size();
+    return -1;
+  }
+
+  last_fprint_ += fprint_delta;
+  last_access_ += access_delta;
+
+  current_.first_appear = static_cast<time_t>(last_access_ - first_appear);
+  current_.last_access = static_cast<time_t>(last_access_);
+  current_.last_change = static_cast<time_t>(last_access_ - last_change);
+  current_.count_access = static_cast<int>(count_access);
+  current_.count_change = static_cast<int>(count_change);
+  current_.last_content = last_content;
+
+  // Urls are not terminated in the block, so they are copied out.
+  int length = static_cast<int>(url_length);
+  url_buffer_.assign(block_, position_, length);
+  position_ += length;
+
+  current_.set_url(const_cast<char*>(url_buffer_.c_str()));
+  current_.set_url_length(length);
+  current_.set_fingerprint(last_fprint_);
+
+  --records_left_;
+  return 0;
+}
+
+int RecordFileBlockReader::Read(VisitingRecord* record) {
+  int result = Decode();
+  if (result == 0) {
+    *record = current_;
+  } else if (record->url() != NULL) {
+    delete[] record->url();
+    record->set_url(NULL);
+  }
+  return result;
+}
+
+const VisitingRecord* RecordFileBlockReader::Next() {
+  return Decode() == 0 ? &current_ : NULL;
+}
+
+void RecordFileBlockReader::Close() {
+  current_.set_url(NULL);
+  file_.Unmap();
+}
+
+bool RecordFileBlockReader::Seek(int64 offset) {
+  if (offset < 0 || offset > file_.size()) {
+    return false;
+  }
+
+  current_.set_url(NULL);
+  file_position_ = offset;
+  records_left_ = 0;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementation of RecordFileBlockWriter
+
+RecordFileBlockWriter::RecordFileBlockWriter() {
+  record_count_ = 0;
+  first_fprint_ = 0;
+  ordinal_ = 0;
+  columns_ = NULL;
+  urls_ = NULL;
+  last_fprint_ = 0;
+  last_access_ = 0;
+}
+
+RecordFileBlockWriter::~RecordFileBlockWriter() {
+  Close();
+  if (columns_ != NULL) {
+    delete columns_;
+  }
+  if (urls_ != NULL) {
+    delete urls_;
+  }
+}
+
+bool RecordFileBlockWriter::Initialize(FILE* file) {
+  file_.Attach(file);
+  return true;
+}
+
+int RecordFileBlockWriter::Write(const VisitingRecord& record) {
+  if (record.url() == NULL) return 0;
+
+  if (record_count_ == 0) {
+    first_fprint_ = record.fingerprint();
+  }
+
+  // Columns and url index are only optimizations of reading. If they fail,
+  // they are removed, and the record file is still written, which is always
+  // scanned without them.
+  if (columns_ != NULL && !columns_->Write(record)) {
+    Logger::Log(EVENT_ERROR, "Failed to write columns, which are dropped.");
+    columns_->Close(0, false);
+    delete columns_;
+    columns_ = NULL;
+  }
+  if (urls_ != NULL && !urls_->Add(record.url(), record.url_length())) {
+    Logger::Log(EVENT_ERROR, "Failed to build url index, which is dropped.");
+    urls_->Close(0, false);
+    delete urls_;
+    urls_ = NULL;
+  }
+
+  int64 last_access = static_cast<int64>(record.last_access);
+  PutVarint(record.fingerprint() - last_fprint_, &block_);
+  PutSignedVarint(last_access - last_access_, &block_);
+  PutSignedVarint(last_access - record.first_appear, &block_);
+  PutSignedVarint(last_access - record.last_change, &block_);
+  PutSignedVarint(record.count_access, &block_);
+  PutSignedVarint(record.count_change, &block_);
+  PutSignedVarint(record.last_content, &block_);
+  PutVarint(record.url_length(), &block_);
+  block_.append(record.url(), record.url_length());
+
+  last_fprint_ = record.fingerprint();
+  last_access_ = last_access;
+  ++record_count_;
+
+  if (record_count_ >= kMaxBlockRecords
+      || static_cast<int>(block_.size()) >= kMaxBlockSize) {
+    return WriteBlock();
+  }
+  return 0;
+}
+
+int RecordFileBlockWriter::WriteBlock() {
+  if (record_count_ == 0) return 0;
+
+  RecordBlockHeader header;
+  header.record_count = static_cast<uint32>(record_count_);
+  header.raw_size = static_cast<uint32>(block_.size());
+
+  uLongf compressed_size = compressBound(header.raw_size);
+  std::string compressed(compressed_size, '\0');
+  Bytef* data = reinterpret_cast<Bytef*>(&compressed[0]);
+  if (compress2(data, &compressed_size,
+                reinterpret_cast<const Bytef*>(block_.data()),
+                header.raw_size, Z_DEFAULT_COMPRESSION) != Z_OK) {
+    return -1;
+  }
+  header.compressed_size = static_cast<uint32>(compressed_size);
+  header.crc = BlockChecksum(header, data);
+
+  block_.clear();
+  record_count_ = 0;
+  last_fprint_ = 0;
+  last_access_ = 0;
+
+  if (!index_path_.empty()) {
+    RecordIndexEntry entry;
+    entry.fingerprint = first_fprint_;
+    entry.offset = file_.position();
+    entry.ordinal = ordinal_;
+    index_.push_back(entry);
+  }
+  ordinal_ += header.record_count;
+
+  if (!file_.Write(&header, sizeof(RecordBlockHeader))
+      || !file_.Write(data, compressed_size)) {
+    return -1;
+  }
+  return 0;
+}
+
+bool RecordFileBlockWriter::Close() {
+  bool result = true;
+  if (file_.is_open()) {
+    result = WriteBlock() == 0;
+    if (!result) {
+      Logger::Log(EVENT_ERROR, "Failed to write last record block.");
+    }
+
+    int64 file_size = file_.position();
+    if (!file_.Close()) {
+      Logger::Log(EVENT_ERROR, "Failed to close record file.");
+      result = false;
+    }
+
+    // A broken file is not indexed, so it is always scanned.
+    if (result && !index_path_.empty()) {
+      RecordFileIndex::Write(index_path_, file_size, index_);
+    }
+    if (columns_ != NULL) {
+      columns_->Close(file_size, result);
+    }
+    if (urls_ != NULL) {
+      urls_->Close(file_size, result);
+    }
+  }
+  return result;
+}
+
+void RecordFileBlockWriter::EnableIndex(const std::string& path) {
+  index_path_ = path;
+}
+
+bool RecordFileBlockWriter::EnableColumns(const std::string& recordfile) {
+  if (columns_ == NULL) {
+    columns_ = new RecordColumnWriter();
+  }
+  if (!columns_->Open(recordfile)) {
+    delete columns_;
+    columns_ = NULL;
+    return false;
+  }
+  return true;
+}
+
+bool RecordFileBlockWriter::EnableUrlIndex(const std::string& recordfile) {
+  if (urls_ == NULL) {
+    urls_ = new RecordUrlIndexBuilder();
+  }
+  if (!urls_->Open(recordfile)) {
+    delete urls_;
+    urls_ = NULL;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,187 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// This file implements RecordFileReader and RecordFileWriter interfaces with
+// a compact block format (version B).
+// Records are grouped into blocks of at most kMaxBlockRecords records. Every
+// block is compressed by zlib, and protected by a crc32 checksum. A block is
+// a RecordBlockHeader followed by the compressed data.
+// In a block, every record is encoded as varints:
+//   finger print - delta from previous finger print (modulo 2^64)
+//   last_access  - zigzag delta from previous last_access
+//   first_appear - zigzag delta from last_access of the same record
+//   last_change  - zigzag delta from last_access of the same record
+//   count_access, count_change, last_content - zigzag value
+//   url length, followed by the url without ending '\0'
+// The deltas are reset at the beginning of every block, so every block can
+// be decoded alone.
+// Appending to a file only appends new blocks, so it is also used for
+// journals.
+// The reader maps the whole file, and uncompresses blocks from the mapped
+// data directly.
+
+#ifndef SITEMAPSERVICE_RECORDFILEBLOCKIO_H__
+#define SITEMAPSERVICE_RECORDFILEBLOCKIO_H__
+
+#include <string>
+#include <vector>
+
+#include "common/basictypes.h"
+#include "common/url.h"
+#include "common/mappedfile.h"
+#include "common/sequentialwriter.h"
+#include "sitemapservice/visitingrecord.h"
+#include "sitemapservice/recordfileio.h"
+#include "sitemapservice/recordfileindex.h"
+#include "sitemapservice/recordcolumnio.h"
+#include "sitemapservice/recordurlindex.h"
+
+// Header of a block.
+struct RecordBlockHeader {
+  // Number of records in this block.
+  uint32 record_count;
+
+  // Size of the block data before and after compression.
+  uint32 raw_size;
+  uint32 compressed_size;
+
+  // crc32 of the fields above, followed by the compressed data.
+  uint32 crc;
+};
+
+class RecordFileBlockReader : public RecordFileReader {
+public:
+  RecordFileBlockReader();
+  virtual ~RecordFileBlockReader();
+
+  // Overriden methods. See base class.
+  // The file is mapped from current position, and it is closed by this
+  // method.
+  virtual bool Initialize(FILE* file);
+
+  // Returns 1 at the end of file, or -1 if the file is corrupted.
+  virtual int Read(VisitingRecord* record);
+
+  virtual const VisitingRecord* Next();
+
+  virtual void Close();
+
+  // Move to the block at "offset" of the file, which is usually found through
+  // RecordFileIndex. The mapping is kept, so it is cheap to jump among blocks.
+  // Returns false if "offset" is out of the file.
+  bool Seek(int64 offset);
+
+private:
+  // Read and decompress next block.
+  // Returns 0 if successful, 1 at the end of file, or -1 if the block is
+  // corrupted.
+  int ReadBlock();
+
+  // Decode next record to current_.
+  // Returns 0 if successful, 1 at the end of file, or -1 if the file is
+  // corrupted.
+  int Decode();
+
+  MappedFile file_;
+
+  // Offset of next block in the mapped file.
+  int64 file_position_;
+
+  // Decompressed data of current block, and the position of next record.
+  std::string block_;
+  int position_;
+
+  // Number of records left in current block.
+  int records_left_;
+
+  // Values of previous record, used to decode deltas.
+  UrlFprint last_fprint_;
+  int64 last_access_;
+
+  // Last decoded record. Its url points to url_buffer_, which is reused by
+  // all records.
+  VisitingRecord current_;
+  std::string url_buffer_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(RecordFileBlockReader);
+};
+
+class RecordFileBlockWriter : public RecordFileWriter {
+public:
+  // Max number of records in a block.
+  static const int kMaxBlockRecords = 4096;
+
+  // A block is written once its data exceeds this size.
+  static const int kMaxBlockSize = 1024 * 1024;
+
+  RecordFileBlockWriter();
+  virtual ~RecordFileBlockWriter();
+
+  // Overridden methods. See base class.
+  virtual bool Initialize(FILE* file);
+
+  virtual int Write(const VisitingRecord& record);
+
+  // Pending records are written as the last block, and the indexes and
+  // columns are finished if they are enabled.
+  virtual bool Close();
+
+  // Collect the first finger print and offset of every block, and write
+  // them to an index file with given path when this writer is closed.
+  void EnableIndex(const std::string& path);
+
+  // Write column files of the record file with given path, see
+  // RecordColumnWriter. Returns false if the column files can't be created.
+  bool EnableColumns(const std::string& recordfile);
+
+  // Write url index of the record file with given path, see RecordUrlIndex.
+  bool EnableUrlIndex(const std::string& recordfile);
+
+private:
+  // Compress and write the pending records as a block.
+  // Returns 0 if successful, or a non-zero error code.
+  int WriteBlock();
+
+  SequentialWriter file_;
+
+  // Encoded records not written yet.
+  std::string block_;
+  int record_count_;
+
+  // Finger print of the first record in current block.
+  UrlFprint first_fprint_;
+
+  // Index entries of written blocks, and path of the index file. The path
+  // is empty if index is not enabled.
+  std::vector<RecordIndexEntry> index_;
+  std::string index_path_;
+
+  // Ordinal of the first record in current block.
+  int64 ordinal_;
+
+  // Column files, or NULL if columns are not enabled.
+  RecordColumnWriter* columns_;
+
+  // Url index builder, or NULL if url index is not enabled.
+  RecordUrlIndexBuilder* urls_;
+
+  // Values of previous record, used to encode deltas.
+  UrlFprint last_fprint_;
+  int64 last_access_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(RecordFileBlockWriter);
+};
+
+#endif // SITEMAPSERVICE_RECORDFILEBLOCKIO_H__
@@ -0,0 +1,300 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "sitemapservice/recordfileimageio.h"
+
+#include "common/logger.h"
+#include "common/sequentialwriter.h"
+#include "third_party/zlib/zlib.h"
+
+namespace {
+
+// Calculates crc32 of a large buffer, whose size may exceed uInt.
+uint32 Checksum(const char* data, uint64 size) {
+  uLong crc = crc32(0L, Z_NULL, 0);
+  while (size > 0) {
+    uInt length = size > 0x40000000 ? 0x40000000 : static_cast<uInt>(size);
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(data), length);
+    data += length;
+    size -= length;
+  }
+  return static_cast<uint32>(crc);
+}
+
+uint32 HeaderChecksum(const RecordImageHeader& header) {
+  return Checksum(reinterpret_cast<const char*>(&header),
+                  reinterpret_cast<const char*>(&header.header_crc)
+                  - reinterpret_cast<const char*>(&header));
+}
+
+}  // namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementation of RecordImage
+
+RecordImage::RecordImage() {
+  header_ = NULL;
+  entries_ = NULL;
+  urls_ = NULL;
+}
+
+RecordImage::~RecordImage() {
+  Close();
+}
+
+bool RecordImage::Open(const char* path, Validation validation) {
+  Close();
+
+  // MappedFile::Open complains about missing files.
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    return false;
+  }
+  bool result = file_.Map(file);
+  fclose(file);
+  return result && Validate(validation);
+}
+
+bool RecordImage::Open(FILE* file) {
+  Close();
+  return file_.Map(file) && Validate(VALIDATE_ALL);
+}
+
+void RecordImage::Close() {
+  file_.Unmap();
+  header_ = NULL;
+  entries_ = NULL;
+  urls_ = NULL;
+}
+
+bool RecordImage::Validate(Validation validation) {
+  if (file_.size() < static_cast<int64>(sizeof(RecordImageHeader))) {
+    return false;
+  }
+
+  // Simply return if it is not an image.
+  const RecordImageHeader* header =
+    reinterpret_cast<const RecordImageHeader*>(file_.data());
+  if (header->version != kVersion) {
+    return false;
+  }
+
+  bool valid = false;
+  do {
+    if (header->header_crc != HeaderChecksum(*header)) break;
+
+    uint64 entries_size = header->record_count * sizeof(RecordImageEntry);
+    if (static_cast<uint64>(file_.size()) !=
+        sizeof(RecordImageHeader) + entries_size + header->url_bytes) {
+      break;
+    }
+
+    const char* entries = file_.data() + sizeof(RecordImageHeader);
+    const char* urls = entries + entries_size;
+    if (validation == VALIDATE_ALL) {
+      if (header->entries_crc != Checksum(entries, entries_size)) break;
+      if (header->urls_crc != Checksum(urls, header->url_bytes)) break;
+
+      // Every url should be valid, so it can be used in place.
+      const RecordImageEntry* entry =
+        reinterpret_cast<const RecordImageEntry*>(entries);
+      uint64 i = 0;
+      for (; i < header->record_count; ++i, ++entry) {
+        if (!IsValidEntry(*entry, header->url_bytes, urls)) break;
+      }
+      if (i != header->record_count) break;
+    }
+
+    header_ = header;
+    entries_ = reinterpret_cast<const RecordImageEntry*>(entries);
+    urls_ = urls;
+    valid = true;
+  } while (false);
+
+  if (!valid) {
+    Logger::Log(EVENT_ERROR, "Record image is corrupted.");
+    file_.Unmap();
+  }
+  return valid;
+}
+
+bool RecordImage::IsValidEntry(const RecordImageEntry& entry,
+                               uint64 url_bytes, const char* urls) const {
+  return entry.url_length >= 0
+    && entry.url_offset + entry.url_length < url_bytes
+    && urls[entry.url_offset + entry.url_length] == '\0';
+}
+
+int64 RecordImage::Find(const UrlFprint& fprint) const {
+  int64 index = LowerBound(fprint);
+  if (index >= record_count() || entries_[index].fingerprint != fprint) {
+    return -1;
+  }
+
+  // The entries may not be validated when the image is opened.
+  if (!IsValidEntry(entries_[index], header_->url_bytes, urls_)) {
+    Logger::Log(EVENT_ERROR, "Record image is corrupted.");
+    return -1;
+  }
+  return index;
+}
+
+int64 RecordImage::LowerBound(const UrlFprint& fprint) const {
+  int64 low = 0, high = record_count();
+  while (low < high) {
+    int64 middle = low + (high - low) / 2;
+    if (entries_[middle].fingerprint < fprint) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+void RecordImage::CopyEntry(const RecordImageEntry& entry,
+                            VisitingRecord* record) {
+  record->set_fingerprint(entry.fingerprint);
+  record->set_url_length(entry.url_length);
+  record->first_appear = static_cast<time_t>(entry.first_appear);
+  record->last_access = static_cast<time_t>(entry.last_access);
+  record->last_change = static_cast<time_t>(entry.last_change);
+  record->last_content = entry.last_content;
+  record->count_access = entry.count_access;
+  record->count_change = entry.count_change;
+}
+
+int RecordImage::Write(const char* path,
+                       const std::vector<const VisitingRecord*>& records) {
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) {
+    Logger::Log(EVENT_ERROR, "Failed to open [%s] to write.", path);
+    return 1;
+  }
+  SequentialWriter writer;
+  writer.Attach(file);
+
+  RecordImageHeader header;
+  memset(&header, 0, sizeof(header));
+  header.version = kVersion;
+  header.record_count = records.size();
+
+  // Header is rewritten after the checksums are calculated.
+  bool result = writer.Write(&header, sizeof(header));
+
+  // Write all the entries.
+  uLong crc = crc32(0L, Z_NULL, 0);
+  RecordImageEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  for (int i = 0, n = static_cast<int>(records.size()); i < n && result; ++i) {
+    const VisitingRecord* record = records[i];
+    entry.fingerprint = record->fingerprint();
+    entry.first_appear = record->first_appear;
+    entry.last_access = record->last_access;
+    entry.last_change = record->last_change;
+    entry.last_content = record->last_content;
+    entry.count_access = record->count_access;
+    entry.count_change = record->count_change;
+    entry.url_offset = header.url_bytes;
+    entry.url_length = record->url_length();
+    header.url_bytes += record->url_length() + 1;
+
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(&entry), sizeof(entry));
+    result = writer.Write(&entry, sizeof(entry));
+  }
+  header.entries_crc = static_cast<uint32>(crc);
+
+  // Write all the url strings.
+  crc = crc32(0L, Z_NULL, 0);
+  for (int i = 0, n = static_cast<int>(records.size()); i < n && result; ++i) {
+    const VisitingRecord* record = records[i];
+    uInt length = static_cast<uInt>(record->url_length() + 1);
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(record->url()), length);
+    result = writer.Write(record->url(), length);
+  }
+  header.urls_crc = static_cast<uint32>(crc);
+
+  // Write the final header.
+  if (result) {
+    header.header_crc = HeaderChecksum(header);
+    result = writer.WriteAt(0, &header, sizeof(header));
+  }
+
+  if (!writer.Close()) {
+    result = false;
+  }
+  if (!result) {
+    Logger::Log(EVENT_ERROR, "Failed to write record image [%s].", path);
+  }
+  return result ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementation of RecordFileImageReader
+
+RecordFileImageReader::RecordFileImageReader() {
+  next_ = 0;
+}
+
+RecordFileImageReader::~RecordFileImageReader() {
+  current_.set_url(NULL);
+}
+
+bool RecordFileImageReader::Initialize(FILE* file) {
+  bool result = image_.Open(file);
+  fclose(file);
+  next_ = 0;
+  return result;
+}
+
+int RecordFileImageReader::Read(VisitingRecord *record) {
+  if (record->url() != NULL) {
+    delete[] record->url();
+    record->set_url(NULL);
+  }
+
+  if (next_ >= image_.record_count()) {
+    return 1;
+  }
+
+  const RecordImageEntry& entry = image_.entry(next_++);
+  RecordImage::CopyEntry(entry, record);
+
+  char* url = new char[entry.url_length + 1];
+  memcpy(url, image_.url(entry), entry.url_length + 1);
+  record->set_url(url);
+  return 0;
+}
+
+const VisitingRecord* RecordFileImageReader::Next() {
+  current_.set_url(NULL);
+  if (next_ >= image_.record_count()) {
+    return NULL;
+  }
+
+  const RecordImageEntry& entry = image_.entry(next_++);
+  RecordImage::CopyEntry(entry, &current_);
+  current_.set_url(const_cast<char*>(image_.url(entry)));
+  return &current_;
+}
+
+void RecordFileImageReader::Close() {
+  current_.set_url(NULL);
+  image_.Close();
+}
+
+void RecordFileImageReader::Seek(const UrlFprint& fprint) {
+  next_ = image_.LowerBound(fprint);
+}
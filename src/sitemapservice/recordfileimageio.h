@@ -0,0 +1,184 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// This file implements an image format of visiting record file, which can
+// be mapped into memory and used in place.
+// Layout of an image file is:
+//   RecordImageHeader
+//   RecordImageEntry[record_count], in ascending order of finger print
+//   url strings, each one is terminated by '\0'
+// The header contains crc32 checksums of all the three parts. Readers check
+// all of them, so a truncated or corrupted image is rejected before it is
+// used. Lookups of a few records check only the header and the entries they
+// use, so they don't read the whole file.
+
+#ifndef SITEMAPSERVICE_RECORDFILEIMAGEIO_H__
+#define SITEMAPSERVICE_RECORDFILEIMAGEIO_H__
+
+#include <vector>
+#include "common/url.h"
+#include "common/mappedfile.h"
+#include "sitemapservice/visitingrecord.h"
+#include "sitemapservice/recordfileio.h"
+
+struct RecordImageHeader {
+  // Version of the file, which is RecordImage::kVersion.
+  uint64 version;
+
+  // Number of entries.
+  uint64 record_count;
+
+  // Number of bytes of all url strings, including the '\0's.
+  uint64 url_bytes;
+
+  // Checksums of the entries and the url strings.
+  uint32 entries_crc;
+  uint32 urls_crc;
+
+  // Checksum of all the fields above.
+  uint32 header_crc;
+
+  uint32 reserved;
+};
+
+// Fixed size form of a VisitingRecord.
+// The time fields are always 64 bits, no matter how large time_t is.
+struct RecordImageEntry {
+  UrlFprint fingerprint;
+  int64 first_appear;
+  int64 last_access;
+  int64 last_change;
+  int64 last_content;
+  int count_access;
+  int count_change;
+
+  // Offset of the url string, from the beginning of all url strings.
+  uint64 url_offset;
+  int url_length;
+
+  int reserved;
+};
+
+class RecordImage {
+ public:
+  static const uint64 kVersion = 200910011200ULL;
+
+  // How much of an image is validated when it is opened.
+  enum Validation {
+    // The header and the file size only. Entries are checked when they are
+    // found, see Find.
+    VALIDATE_HEADER,
+    // Also the checksums of all entries and url strings, which reads the
+    // whole file.
+    VALIDATE_ALL,
+  };
+
+  RecordImage();
+  ~RecordImage();
+
+  // Maps the image file with given path, and validates it.
+  // Returns false if the file is not a valid image. No error is logged if
+  // it doesn't exist or it is simply not an image file, so caller can try
+  // other formats.
+  bool Open(const char* path, Validation validation);
+
+  // Same as above, but maps the file underlying an opened stream, and
+  // validates all of it.
+  bool Open(FILE* file);
+
+  // Unmaps the image.
+  void Close();
+
+  // Returns number of records in the image.
+  int64 record_count() const {
+    return header_ == NULL ? 0 : header_->record_count;
+  }
+
+  // Returns the index-th entry. No bound check is done.
+  const RecordImageEntry& entry(int64 index) const {
+    return entries_[index];
+  }
+
+  // Returns index of the entry with given finger print, or -1 if there is
+  // no such entry or it is corrupted. Entries are binary searched.
+  int64 Find(const UrlFprint& fprint) const;
+
+  // Returns index of the first entry whose finger print is not less than
+  // given one, or record_count() if there is no such entry.
+  int64 LowerBound(const UrlFprint& fprint) const;
+
+  // Returns the url string for an entry.
+  const char* url(const RecordImageEntry& entry) const {
+    return urls_ + entry.url_offset;
+  }
+
+  // Copies fields of an entry to a visiting record, except the url string.
+  static void CopyEntry(const RecordImageEntry& entry, VisitingRecord* record);
+
+  // Writes records to an image file.
+  // Returns 0 if successful, or a non-zero error code.
+  static int Write(const char* path,
+                   const std::vector<const VisitingRecord*>& records);
+
+ private:
+  // Validates the mapped file, and sets the data pointers.
+  bool Validate(Validation validation);
+
+  // Returns whether the url of an entry is in the url strings, and it is
+  // terminated, so it can be used in place.
+  bool IsValidEntry(const RecordImageEntry& entry, uint64 url_bytes,
+                    const char* urls) const;
+
+  MappedFile file_;
+
+  const RecordImageHeader* header_;
+  const RecordImageEntry* entries_;
+  const char* urls_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(RecordImage);
+};
+
+class RecordFileImageReader : public RecordFileReader {
+public:
+  RecordFileImageReader();
+  virtual ~RecordFileImageReader();
+
+  // Overriden methods. See base class.
+  // The file is mapped, and it is closed by this method.
+  virtual bool Initialize(FILE* file);
+
+  virtual int Read(VisitingRecord* record);
+
+  // Url of the returned record points into the image directly.
+  virtual const VisitingRecord* Next();
+
+  virtual void Close();
+
+  // Move to the first record whose finger print is not less than given one.
+  void Seek(const UrlFprint& fprint);
+
+private:
+  RecordImage image_;
+
+  // Index of next record to read.
+  int64 next_;
+
+  // Last record returned by Next. Its url is not owned by it.
+  VisitingRecord current_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(RecordFileImageReader);
+};
+
+#endif // SITEMAPSERVICE_RECORDFILEIMAGEIO_H__
@@ -0,0 +1,279 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "sitemapservice/recordfileindex.h"
+
+#include "common/logger.h"
+#include "common/fileutil.h"
+#include "sitemapservice/recordfileio.h"
+#include "sitemapservice/recordfileblockio.h"
+#include "third_party/zlib/zlib.h"
+
+namespace {
+
+uint32 EntriesChecksum(const std::vector<RecordIndexEntry>& entries) {
+  uLong crc = crc32(0L, Z_NULL, 0);
+  if (!entries.empty()) {
+    uInt size = static_cast<uInt>(entries.size() * sizeof(RecordIndexEntry));
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(&entries[0]), size);
+  }
+  return static_cast<uint32>(crc);
+}
+
+}  // namespace
+
+const char* RecordFileIndex::kIndexSuffix = "_index";
+
+std::string RecordFileIndex::GetIndexPath(const std::string& recordfile) {
+  std::string path(recordfile);
+  path.append(kIndexSuffix);
+  return path;
+}
+
+bool RecordFileIndex::Write(const std::string& path, int64 file_size,
+                            const std::vector<RecordIndexEntry>& entries) {
+  RecordIndexHeader header;
+  memset(&header, 0, sizeof(header));
+  header.version = kVersion;
+  header.file_size = file_size;
+  header.entry_count = entries.size();
+  header.entries_crc = EntriesChecksum(entries);
+
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    Logger::Log(EVENT_ERROR, "Failed to open [%s] to write.", path.c_str());
+    return false;
+  }
+
+  bool result = fwrite(&header, sizeof(header), 1, file) == 1;
+  if (result && !entries.empty()) {
+    result = fwrite(&entries[0], sizeof(RecordIndexEntry), entries.size(),
+                    file) == entries.size();
+  }
+  if (fclose(file) != 0) {
+    result = false;
+  }
+
+  if (!result) {
+    Logger::Log(EVENT_ERROR, "Failed to write record index [%s].",
+              path.c_str());
+    FileUtil::DeleteFile(path.c_str());
+  }
+  return result;
+}
+
+bool RecordFileIndex::Load(const std::string& recordfile) {
+  entries_.clear();
+
+  std::string path = GetIndexPath(recordfile);
+  FileAttribute attr;
+  if (!FileUtil::Exists(path.c_str())
+      || !FileUtil::GetFileAttribute(recordfile.c_str(), &attr)) {
+    return false;
+  }
+
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    return false;
+  }
+
+  // The index is ignored if it belongs to another version of record file.
+  RecordIndexHeader header;
+  bool result = fread(&header, sizeof(header), 1, file) == 1
+    && header.version == kVersion
+    && header.file_size == static_cast<uint64>(attr.size)
+    && header.entry_count * sizeof(RecordIndexEntry) <= header.file_size;
+
+  if (result && header.entry_count > 0) {
+    entries_.resize(static_cast<size_t>(header.entry_count));
+    result = fread(&entries_[0], sizeof(RecordIndexEntry), entries_.size(),
+                   file) == entries_.size();
+  }
+  fclose(file);
+
+  if (result) {
+    result = EntriesChecksum(entries_) == header.entries_crc;
+  }
+
+  if (!result) {
+    Logger::Log(EVENT_NORMAL, "Ignore invalid record index [%s].",
+              path.c_str());
+    entries_.clear();
+  }
+  return result;
+}
+
+int64 RecordFileIndex::Find(const UrlFprint& fprint) const {
+  int64 first_ordinal = 0;
+  return Find(fprint, &first_ordinal);
+}
+
+int64 RecordFileIndex::Find(const UrlFprint& fprint,
+                            int64* first_ordinal) const {
+  // Find the last block whose first finger print is not greater.
+  int low = 0, high = static_cast<int>(entries_.size());
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    if (entries_[middle].fingerprint <= fprint) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (low == 0) return -1;
+
+  *first_ordinal = entries_[low - 1].ordinal;
+  return entries_[low - 1].offset;
+}
+
+bool RecordFileIndex::Lookup(const std::string& recordfile,
+                             const UrlFprint& fprint,
+                             VisitingRecord* record) {
+  if (!FileUtil::Exists(recordfile.c_str())) {
+    return false;
+  }
+
+  RecordFileIndex index;
+  RecordFileReader* reader = NULL;
+  if (index.Load(recordfile)) {
+    int64 offset = index.Find(fprint);
+    if (offset < 0) return false;
+    reader = RecordFileIOFactory::CreateReader(recordfile, offset);
+  } else {
+    reader = RecordFileIOFactory::CreateReader(recordfile);
+  }
+  if (reader == NULL) {
+    return false;
+  }
+
+  // Records are sorted, so the scan stops at a larger finger print.
+  bool found = false;
+  const VisitingRecord* next = NULL;
+  while ((next = reader->Next()) != NULL && next->fingerprint() <= fprint) {
+    if (next->fingerprint() == fprint) {
+      *record = *next;
+      found = true;
+      break;
+    }
+  }
+
+  delete reader;
+  return found;
+}
+
+int64 RecordFileIndex::FindOrdinal(int64 ordinal, int64* first_ordinal) const {
+  // Find the last block whose first ordinal is not greater.
+  int low = 0, high = static_cast<int>(entries_.size());
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    if (entries_[middle].ordinal <= ordinal) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (low == 0) return -1;
+
+  *first_ordinal = entries_[low - 1].ordinal;
+  return entries_[low - 1].offset;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Implementation of RecordOrdinalReader
+
+RecordOrdinalReader::RecordOrdinalReader() {
+  reader_ = NULL;
+  next_ordinal_ = 0;
+  last_ = NULL;
+}
+
+RecordOrdinalReader::~RecordOrdinalReader() {
+  Close();
+}
+
+bool RecordOrdinalReader::Open(const std::string& recordfile) {
+  Close();
+
+  if (!index_.Load(recordfile)) {
+    return false;
+  }
+
+  // Only block files are indexed.
+  reader_ = RecordFileIOFactory::CreateBlockReader(recordfile);
+  if (reader_ == NULL) {
+    return false;
+  }
+
+  next_ordinal_ = 0;
+  last_ = NULL;
+  return true;
+}
+
+void RecordOrdinalReader::Close() {
+  if (reader_ != NULL) {
+    delete reader_;
+    reader_ = NULL;
+  }
+  next_ordinal_ = 0;
+  last_ = NULL;
+}
+
+const VisitingRecord* RecordOrdinalReader::Get(int64 ordinal) {
+  if (reader_ == NULL || ordinal < 0) return NULL;
+
+  // Seek to the block through the index, if the record is behind, or it is
+  // not in the current block or the next one.
+  int64 first_ordinal = 0;
+  int64 offset = index_.FindOrdinal(ordinal, &first_ordinal);
+  if (offset < 0) return NULL;
+
+  if (ordinal < next_ordinal_ || first_ordinal > next_ordinal_) {
+    if (!reader_->Seek(offset)) return NULL;
+    next_ordinal_ = first_ordinal;
+    last_ = NULL;
+  }
+
+  while (next_ordinal_ <= ordinal) {
+    last_ = reader_->Next();
+    if (last_ == NULL) return NULL;
+    ++next_ordinal_;
+  }
+  return last_;
+}
+
+const VisitingRecord* RecordOrdinalReader::Find(const UrlFprint& fprint) {
+  if (reader_ == NULL) return NULL;
+
+  int64 first_ordinal = 0;
+  int64 offset = index_.Find(fprint, &first_ordinal);
+  if (offset < 0) return NULL;
+
+  // Read forward if the last record is in the block and before the finger
+  // print. Otherwise seek to the block.
+  if (last_ == NULL || next_ordinal_ <= first_ordinal
+      || !(last_->fingerprint() < fprint)) {
+    if (!reader_->Seek(offset)) return NULL;
+    next_ordinal_ = first_ordinal;
+    last_ = NULL;
+  }
+
+  // Records are sorted, so the scan stops at a larger finger print.
+  do {
+    last_ = reader_->Next();
+    if (last_ == NULL) return NULL;
+    ++next_ordinal_;
+  } while (last_->fingerprint() < fprint);
+  return last_->fingerprint() == fprint ? last_ : NULL;
+}
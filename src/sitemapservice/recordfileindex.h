@@ -0,0 +1,162 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// RecordFileIndex is a sparse index of a record file sorted by finger print,
+// like the base data file. It holds the first finger print of every block
+// in the file, with the offset of the block, so a record can be found by a
+// binary search in the index, and a scan of only one block.
+// Every entry also holds the ordinal of the first record in the block, so
+// the n-th record can be found in the same way, see RecordOrdinalReader.
+// The index of a record file is stored in a side file, whose name is the
+// record file name with kIndexSuffix. It is written by RecordFileBlockWriter
+// when the record file is closed, see RecordFileIOFactory::CreateIndexedWriter.
+// Layout of an index file is:
+//   RecordIndexHeader
+//   RecordIndexEntry[entry_count], in ascending order of finger print
+// The index also records size of the indexed file, so an index left by an
+// interrupted merge is never used with a different record file.
+
+#ifndef SITEMAPSERVICE_RECORDFILEINDEX_H__
+#define SITEMAPSERVICE_RECORDFILEINDEX_H__
+
+#include <string>
+#include <vector>
+
+#include "common/basictypes.h"
+#include "common/url.h"
+#include "sitemapservice/visitingrecord.h"
+
+class RecordFileBlockReader;
+
+struct RecordIndexHeader {
+  // Version of the file, which is RecordFileIndex::kVersion.
+  uint64 version;
+
+  // Size of the indexed record file.
+  uint64 file_size;
+
+  uint64 entry_count;
+
+  // Checksum of all the entries.
+  uint32 entries_crc;
+
+  uint32 reserved;
+};
+
+struct RecordIndexEntry {
+  // Finger print of the first record in a block.
+  UrlFprint fingerprint;
+
+  // Offset of the block in the record file.
+  int64 offset;
+
+  // Ordinal of the first record in the block, starting from 0.
+  int64 ordinal;
+};
+
+class RecordFileIndex {
+ public:
+  static const uint64 kVersion = 200910061200ULL;
+
+  // Suffix of the index file name.
+  static const char* kIndexSuffix;
+
+  RecordFileIndex() {}
+  ~RecordFileIndex() {}
+
+  // Get path of the index file for a record file.
+  static std::string GetIndexPath(const std::string& recordfile);
+
+  // Writes entries of a record file with given size to an index file.
+  // Returns false if it fails.
+  static bool Write(const std::string& path, int64 file_size,
+                    const std::vector<RecordIndexEntry>& entries);
+
+  // Loads the index of given record file.
+  // Returns false if there is no index, or the index is corrupted, or it
+  // doesn't match the record file.
+  bool Load(const std::string& recordfile);
+
+  // Returns offset of the only block which may contain given finger print,
+  // or -1 if the finger print is less than all records.
+  int64 Find(const UrlFprint& fprint) const;
+
+  // Like above, and sets "first_ordinal" to ordinal of the first record in
+  // the block.
+  int64 Find(const UrlFprint& fprint, int64* first_ordinal) const;
+
+  // Returns offset of the block which contains the record with given
+  // ordinal, and sets "first_ordinal" to ordinal of the first record in the
+  // block. Returns -1 if the index is empty.
+  int64 FindOrdinal(int64 ordinal, int64* first_ordinal) const;
+
+  const std::vector<RecordIndexEntry>& entries() const {
+    return entries_;
+  }
+
+  // Looks up a record with given finger print in a record file sorted by
+  // finger print.
+  // The index is used if it is valid. Otherwise the file is scanned.
+  // Returns false if no record is found.
+  static bool Lookup(const std::string& recordfile, const UrlFprint& fprint,
+                     VisitingRecord* record);
+
+ private:
+  std::vector<RecordIndexEntry> entries_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(RecordFileIndex);
+};
+
+// Reads records of an indexed record file by ordinal.
+// The file is mapped once. Records in the same or the next blocks are reached
+// by reading forward, and other blocks are reached by seeking in the mapping
+// through the index. So ascending ordinals are the cheapest.
+class RecordOrdinalReader {
+ public:
+  RecordOrdinalReader();
+  ~RecordOrdinalReader();
+
+  // Opens a record file with a valid index.
+  // Returns false if the file can't be opened or it has no valid index.
+  bool Open(const std::string& recordfile);
+
+  void Close();
+
+  // Returns the record with given ordinal.
+  // The record is valid until next call.
+  // Returns NULL if there is no such record.
+  const VisitingRecord* Get(int64 ordinal);
+
+  // Returns the record with given finger print, or NULL if there is none.
+  // The record is valid until next call. Ascending finger prints are the
+  // cheapest, like ordinals.
+  const VisitingRecord* Find(const UrlFprint& fprint);
+
+ private:
+  RecordFileIndex index_;
+
+  // Reader of the whole file, which is moved among blocks by Seek.
+  RecordFileBlockReader* reader_;
+
+  // Ordinal of the record which will be returned by reader_->Next().
+  int64 next_ordinal_;
+
+  // Record last returned by reader_->Next(), or NULL after a seek.
+  const VisitingRecord* last_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(RecordOrdinalReader);
+};
+
+#endif // SITEMAPSERVICE_RECORDFILEINDEX_H__
@@ -16,9 +16,20 @@
 
 #include "common/logger.h"
 #include "sitemapservice/recordfilebinaryio.h"
+#include "sitemapservice/recordfileblockio.h"
+#include "sitemapservice/recordfileindex.h"
+#include "sitemapservice/recordfileimageio.h"
+#include "sitemapservice/recordcolumnio.h"
+#include "sitemapservice/recordurlindex.h"
+#include "common/sequentialwriter.h"
 
 
 RecordFileReader* RecordFileIOFactory::CreateReader(const std::string& path) {
+  return CreateReader(path, -1);
+}
+
+RecordFileReader* RecordFileIOFactory::CreateReader(const std::string& path,
+                                                    int64 offset) {
   FILE* file = fopen(path.c_str(), "rb");
   if (file == NULL) {
     Logger::Log(EVENT_ERROR, "Failed to open [%s] to read.", path.c_str());
@@ -36,20 +47,95 @@ RecordFileReader* RecordFileIOFactory::CreateReader(const std::string& path) {
   RecordFileReader* reader = NULL;
   if (version == kVersionA) {
     reader = new RecordFileBinaryReader();
+  } else if (version == kVersionB) {
+    reader = new RecordFileBlockReader();
+  } else if (version == RecordImage::kVersion) {
+    reader = new RecordFileImageReader();
   } else {
     Logger::Log(EVENT_ERROR, "Unrecognized record file version [%llu] from [%s]",
               version, path.c_str());
+    fclose(file);
+    return NULL;
   }
 
-  if (reader != NULL) {
-    reader->Initialize(file);
-  } else {
+  // Readers of sequential formats start from current position.
+  if (offset >= 0) {
+    if (version == RecordImage::kVersion
+        || fseek(file, static_cast<long>(offset), SEEK_SET) != 0) {
+      Logger::Log(EVENT_ERROR, "Failed to seek [%s] to [%lld].",
+                path.c_str(), offset);
+      fclose(file);
+      delete reader;
+      return NULL;
+    }
+  }
+
+  // All readers map the file, and close the stream.
+  if (!reader->Initialize(file)) {
+    Logger::Log(EVENT_ERROR, "Failed to open record file [%s].", path.c_str());
+    delete reader;
+    return NULL;
+  }
+
+  return reader;
+}
+
+RecordFileBlockReader* RecordFileIOFactory::CreateBlockReader(
+  const std::string& path) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    Logger::Log(EVENT_ERROR, "Failed to open [%s] to read.", path.c_str());
+    return NULL;
+  }
+
+  uint64 version;
+  if (fread(&version, sizeof(uint64), 1, file) != 1 || version != kVersionB) {
+    Logger::Log(EVENT_ERROR, "[%s] is not in block format.", path.c_str());
     fclose(file);
+    return NULL;
+  }
+
+  RecordFileBlockReader* reader = new RecordFileBlockReader();
+  if (!reader->Initialize(file)) {
+    Logger::Log(EVENT_ERROR, "Failed to open record file [%s].", path.c_str());
+    delete reader;
+    return NULL;
   }
 
   return reader;
 }
 
+RecordFileReader* RecordFileIOFactory::CreateRangeReader(
+  const std::string& path, const UrlFprint& begin) {
+  RecordFileIndex index;
+  if (index.Load(path)) {
+    int64 offset = index.Find(begin);
+    if (offset >= 0) {
+      return CreateReader(path, offset);
+    }
+    return CreateReader(path);
+  }
+
+  // Images are sorted entries, which can be binary searched.
+  FILE* file = fopen(path.c_str(), "rb");
+  uint64 version = 0;
+  if (file != NULL && fread(&version, sizeof(uint64), 1, file) == 1
+      && version == RecordImage::kVersion) {
+    RecordFileImageReader* reader = new RecordFileImageReader();
+    if (!reader->Initialize(file)) {
+      Logger::Log(EVENT_ERROR, "Failed to open record file [%s].",
+                path.c_str());
+      delete reader;
+      return NULL;
+    }
+    reader->Seek(begin);
+    return reader;
+  }
+
+  if (file != NULL) fclose(file);
+  return CreateReader(path);
+}
+
 RecordFileWriter* RecordFileIOFactory::CreateWriter(const std::string& path) {
   FILE* file = fopen(path.c_str(), "wb");
   if (file == NULL) {
@@ -57,7 +143,7 @@ RecordFileWriter* RecordFileIOFactory::CreateWriter(const std::string& path) {
     return NULL;
   }
 
-  uint64 version = kVersionA;
+  uint64 version = kVersionB;
   if (fwrite(&version, sizeof(uint64), 1, file) != 1) {
     Logger::Log(EVENT_ERROR, "Failed to write version info to [%s].",
               path.c_str());
@@ -65,8 +151,146 @@ RecordFileWriter* RecordFileIOFactory::CreateWriter(const std::string& path) {
     return NULL;
   }
 
-  RecordFileWriter* writer = new RecordFileBinaryWriter();
+  RecordFileWriter* writer = new RecordFileBlockWriter();
   writer->Initialize(file);
   return writer;
 }
 
+RecordFileWriter* RecordFileIOFactory::CreateIndexedWriter(
+  const std::string& path) {
+  RecordFileBlockWriter* writer =
+    static_cast<RecordFileBlockWriter*>(CreateWriter(path));
+  if (writer != NULL) {
+    writer->EnableIndex(RecordFileIndex::GetIndexPath(path));
+
+    // Columns are only an optimization, so it goes on without them.
+    if (!writer->EnableColumns(path)) {
+      Logger::Log(EVENT_ERROR, "Failed to create columns for [%s].",
+                path.c_str());
+    }
+    if (!writer->EnableUrlIndex(path)) {
+      Logger::Log(EVENT_ERROR, "Failed to create url index for [%s].",
+                path.c_str());
+    }
+  }
+  return writer;
+}
+
+
+RecordFileWriter* RecordFileIOFactory::CreateAppender(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "a+b");
+  if (file == NULL) {
+    Logger::Log(EVENT_ERROR, "Failed to open [%s] to append.", path.c_str());
+    return NULL;
+  }
+
+  // Check version of the existing file, or write version to the new file.
+  uint64 version = 0;
+  fseek(file, 0, SEEK_SET);
+  if (fread(&version, sizeof(uint64), 1, file) != 1) {
+    version = kVersionB;
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) != 0
+        || fwrite(&version, sizeof(uint64), 1, file) != 1) {
+      Logger::Log(EVENT_ERROR, "Failed to write version info to [%s].",
+                path.c_str());
+      fclose(file);
+      return NULL;
+    }
+  } else if (version != kVersionA && version != kVersionB) {
+    Logger::Log(EVENT_ERROR, "Unrecognized record file version [%llu] from [%s]",
+              version, path.c_str());
+    fclose(file);
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+
+  // Old files are still appended in old format.
+  RecordFileWriter* writer = NULL;
+  if (version == kVersionA) {
+    writer = new RecordFileBinaryWriter();
+  } else {
+    writer = new RecordFileBlockWriter();
+  }
+  writer->Initialize(file);
+  return writer;
+}
+
+bool RecordFileIOFactory::Concatenate(const std::vector<std::string>& parts,
+                                      const std::vector<int64>& counts,
+                                      const std::string& path) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    Logger::Log(EVENT_ERROR, "Failed to open [%s] to write.", path.c_str());
+    return false;
+  }
+
+  SequentialWriter writer;
+  writer.Attach(file);
+  uint64 version = kVersionB;
+  bool result = writer.Write(&version, sizeof(uint64));
+
+  // Side files are built from those of the parts. Any side file missing in
+  // a part is not built.
+  std::vector<RecordIndexEntry> entries;
+  bool has_index = true;
+  RecordColumnWriter columns;
+  bool has_columns = columns.Open(path);
+  RecordUrlIndexBuilder urls;
+  bool has_urls = urls.Open(path);
+
+  std::vector<char> buffer(1024 * 1024);
+  int64 ordinal = 0;
+  for (size_t i = 0; result && i < parts.size(); ++i) {
+    // Blocks of a part are appended without its version, so block offsets
+    // in the part are moved by the position minus size of the version.
+    int64 shift = writer.position() - sizeof(uint64);
+    RecordFileIndex index;
+    if (has_index && index.Load(parts[i])) {
+      for (size_t j = 0; j < index.entries().size(); ++j) {
+        RecordIndexEntry entry = index.entries()[j];
+        entry.offset += shift;
+        entry.ordinal += ordinal;
+        entries.push_back(entry);
+      }
+    } else {
+      has_index = false;
+    }
+    ordinal += counts[i];
+
+    has_columns = has_columns && columns.Append(parts[i]);
+    has_urls = has_urls && urls.AddIndex(parts[i]);
+
+    FILE* part = fopen(parts[i].c_str(), "rb");
+    result = part != NULL
+      && fread(&version, sizeof(uint64), 1, part) == 1
+      && version == kVersionB;
+    while (result) {
+      size_t size = fread(&buffer[0], 1, buffer.size(), part);
+      if (size == 0) {
+        result = ferror(part) == 0;
+        break;
+      }
+      result = writer.Write(&buffer[0], size);
+    }
+    if (part != NULL) fclose(part);
+
+    if (!result) {
+      Logger::Log(EVENT_ERROR, "Failed to append [%s] to [%s].",
+                parts[i].c_str(), path.c_str());
+    }
+  }
+
+  int64 file_size = writer.position();
+  if (!writer.Close()) {
+    result = false;
+  }
+
+  if (result && has_index) {
+    RecordFileIndex::Write(RecordFileIndex::GetIndexPath(path), file_size,
+                           entries);
+  }
+  columns.Close(file_size, result && has_columns);
+  urls.Close(file_size, result && has_urls);
+  return result;
+}
@@ -21,6 +21,8 @@
 #ifndef SITEMAPSERVICE_RECORDFILEIO_H__
 #define SITEMAPSERVICE_RECORDFILEIO_H__
 
+#include <vector>
+
 #include "common/url.h"
 #include "sitemapservice/visitingrecord.h"
 
@@ -36,6 +38,13 @@ public:
   // Otherwise, the value indicates an error.
   virtual int Read(VisitingRecord* record) = 0;
 
+  // Read a record without copying it.
+  // Returns NULL at the end of file, or if the file is corrupted.
+  // The returned record, including its url, is owned by the reader, and is
+  // only valid until the next call. Url of the record is not allocated for
+  // every record, so this is preferred by sequential scans.
+  virtual const VisitingRecord* Next() = 0;
+
   virtual void Close() = 0;
 };
 
@@ -50,22 +59,73 @@ public:
   // Otherwise, negative value indicates an error.
   virtual int Write(const VisitingRecord& record) = 0;
 
-  virtual void Close() = 0;
+  // Flush and close the file.
+  // Returns false if the file can't be written completely.
+  virtual bool Close() = 0;
 };
 
+class RecordFileBlockReader;
+
 class RecordFileIOFactory {
 public:
-  // Create a writer.
+  // Create a writer. Records are written in the compact block format.
   // Caller should take care of the returned pointer.
   static RecordFileWriter* CreateWriter(const std::string& path);
 
+  // Create a writer like above, which also writes a sparse index of the file
+  // and its column files and url index when it is closed. The records should
+  // be written in ascending order of finger print. See RecordFileIndex,
+  // RecordColumn and RecordUrlIndex.
+  // Caller should take care of the returned pointer.
+  static RecordFileWriter* CreateIndexedWriter(const std::string& path);
+
+  // Create a writer which appends records to the end of an existing file.
+  // The file is created if it doesn't exist. An existing file is appended in
+  // its own format.
+  // Caller should take care of the returned pointer.
+  static RecordFileWriter* CreateAppender(const std::string& path);
+
   // Create a reader.
   // Caller should take care of the returned pointer.
   static RecordFileReader* CreateReader(const std::string& path);
 
+  // Create a reader which starts from given offset, which should be the
+  // beginning of a record (or a block in the compact format).
+  // Record images can't be read from an offset.
+  // Caller should take care of the returned pointer.
+  static RecordFileReader* CreateReader(const std::string& path, int64 offset);
+
+  // Create a reader of a file in the compact block format, which can be moved
+  // among blocks, see RecordFileBlockReader::Seek.
+  // Returns NULL if the file is in another format.
+  // Caller should take care of the returned pointer.
+  static RecordFileBlockReader* CreateBlockReader(const std::string& path);
+
+  // Create a reader of a file sorted by finger print, which skips records
+  // less than "begin" cheaply when it can. Images are binary searched, and
+  // indexed files start from the block which may contain "begin". Other
+  // files start from the beginning, so caller should still skip the smaller
+  // records itself.
+  // Caller should take care of the returned pointer.
+  static RecordFileReader* CreateRangeReader(const std::string& path,
+                                             const UrlFprint& begin);
+
+  // Concatenate record files written by CreateIndexedWriter into a new file
+  // like it, with index, columns and url index. Finger prints of the parts
+  // should be in ascending and disjoint ranges. "counts" holds number of
+  // records in every part.
+  // Returns false if it fails.
+  static bool Concatenate(const std::vector<std::string>& parts,
+                          const std::vector<int64>& counts,
+                          const std::string& path);
+
 private:
+  // Raw VisitingRecord structs, see RecordFileBinaryReader.
   static const uint64 kVersionA = 200801012108ULL;
 
+  // Compressed blocks of varint encoded records, see RecordFileBlockReader.
+  static const uint64 kVersionB = 200910021200ULL;
+
   RecordFileIOFactory() {}
 };
 
@@ -16,6 +16,7 @@
 #include "sitemapservice/recordfilemanager.h"
 
 #include <errno.h>
+#include <stdio.h>
 #include <algorithm>
 
 #if defined(__linux__) || defined(__linux__)
@@ -26,19 +27,55 @@
 #include "common/logger.h"
 #include "common/util.h"
 #include "common/fileutil.h"
+#include "sitemapservice/recordfilestat.h"
+#include "sitemapservice/recordmerger.h"
 
 const std::string RecordfileManager::kBaseFile = "data_base";
 const std::string RecordfileManager::kTempFilePrefix = "data_temp_";
 const std::string RecordfileManager::kCurrentFile = "data_current";
+const std::string RecordfileManager::kJournalFile = "data_journal";
 const std::string RecordfileManager::kFPFile = "data_fp";
+const std::string RecordfileManager::kFPFilterFile = "data_fp_filter";
+const std::string RecordfileManager::kTombstonePrefix = "data_tomb_";
 const std::string RecordfileManager::kHostFile = "data_host";
+const std::string RecordfileManager::kLevelPrefix = "data_level_";
+const std::string RecordfileManager::kFPSuffix = "_fp";
+const std::string RecordfileManager::kRetiredFile = "data_retired";
+const std::string RecordfileManager::kSwapSuffix = "_merger_to_swap";
 
 
 // initialize the static fields.
 std::string RecordfileManager::recordfile_home_ = "";
 
+RecordfileManager::Snapshot::Snapshot(RecordfileManager* manager) {
+  manager_ = manager;
+  refs_ = 1;
+}
+
+std::vector<std::string> RecordfileManager::Snapshot::GetDatabaseFiles() const {
+  std::vector<std::string> files(level_files_);
+  files.push_back(base_file_);
+  return files;
+}
+
+std::vector<std::string> RecordfileManager::Snapshot::GetAllFiles() const {
+  std::vector<std::string> files = GetDatabaseFiles();
+  files.insert(files.end(), temp_files_.begin(), temp_files_.end());
+  return files;
+}
+
+void RecordfileManager::Snapshot::AddRef() {
+  manager_->lock_.Enter(true);
+  ++refs_;
+  manager_->lock_.Leave();
+}
+
+void RecordfileManager::Snapshot::Release() {
+  manager_->ReleaseSnapshot(this);
+}
+
 RecordfileManager::RecordfileManager() {
-  // empty
+  generation_ = 0;
 }
 
 RecordfileManager::~RecordfileManager() {
@@ -50,6 +87,11 @@ bool RecordfileManager::Initialize(const char *siteid) {
 }
 
 bool RecordfileManager::Initialize(const char *siteid, int64 max_tempsize) {
+  std::string home = GetRecordfileHome();
+  return Initialize(home.c_str(), siteid, max_tempsize);
+}
+
+std::string RecordfileManager::GetRecordfileHome() {
   // TODO: for backward compatibility, the default value for home is AppDir.
   // This should be removed in the future, and app must set it when starting.
   std::string home = RecordfileManager::recordfile_home_;
@@ -57,15 +99,12 @@ bool RecordfileManager::Initialize(const char *siteid, int64 max_tempsize) {
     home.append(Util::GetApplicationDir());
     home.append("/cache/");
   }
-
-  return Initialize(home.c_str(), siteid, max_tempsize);
+  return home;
 }
 
 // file save to dir/siteid/, replace the non [a-zA-Z0-9] char in siteid to '_'
-bool RecordfileManager::Initialize(const char* dir, const char* siteid,
-                                   int64 max_tempsize) {
-  max_tempsize_ = max_tempsize;
-
+std::string RecordfileManager::GetSiteDirectory(const char* dir,
+                                                const char* siteid) {
   std::string dirname(siteid);
   for (int i = 0; i < static_cast<int>(dirname.length()); ++i) {
     if (!isalnum(dirname[i])) {
@@ -73,14 +112,89 @@ bool RecordfileManager::Initialize(const char* dir, const char* siteid,
     }
   }
 
-  directory_.clear();
-  directory_.append(dir).append("/").append(dirname).append("/");
+  std::string directory(dir);
+  directory.append("/").append(dirname).append("/");
+  return directory;
+}
+
+std::string RecordfileManager::GetSiteBaseFile(const char* siteid) {
+  std::string home = GetRecordfileHome();
+  std::string file = GetSiteDirectory(home.c_str(), siteid);
+  file.append(GetGenerationName(FindGeneration(file)));
+  return file;
+}
+
+std::vector<std::string> RecordfileManager::GetSiteLevelFiles(
+  const char* siteid) {
+  std::string home = GetRecordfileHome();
+  std::string directory = GetSiteDirectory(home.c_str(), siteid);
+
+  // Side files of level files have longer names, see Initialize.
+  std::vector<std::string> names, files;
+  if (!FileUtil::Exists(directory.c_str())
+      || !FindFiles(directory, kLevelPrefix, &names)) {
+    return files;
+  }
+  std::sort(names.begin(), names.end());
+  for (int i = 0; i < static_cast<int>(names.size()); ++i) {
+    if (names[i].length() == kLevelPrefix.length() + 23) {
+      files.push_back(directory + names[i]);
+    }
+  }
+  return files;
+}
+
+int RecordfileManager::GetGeneration(const std::string& name) {
+  if (name == kBaseFile) return 0;
+
+  // Like "data_base_00000012".
+  size_t length = kBaseFile.length() + 9;
+  if (name.length() != length || name.compare(0, kBaseFile.length(), kBaseFile) != 0
+      || name[kBaseFile.length()] != '_') {
+    return -1;
+  }
+  for (size_t i = kBaseFile.length() + 1; i < length; ++i) {
+    if (!isdigit(name[i])) return -1;
+  }
+  return atoi(name.c_str() + kBaseFile.length() + 1);
+}
+
+std::string RecordfileManager::GetGenerationName(int generation) {
+  if (generation == 0) return kBaseFile;
+
+  char buffer[32];
+  sprintf(buffer, "_%08d", generation);
+  std::string name(kBaseFile);
+  name.append(buffer);
+  return name;
+}
+
+int RecordfileManager::FindGeneration(const std::string& dir) {
+  std::vector<std::string> names;
+  FindFiles(dir, kBaseFile, &names);
+
+  int newest = 0;
+  for (int i = 0; i < static_cast<int>(names.size()); ++i) {
+    int generation = GetGeneration(names[i]);
+    if (generation > newest) newest = generation;
+  }
+  return newest;
+}
+
+bool RecordfileManager::Initialize(const char* dir, const char* siteid,
+                                   int64 max_tempsize) {
+  max_tempsize_ = max_tempsize;
+
+  directory_ = GetSiteDirectory(dir, siteid);
   if (!FileUtil::CreateDir(directory_.c_str())) {
     Logger::Log(EVENT_ERROR, "Failed initialize record file dir [%s].",
               directory_.c_str());
     return false;
   }
 
+  // Files retired by last run are not database files any more.
+  DeleteLeftovers();
+
   // Load all the old values in time order.
   std::vector<std::string> file_names;
   if (!FindFiles(directory_, kTempFilePrefix, &file_names)) {
@@ -88,6 +202,10 @@ bool RecordfileManager::Initialize(const char* dir, const char* siteid,
     return false;
   }
   for (int i = 0; i < static_cast<int>(file_names.size()); ++i) {
+    // Statistics files of temp files are not temp files.
+    if (IsStatFile(file_names[i])) continue;
+    if (retired_.find(directory_ + file_names[i]) != retired_.end()) continue;
+
     FileAttribute file_attr;
     std::string full_name(directory_);
     full_name.append(file_names[i]);
@@ -104,6 +222,46 @@ bool RecordfileManager::Initialize(const char* dir, const char* siteid,
   }
   std::sort(temp_files_.begin(), temp_files_.end());
 
+  // Side files of level files, like indexes, have longer names, and are
+  // excluded. Level files are named like "{prefix}L_YYYYmmddHHMMSS_NNNNNN".
+  if (!FindFiles(directory_, kLevelPrefix, &file_names)) {
+    Logger::Log(EVENT_ERROR, "Failed to list level files.");
+    return false;
+  }
+  level_files_.clear();
+  for (int i = 0; i < static_cast<int>(file_names.size()); ++i) {
+    if (file_names[i].length() == kLevelPrefix.length() + 23
+        && retired_.find(directory_ + file_names[i]) == retired_.end()) {
+      level_files_.push_back(file_names[i]);
+    }
+  }
+  std::sort(level_files_.begin(), level_files_.end());
+
+  // Older generations of the base file may be left if they were held by
+  // snapshots when the service stopped.
+  generation_ = FindGeneration(directory_);
+  if (!FindFiles(directory_, kBaseFile, &file_names)) {
+    Logger::Log(EVENT_ERROR, "Failed to list base files.");
+    return false;
+  }
+  std::vector<std::string> stale;
+  for (int i = 0; i < static_cast<int>(file_names.size()); ++i) {
+    int generation = GetGeneration(file_names[i]);
+    if (generation >= 0 && generation < generation_) {
+      stale.push_back(directory_ + file_names[i]);
+    }
+  }
+  DeleteFiles(stale);
+
+  // The finger print file of the first generation used to have its own
+  // name, and now it is named after the base file like others.
+  std::string fpfile = GetFPFile();
+  std::string oldfpfile = directory_ + kFPFile;
+  if (generation_ == 0 && FileUtil::Exists(oldfpfile.c_str())
+      && !FileUtil::Exists(fpfile.c_str())) {
+    rename(oldfpfile.c_str(), fpfile.c_str());
+  }
+
   return true;
 }
 
@@ -118,8 +276,18 @@ std::string RecordfileManager::GetHostFile() {
 }
 
 std::string RecordfileManager::GetBaseFile() {
+  lock_.Enter(true);
   std::string file = directory_;
-  file.append(kBaseFile);
+  file.append(GetGenerationName(generation_));
+  lock_.Leave();
+  return file;
+}
+
+std::string RecordfileManager::GetNewBaseFile() {
+  lock_.Enter(true);
+  std::string file = directory_;
+  file.append(GetGenerationName(generation_ + 1));
+  lock_.Leave();
   return file;
 }
 
@@ -129,12 +297,55 @@ std::string RecordfileManager::GetCurrentFile() {
   return file;
 }
 
+std::string RecordfileManager::GetJournalFile() {
+  std::string file = directory_;
+  file.append(kJournalFile);
+  return file;
+}
+
 std::string RecordfileManager::GetFPFile() {
+  return GetRecordFPFile(GetBaseFile());
+}
+
+std::string RecordfileManager::GetFPFilterFile() {
   std::string file = directory_;
-  file.append(kFPFile);
+  file.append(kFPFilterFile);
   return file;
 }
 
+std::string RecordfileManager::GetNewTombstoneFile() {
+  // use timestamp as part of file name, and a sequence number is appended
+  // to keep the name order same as the creation order.
+  time_t current = time(NULL);
+  char buffer[128];
+  strftime(buffer, 128, "%Y%m%d%H%M%S", localtime(&current));
+
+  std::string prefix(directory_);
+  prefix.append(kTombstonePrefix).append(buffer).append("_");
+  for (int cnt = 0; ; ++cnt) {
+    sprintf(buffer, "%06d", cnt);
+    std::string file(prefix);
+    file.append(buffer);
+    if (!FileUtil::Exists(file.c_str())) {
+      return file;
+    }
+  }
+}
+
+std::vector<std::string> RecordfileManager::GetTombstoneFiles() {
+  std::vector<std::string> names;
+  if (!FindFiles(directory_, kTombstonePrefix, &names)) {
+    Logger::Log(EVENT_ERROR, "Failed to list tombstone files.");
+  }
+
+  // Names are ordered by creation time.
+  std::sort(names.begin(), names.end());
+  for (int i = 0, n = static_cast<int>(names.size()); i < n; ++i) {
+    names[i] = directory_ + names[i];
+  }
+  return names;
+}
+
 std::vector<std::string> RecordfileManager::GetTempFiles() {
   lock_.Enter(true);
   std::vector<std::string> result;
@@ -214,6 +425,8 @@ bool RecordfileManager::CompleteCurrentFile() {
   newfile.append(buffer);
 
   // try to get a complete new file name
+  // A retired temp file may still be held by snapshots, and it is deleted
+  // by name when they are released, so its name is never reused.
   std::string nextfile = newfile;
   for (int cnt = 0; ; ++cnt) {
     int i = 0;
@@ -222,7 +435,11 @@ bool RecordfileManager::CompleteCurrentFile() {
         break;
       }
     }
-    if (i == temp_files_.size()) {
+    std::string full_name = directory_ + nextfile;
+    if (i == static_cast<int>(temp_files_.size())
+        && pins_.find(full_name) == pins_.end()
+        && retired_.find(full_name) == retired_.end()
+        && !FileUtil::Exists(full_name.c_str())) {
       break;
     }
 
@@ -237,13 +454,22 @@ bool RecordfileManager::CompleteCurrentFile() {
   nextfile_full.append(nextfile);
 
   // ensure the destination file doesn't exist.
+  std::string currentstat = RecordFileStat::GetStatPath(currentfile);
+  std::string nextstat = RecordFileStat::GetStatPath(nextfile_full);
   remove(nextfile_full.c_str());
+  remove(nextstat.c_str());
   if (rename(currentfile.c_str(), nextfile_full.c_str()) != 0) {
     Logger::Log(EVENT_ERROR, "Failed to complete file [%s]. (%d)",
               nextfile_full.c_str(), errno);
     return false;
   }
 
+  // Statistics goes with the file. It is only an optimization, so failure
+  // is ignored.
+  if (FileUtil::Exists(currentstat.c_str())) {
+    rename(currentstat.c_str(), nextstat.c_str());
+  }
+
   FileAttribute file_attr;
   if (!FileUtil::GetFileAttribute(nextfile_full.c_str(), &file_attr)) {
     Logger::Log(EVENT_ERROR, "Failed to access new temp file [%s].",
@@ -287,22 +513,343 @@ void RecordfileManager::CleanUpTempFile() {
     }
   }
 
-  // Remove old files from disk.
+  // Remove old files from internal list, and from disk when they are not
+  // read by anyone.
+  std::vector<std::string> files;
   for (int j = 0; j <= i; ++j) {
-    std::string full_name(directory_);
-    full_name.append("/").append(temp_files_[j].name);
-    if (!FileUtil::DeleteFile(full_name.c_str())) {
-      Logger::Log(EVENT_ERROR, "Failed to delete temp file [%s] (ignore)",
-                full_name.c_str());
-    }
+    files.push_back(directory_ + temp_files_[j].name);
   }
-
-  // Remove old files from internal list.
+  std::vector<std::string> deleted;
   if (i >= 0) {
     temp_files_.erase(temp_files_.begin(), temp_files_.begin() + i + 1);
+    RetireLocked(files, &deleted);
     Logger::Log(EVENT_IMPORTANT, "[%d] temp files are cleaned from [%s].",
       i + 1, directory_.c_str());
   }
+  autoleave_lock.LeaveAhead();
+
+  DeleteRetired(deleted);
+}
+
+bool RecordfileManager::IsStatFile(const std::string& name) {
+  std::string suffix(RecordFileStat::kStatSuffix);
+  return name.length() > suffix.length()
+    && name.compare(name.length() - suffix.length(), suffix.length(),
+                    suffix) == 0;
+}
+
+std::string RecordfileManager::GetNewLevelFile(int level) {
+  // Like tombstone files, names are ordered by creation time.
+  time_t current = time(NULL);
+  char timestamp[128];
+  strftime(timestamp, 128, "%Y%m%d%H%M%S", localtime(&current));
+
+  char buffer[128];
+  sprintf(buffer, "%d_", level);
+  std::string prefix(directory_);
+  prefix.append(kLevelPrefix).append(buffer).append(timestamp).append("_");
+  for (int cnt = 0; ; ++cnt) {
+    sprintf(buffer, "%06d", cnt);
+    std::string file(prefix);
+    file.append(buffer);
+
+    // Names of retired files held by snapshots are not reused either.
+    lock_.Enter(true);
+    bool used = pins_.find(file) != pins_.end()
+      || retired_.find(file) != retired_.end();
+    lock_.Leave();
+    if (!used && !FileUtil::Exists(file.c_str())) {
+      return file;
+    }
+  }
+}
+
+std::vector<std::string> RecordfileManager::GetLevelFiles(int level) {
+  char buffer[32];
+  sprintf(buffer, "%d_", level);
+  std::string prefix(kLevelPrefix);
+  prefix.append(buffer);
+
+  std::vector<std::string> files;
+  lock_.Enter(true);
+  for (int i = 0, n = static_cast<int>(level_files_.size()); i < n; ++i) {
+    if (level_files_[i].compare(0, prefix.length(), prefix) == 0) {
+      files.push_back(directory_ + level_files_[i]);
+    }
+  }
+  lock_.Leave();
+  return files;
+}
+
+std::vector<std::string> RecordfileManager::GetLevelFiles() {
+  std::vector<std::string> files;
+  for (int level = 1; level <= kLevelCount; ++level) {
+    std::vector<std::string> level_files = GetLevelFiles(level);
+    files.insert(files.end(), level_files.begin(), level_files.end());
+  }
+  return files;
+}
+
+int64 RecordfileManager::GetLevelFilesSize() {
+  std::vector<std::string> files = GetLevelFiles();
+  int64 size = 0;
+  for (int i = 0; i < static_cast<int>(files.size()); ++i) {
+    FileAttribute file_attr;
+    if (FileUtil::GetFileAttribute(files[i].c_str(), &file_attr)) {
+      size += file_attr.size;
+    }
+  }
+  return size;
+}
+
+std::string RecordfileManager::GetRecordFPFile(const std::string& recordfile) {
+  std::string file(recordfile);
+  file.append(kFPSuffix);
+  return file;
+}
+
+std::vector<std::string> RecordfileManager::GetDatabaseFiles() {
+  // Files are got together, so they are consistent with each other.
+  Snapshot* snapshot = AcquireSnapshot();
+  std::vector<std::string> files = snapshot->GetDatabaseFiles();
+  snapshot->Release();
+  return files;
+}
+
+RecordfileManager::Snapshot* RecordfileManager::AcquireSnapshot() {
+  Snapshot* snapshot = new Snapshot(this);
+
+  lock_.Enter(true);
+  snapshot->base_file_ = directory_ + GetGenerationName(generation_);
+  for (int i = 0; i < static_cast<int>(level_files_.size()); ++i) {
+    snapshot->level_files_.push_back(directory_ + level_files_[i]);
+  }
+  for (int i = 0; i < static_cast<int>(temp_files_.size()); ++i) {
+    snapshot->temp_files_.push_back(directory_ + temp_files_[i].name);
+  }
+
+  std::vector<std::string> files = snapshot->GetAllFiles();
+  for (int i = 0; i < static_cast<int>(files.size()); ++i) {
+    ++pins_[files[i]];
+  }
+  lock_.Leave();
+
+  return snapshot;
+}
+
+void RecordfileManager::ReleaseSnapshot(Snapshot* snapshot) {
+  std::vector<std::string> deleted;
+
+  lock_.Enter(true);
+  if (--snapshot->refs_ > 0) {
+    lock_.Leave();
+    return;
+  }
+
+  // Retired files are deleted with the last snapshot holding them.
+  std::vector<std::string> files = snapshot->GetAllFiles();
+  for (int i = 0; i < static_cast<int>(files.size()); ++i) {
+    std::map<std::string, int>::iterator itr = pins_.find(files[i]);
+    if (itr == pins_.end() || --itr->second > 0) continue;
+
+    pins_.erase(itr);
+    if (retired_.find(files[i]) != retired_.end()) {
+      deleted.push_back(files[i]);
+    }
+  }
+  lock_.Leave();
+
+  delete snapshot;
+  DeleteRetired(deleted);
+}
+
+std::string RecordfileManager::GetSwapFile(const std::string& recordfile) {
+  std::string file(recordfile);
+  file.append(kSwapSuffix);
+  return file;
+}
+
+bool RecordfileManager::PrepareMerge(const std::vector<std::string>& sources,
+                                     const std::string& destination) {
+  lock_.Enter(true);
+  merge_sources_ = sources;
+  merge_destination_ = destination;
+  bool result = SaveRetiredLocked();
+  lock_.Leave();
+  return result;
+}
+
+void RecordfileManager::CommitMerge(const std::vector<std::string>& sources,
+                                    const std::string& destination) {
+  std::string name = destination.substr(directory_.length());
+  std::vector<std::string> deleted;
+
+  lock_.Enter(true);
+  for (int i = 0; i < static_cast<int>(sources.size()); ++i) {
+    RemoveFileLocked(sources[i]);
+  }
+
+  int generation = GetGeneration(name);
+  if (generation > generation_) {
+    generation_ = generation;
+  } else if (generation < 0) {
+    level_files_.push_back(name);
+    std::sort(level_files_.begin(), level_files_.end());
+  }
+
+  merge_sources_.clear();
+  merge_destination_.clear();
+  RetireLocked(sources, &deleted);
+  lock_.Leave();
+
+  DeleteRetired(deleted);
+}
+
+void RecordfileManager::RemoveFileLocked(const std::string& file) {
+  std::string name = file.substr(directory_.length());
+  for (int i = 0; i < static_cast<int>(temp_files_.size()); ++i) {
+    if (temp_files_[i].name == name) {
+      temp_files_.erase(temp_files_.begin() + i);
+      return;
+    }
+  }
+
+  std::vector<std::string>::iterator itr =
+    std::find(level_files_.begin(), level_files_.end(), name);
+  if (itr != level_files_.end()) {
+    level_files_.erase(itr);
+  }
+}
+
+void RecordfileManager::RetireLocked(const std::vector<std::string>& files,
+                                     std::vector<std::string>* deleted) {
+  for (int i = 0; i < static_cast<int>(files.size()); ++i) {
+    retired_.insert(files[i]);
+    if (pins_.find(files[i]) == pins_.end()) {
+      deleted->push_back(files[i]);
+    }
+  }
+  SaveRetiredLocked();
+}
+
+void RecordfileManager::DeleteFiles(const std::vector<std::string>& files) {
+  // A file could not be deleted if it is still opened on some platforms,
+  // like a base file read by a page handler. Old generations of the base
+  // file are deleted again next time the manager is initialized.
+  for (int i = 0; i < static_cast<int>(files.size()); ++i) {
+    RecordMerger::RemoveDatabaseFile(files[i]);
+  }
+}
+
+void RecordfileManager::DeleteRetired(const std::vector<std::string>& files) {
+  if (files.empty()) {
+    return;
+  }
+  DeleteFiles(files);
+
+  // Files which can't be deleted are still listed, and deleted again next
+  // time the manager is initialized.
+  lock_.Enter(true);
+  for (int i = 0; i < static_cast<int>(files.size()); ++i) {
+    if (!FileUtil::Exists(files[i].c_str())) {
+      retired_.erase(files[i]);
+    }
+  }
+  SaveRetiredLocked();
+  lock_.Leave();
+}
+
+void RecordfileManager::DeleteLeftovers() {
+  // Every line is a retired file, which may be followed by the destination
+  // of a merge. Such a file is only retired if the destination exists.
+  std::vector<std::string> files;
+  std::string path = directory_ + kRetiredFile;
+  FILE* file = fopen(path.c_str(), "r");
+  if (file != NULL) {
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != NULL) {
+      std::string name(line);
+      if (name.length() > 0 && name[name.length() - 1] == '\n') {
+        name.erase(name.length() - 1);
+      }
+      size_t space = name.find(' ');
+      if (space != std::string::npos) {
+        std::string destination = directory_ + name.substr(space + 1);
+        name.erase(space);
+        if (!FileUtil::Exists(destination.c_str())) continue;
+      }
+      if (name.length() > 0) {
+        files.push_back(directory_ + name);
+      }
+    }
+    fclose(file);
+  }
+
+  // Incomplete files of interrupted merges are never read.
+  std::vector<std::string> names;
+  if (FindFiles(directory_, "", &names)) {
+    for (int i = 0; i < static_cast<int>(names.size()); ++i) {
+      if (names[i].find(kSwapSuffix) != std::string::npos) {
+        remove((directory_ + names[i]).c_str());
+      }
+    }
+  }
+
+  lock_.Enter(true);
+  retired_.clear();
+  retired_.insert(files.begin(), files.end());
+  lock_.Leave();
+  DeleteRetired(files);
+  if (files.empty()) {
+    remove(path.c_str());
+  }
+}
+
+bool RecordfileManager::SaveRetiredLocked() {
+  std::string path = directory_ + kRetiredFile;
+  if (retired_.empty() && merge_sources_.empty()) {
+    return remove(path.c_str()) == 0 || !FileUtil::Exists(path.c_str());
+  }
+
+  // The list is written to another file, and moved into place when it is
+  // complete.
+  std::string swap = GetSwapFile(path);
+  FILE* file = fopen(swap.c_str(), "w");
+  if (file == NULL) {
+    Logger::Log(EVENT_ERROR, "Failed to open [%s] to save retired files.",
+              swap.c_str());
+    return false;
+  }
+
+  bool result = true;
+  size_t prefix = directory_.length();
+  std::set<std::string>::const_iterator itr = retired_.begin();
+  for (; itr != retired_.end(); ++itr) {
+    if (fprintf(file, "%s\n", itr->substr(prefix).c_str()) < 0) {
+      result = false;
+    }
+  }
+  for (int i = 0; i < static_cast<int>(merge_sources_.size()); ++i) {
+    if (fprintf(file, "%s %s\n", merge_sources_[i].substr(prefix).c_str(),
+                merge_destination_.substr(prefix).c_str()) < 0) {
+      result = false;
+    }
+  }
+  if (fclose(file) != 0) {
+    result = false;
+  }
+
+#ifdef WIN32
+  // An existing file is not replaced by rename on Windows.
+  remove(path.c_str());
+#endif
+  if (!result || rename(swap.c_str(), path.c_str()) != 0) {
+    Logger::Log(EVENT_ERROR, "Failed to save retired files to [%s].",
+              path.c_str());
+    remove(swap.c_str());
+    return false;
+  }
+  return true;
 }
 
 #ifdef WIN32
@@ -16,10 +16,28 @@
 // A class used to manage record files.
 // A record file is used to store url visiting records.
 // There are many kinds of record files: current file, base file and 
+// temp files.
+// Records are organized in levels, like a log-structured merge tree. Temp
+// files are level 0. They are merged into a level 1 file, and level files
+// are merged into a file of the next level when there are enough of them.
+// Level files are finally merged into the base file, which is the last level.
+// So most merges only rewrite the new data, instead of the whole base file.
+// The database is the base file together with all the level files, which
+// should be read through RecordMergeReader. See GetDatabaseFiles.
+// Database files are never changed once they are written. A merge writes a
+// new level file, or a new generation of the base file, and the merged
+// files are retired. Readers take a Snapshot of the files, and retired
+// files are only deleted when no snapshot holds them, so reading doesn't
+// block merging, or the other way around.
+// Retired files which are not deleted yet are listed in a file, so they are
+// deleted next time the manager is initialized, instead of being read again
+// as database files.
 
 #ifndef SITEMAPSERVICE_RECORDFILEMANAGER_H__
 #define SITEMAPSERVICE_RECORDFILEMANAGER_H__
 
+#include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -29,11 +47,68 @@
 class RecordfileManager {
   
  public:
+  // Number of levels between temp files and the base file.
+  static const int kLevelCount = 2;
+
+  // A consistent set of database files and temp files. The files are not
+  // deleted while the snapshot is alive, even if they are merged into new
+  // files, so they could be read without any lock.
+  // A snapshot is reference counted. It is created by AcquireSnapshot with
+  // one reference, and deleted when the last reference is released.
+  class Snapshot {
+   public:
+    const std::string& base_file() const { return base_file_; }
+
+    // Level files, from the first level to the last one.
+    const std::vector<std::string>& level_files() const {
+      return level_files_;
+    }
+
+    const std::vector<std::string>& temp_files() const {
+      return temp_files_;
+    }
+
+    // Get the level files and the base file, like GetDatabaseFiles.
+    std::vector<std::string> GetDatabaseFiles() const;
+
+    void AddRef();
+    void Release();
+
+   private:
+    friend class RecordfileManager;
+
+    explicit Snapshot(RecordfileManager* manager);
+    ~Snapshot() {}
+
+    // Get all the files held by this snapshot.
+    std::vector<std::string> GetAllFiles() const;
+
+    RecordfileManager* manager_;
+
+    // Guarded by lock_ of manager_.
+    int refs_;
+
+    std::string base_file_;
+    std::vector<std::string> level_files_;
+    std::vector<std::string> temp_files_;
+
+    DISALLOW_EVIL_CONSTRUCTORS(Snapshot);
+  };
+
   // set the dir to hold all record data files
   static void SetRecordfileHome(const char* dir) {
     recordfile_home_ = std::string(dir);
   }
 
+  // Get base file of a site in the default home, without initializing a
+  // manager. It is used to read site data outside the site services, so it
+  // is not held by a snapshot, and it should be opened quickly.
+  static std::string GetSiteBaseFile(const char* siteid);
+
+  // Get level files of a site in the default home, like GetSiteBaseFile.
+  // They are ordered from the first level to the last one.
+  static std::vector<std::string> GetSiteLevelFiles(const char* siteid);
+
   RecordfileManager();
   ~RecordfileManager();
 
@@ -52,14 +127,34 @@ class RecordfileManager {
   // following methods can only be called after initialization.
   std::string GetDirectory();
 
+  // Get the newest generation of the base file.
   std::string GetBaseFile();
 
+  // Get name of the next generation of the base file, which is written by
+  // a merge, and replaces the current one by CommitMerge.
+  std::string GetNewBaseFile();
+
   std::string GetCurrentFile();
 
+  // Journal file holds records changed after current file is saved.
+  std::string GetJournalFile();
+
   std::string GetHostFile();
 
+  // Get the finger print file of the base file.
   std::string GetFPFile();
 
+  // Filter file holds a FprintFilter of all known urls.
+  std::string GetFPFilterFile();
+
+  // Tombstone files are sorted runs of obsoleted url finger prints.
+  // See TombstoneLog.
+  // Get a new tombstone file name, which is newer than all existing ones.
+  std::string GetNewTombstoneFile();
+
+  // Get all existing tombstone files, from the oldest to the newest.
+  std::vector<std::string> GetTombstoneFiles();
+
   std::vector<std::string> GetTempFiles();
 
   // Get all temporary files in the ranges of [begin, end].
@@ -75,6 +170,47 @@ class RecordfileManager {
 
   void CleanUpTempFile();
 
+  // Get a new file name of given level, which is newer than all existing
+  // files of the level.
+  std::string GetNewLevelFile(int level);
+
+  // Get all files of given level, from the oldest to the newest.
+  std::vector<std::string> GetLevelFiles(int level);
+
+  // Get all level files, from the first level to the last one.
+  std::vector<std::string> GetLevelFiles();
+
+  int64 GetLevelFilesSize();
+
+  // Get the finger print file of a level file or a base file.
+  static std::string GetRecordFPFile(const std::string& recordfile);
+
+  // Get all files of the database, which are the level files and the base
+  // file, from the first level to the base.
+  std::vector<std::string> GetDatabaseFiles();
+
+  // Take a snapshot of current files. Caller should release it.
+  Snapshot* AcquireSnapshot();
+
+  // Get the name of the file which a merge into "recordfile" is written to,
+  // before it is complete. Such files left by an interrupted merge are
+  // deleted by Initialize.
+  static std::string GetSwapFile(const std::string& recordfile);
+
+  // Record that "sources" are retired once "destination" exists. It should
+  // be called before "destination" is moved into place, so the sources are
+  // never read with it if the service stops before CommitMerge.
+  // Returns false if it can't be recorded.
+  bool PrepareMerge(const std::vector<std::string>& sources,
+                    const std::string& destination);
+
+  // Replace "sources" by "destination", which is merged from them, as one
+  // change seen by snapshots. "destination" is a new level file, or a new
+  // generation of the base file. Sources are temp files, level files, or
+  // the old base file, which are retired.
+  void CommitMerge(const std::vector<std::string>& sources,
+                   const std::string& destination);
+
   int64 GetMaxTempFilesSize() {
     return max_tempsize_;
   }
@@ -98,16 +234,67 @@ class RecordfileManager {
   static const std::string kHostFile;
   static const std::string kTempFilePrefix;
   static const std::string kCurrentFile;
+  static const std::string kJournalFile;
   static const std::string kFPFile;
+  static const std::string kFPFilterFile;
+  static const std::string kTombstonePrefix;
+  static const std::string kLevelPrefix;
+  static const std::string kFPSuffix;
+  static const std::string kRetiredFile;
+  static const std::string kSwapSuffix;
 
   // the dir to store all the record data files by default
   // Record data for {host} will be stored in {record_file_home}/{host}.
   // When it is not set, Util::GetApplicationDir() will be used as default.
   static std::string recordfile_home_;
 
+  // Get the default dir to hold record data files.
+  static std::string GetRecordfileHome();
+
+  // Get the dir under "dir" to hold record data files of a site.
+  static std::string GetSiteDirectory(const char* dir, const char* siteid);
+
+  // Whether a file name is the name of a statistics file.
+  static bool IsStatFile(const std::string& name);
+
+  // Get the generation of a base file name, which is 0 for kBaseFile, and N
+  // for "{kBaseFile}_NNNNNNNN". Returns -1 if it is not a base file.
+  static int GetGeneration(const std::string& name);
+
+  // Get the name of given generation of the base file.
+  static std::string GetGenerationName(int generation);
+
+  // Get the newest generation of base file in "dir".
+  static int FindGeneration(const std::string& dir);
+
   // find all files in dir whose name starts with prefix
-  bool FindFiles(const std::string& dir, const std::string& prefix,
-                std::vector<std::string>* files);
+  static bool FindFiles(const std::string& dir, const std::string& prefix,
+                        std::vector<std::string>* files);
+
+  // Remove "file" from temp files and level files. lock_ should be held.
+  void RemoveFileLocked(const std::string& file);
+
+  // Retire files which are not in database any more. Files not held by any
+  // snapshot are added to "deleted", and others are deleted when they are
+  // released. lock_ should be held.
+  void RetireLocked(const std::vector<std::string>& files,
+                    std::vector<std::string>* deleted);
+
+  // Delete database files with their side files.
+  static void DeleteFiles(const std::vector<std::string>& files);
+
+  // Delete retired "files", and forget those deleted.
+  void DeleteRetired(const std::vector<std::string>& files);
+
+  // Delete files retired by last run, and files of interrupted merges.
+  void DeleteLeftovers();
+
+  // Save names of retired files, and the sources of the prepared merge.
+  // lock_ should be held.
+  bool SaveRetiredLocked();
+
+  // Release a reference of "snapshot", see Snapshot::Release.
+  void ReleaseSnapshot(Snapshot* snapshot);
 
   int64 max_tempsize_;
 
@@ -116,6 +303,25 @@ class RecordfileManager {
 
   std::vector<TempFile> temp_files_;
 
+  // Names of all level files, which are ordered by level and creation time.
+  std::vector<std::string> level_files_;
+
+  // Generation of current base file.
+  int generation_;
+
+  // Number of snapshots holding every file.
+  std::map<std::string, int> pins_;
+
+  // Retired files which are not deleted yet, which are mostly held by
+  // snapshots. They are saved in kRetiredFile.
+  std::set<std::string> retired_;
+
+  // Sources and destination of the merge recorded by PrepareMerge, until it
+  // is committed.
+  std::vector<std::string> merge_sources_;
+  std::string merge_destination_;
+
+  // Guards all the data above, and references of snapshots.
   CriticalSection lock_;
 
   DISALLOW_EVIL_CONSTRUCTORS(RecordfileManager);
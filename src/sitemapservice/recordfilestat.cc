@@ -17,6 +17,11 @@
 #include <math.h>
 #include "sitemapservice/recordfilestat.h"
 
+#include "common/logger.h"
+#include "common/fileutil.h"
+
+const char* RecordFileStat::kStatSuffix = "_stat";
+
 RecordFileStat::RecordFileStat() {
   Reset();
 }
@@ -74,25 +79,136 @@ void RecordFileStat::AddRecord(const VisitingRecord &record) {
     max_access_log_ = log(static_cast<double>(max_access_));
   }
 
-  int offset = static_cast<int>(newest_ - record.last_access);
+  AddCount(newest_ - record.last_access, 1);
+}
+
+void RecordFileStat::AddCount(int64 offset, int count) {
   if (offset < 0) { // fixed it. it should add to hours_[0]
-    ++hours_[0];
+    hours_[0] += count;
     return;
   }
 
-  int hour_index = offset / 3600;
+  int64 hour_index = offset / 3600;
   if (hour_index < kHours) {
-    ++hours_[hour_index];
+    hours_[hour_index] += count;
     return;
   }
 
   offset -= kHours * 3600;
-  int day_index = offset / (3600 * 24);
+  int64 day_index = offset / (3600 * 24);
   if (day_index < kDays) {
-    ++days_[day_index];
+    days_[day_index] += count;
   } else {
-    ++very_old_;
+    very_old_ += count;
+  }
+}
+
+void RecordFileStat::Merge(const RecordFileStat& another) {
+  // Every range of another histogram is moved by the difference of newest_,
+  // and counted at its newest end.
+  int64 delta = newest_ - another.newest_;
+  for (int i = 0; i < kHours; ++i) {
+    if (another.hours_[i] == 0) continue;
+    AddCount(i * 3600LL + delta, another.hours_[i]);
+  }
+  for (int i = 0; i < kDays; ++i) {
+    if (another.days_[i] == 0) continue;
+    AddCount(kHours * 3600LL + i * 3600 * 24LL + delta, another.days_[i]);
+  }
+  AddCount(kHours * 3600LL + kDays * 3600 * 24LL + delta, another.very_old_);
+
+  total_count_ += another.total_count_;
+  total_access_ += another.total_access_;
+
+  if (max_access_ < another.max_access_) {
+    max_access_ = another.max_access_;
+    max_access_log_ = another.max_access_log_;
+  }
+}
+
+std::string RecordFileStat::GetStatPath(const std::string& recordfile) {
+  std::string path(recordfile);
+  path.append(kStatSuffix);
+  return path;
+}
+
+bool RecordFileStat::Save(const std::string& recordfile) const {
+  FileAttribute attr;
+  if (!FileUtil::GetFileAttribute(recordfile.c_str(), &attr)) {
+    return false;
+  }
+
+  std::string path = GetStatPath(recordfile);
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    Logger::Log(EVENT_ERROR, "Failed to open [%s] to write.", path.c_str());
+    return false;
+  }
+
+  // The statistics is only used with the record file of the same size.
+  uint64 version = kVersion;
+  int64 file_size = attr.size;
+  int64 newest = newest_;
+  bool result = fwrite(&version, sizeof(version), 1, file) == 1
+    && fwrite(&file_size, sizeof(file_size), 1, file) == 1
+    && fwrite(&newest, sizeof(newest), 1, file) == 1
+    && fwrite(&very_old_, sizeof(very_old_), 1, file) == 1
+    && fwrite(&total_count_, sizeof(total_count_), 1, file) == 1
+    && fwrite(&total_access_, sizeof(total_access_), 1, file) == 1
+    && fwrite(&max_access_, sizeof(max_access_), 1, file) == 1
+    && fwrite(hours_, sizeof(hours_), 1, file) == 1
+    && fwrite(days_, sizeof(days_), 1, file) == 1;
+  if (fclose(file) != 0) {
+    result = false;
+  }
+
+  if (!result) {
+    Logger::Log(EVENT_ERROR, "Failed to save statistics [%s].", path.c_str());
+    remove(path.c_str());
   }
+  return result;
+}
+
+bool RecordFileStat::Load(const std::string& recordfile) {
+  FileAttribute attr;
+  std::string path = GetStatPath(recordfile);
+  if (!FileUtil::GetFileAttribute(recordfile.c_str(), &attr)
+      || !FileUtil::Exists(path.c_str())) {
+    return false;
+  }
+
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    return false;
+  }
+
+  uint64 version = 0;
+  int64 file_size = 0;
+  int64 newest = 0;
+  RecordFileStat stat;
+  bool result = fread(&version, sizeof(version), 1, file) == 1
+    && version == kVersion
+    && fread(&file_size, sizeof(file_size), 1, file) == 1
+    && file_size == attr.size
+    && fread(&newest, sizeof(newest), 1, file) == 1
+    && fread(&stat.very_old_, sizeof(stat.very_old_), 1, file) == 1
+    && fread(&stat.total_count_, sizeof(stat.total_count_), 1, file) == 1
+    && fread(&stat.total_access_, sizeof(stat.total_access_), 1, file) == 1
+    && fread(&stat.max_access_, sizeof(stat.max_access_), 1, file) == 1
+    && fread(stat.hours_, sizeof(stat.hours_), 1, file) == 1
+    && fread(stat.days_, sizeof(stat.days_), 1, file) == 1;
+  fclose(file);
+
+  if (!result) {
+    Logger::Log(EVENT_NORMAL, "Ignore invalid statistics [%s].", path.c_str());
+    return false;
+  }
+
+  stat.newest_ = static_cast<time_t>(newest);
+  stat.max_access_log_ = stat.max_access_ > 1
+    ? log(static_cast<double>(stat.max_access_)) : -1.0;
+  *this = stat;
+  return true;
 }
 
 double RecordFileStat::GetPriority(const VisitingRecord& record) {
@@ -21,12 +21,16 @@
 // in last two hour ... and  up to last kHours. After kHours, the granularity
 // becomes more coarse, only last day, last two days .. last kDays values are
 // provided.
+// The statistics of a record file can be saved in a side file, whose name is
+// the record file name with kStatSuffix, so the statistics of several files
+// can be combined without reading them.
 // This class is NOT thread-safe.
 
 #ifndef SITEMAPSERVICE_RECORDFILESTAT_H__
 #define SITEMAPSERVICE_RECORDFILESTAT_H__
 
 #include <time.h>
+#include <string>
 #include "sitemapservice/visitingrecord.h"
 
 
@@ -41,6 +45,11 @@ public:
   // 24 hours before kHours, i.e. [NOW - (kHours + 24), Now - kHours].
   static const int kDays = 1000;
 
+  static const uint64 kVersion = 200910081200ULL;
+
+  // Suffix of the statistics file name.
+  static const char* kStatSuffix;
+
   // Empty constructor.
   RecordFileStat();
 
@@ -51,6 +60,22 @@ public:
   // Add a record to the statisic data.
   void AddRecord(const VisitingRecord& record);
 
+  // Add all the records counted by another statistics data. If it is reset
+  // at a different time, its histograms are moved to the time of this one.
+  void Merge(const RecordFileStat& another);
+
+  // Get path of the statistics file for a record file.
+  static std::string GetStatPath(const std::string& recordfile);
+
+  // Save the statistics of a complete record file to its statistics file.
+  // Returns false if it fails.
+  bool Save(const std::string& recordfile) const;
+
+  // Load the statistics of a record file.
+  // Returns false if there is no statistics file, or it doesn't match the
+  // record file.
+  bool Load(const std::string& recordfile);
+
   // Get cutdown time for the newest "maxsize" visting records.
   // This means at most "maxsize" number of URLs whose last-access time is
   // later than returned cut-down time.
@@ -66,6 +91,10 @@ public:
   double GetPriority(const VisitingRecord& record);
 
 private:
+  // Count "count" URLs whose last-access time is "offset" seconds before
+  // newest_.
+  void AddCount(int64 offset, int count);
+
   // "hours_[i]" represents the number of URLs whose last-access time is in
   // last "i" hour.
   int hours_[kHours];
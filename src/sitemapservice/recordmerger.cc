@@ -18,9 +18,19 @@
 #include "common/url.h"
 #include "common/port.h"
 #include "common/logger.h"
+#include "common/fileutil.h"
+#include "common/thread.h"
+#include "common/sequentialwriter.h"
 #include "sitemapservice/recordfileio.h"
+#include "sitemapservice/recordfileindex.h"
+#include "sitemapservice/recordcolumnio.h"
+#include "sitemapservice/recordurlindex.h"
+#include "sitemapservice/mergeheap.h"
+#include "sitemapservice/recordmergereader.h"
+#include "sitemapservice/fprintsorter.h"
 #include "sitemapservice/urlfprintio.h"
 #include "sitemapservice/recordfilemanager.h"
+#include "sitemapservice/tombstonelog.h"
 
 RecordMerger::RecordMerger() {
   // does nothing.
@@ -31,230 +41,524 @@ RecordMerger::~RecordMerger() {
 }
 
 
+namespace {
+
+// Appends content of file "path" to "writer".
+bool AppendFile(SequentialWriter* writer, const std::string& path) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL) return false;
+
+  bool result = true;
+  std::vector<char> buffer(1024 * 1024);
+  while (result) {
+    size_t size = fread(&buffer[0], 1, buffer.size(), file);
+    if (size == 0) {
+      result = ferror(file) == 0;
+      break;
+    }
+    result = writer->Write(&buffer[0], size);
+  }
+  fclose(file);
+  return result;
+}
+
+}  // namespace
+
+// A thread merging one range of finger prints into a part of the result.
+class RecordMerger::RangeWorker : public Thread {
+ public:
+  RangeWorker() {}
+
+  void Initialize(RecordMerger* merger, const std::string& destination,
+                  const std::string& fp_dest,
+                  const std::vector<std::string>* sources,
+                  const std::vector<std::string>* tombstones,
+                  time_t cutdown, UrlFprint begin, UrlFprint end) {
+    merger_ = merger;
+    destination_ = destination;
+    fp_dest_ = fp_dest;
+    sources_ = sources;
+    tombstones_ = tombstones;
+    cutdown_ = cutdown;
+    begin_ = begin;
+    end_ = end;
+    result_ = 1;
+    throttled_ = SequentialWriter::IsThreadThrottled();
+  }
+
+  virtual void Run() {
+    // Ranges of a throttled merge share the budget of the merge.
+    SequentialWriter::SetThreadThrottled(throttled_);
+    result_ = merger_->MergeRange(destination_, fp_dest_, *sources_,
+                                  *tombstones_, cutdown_, begin_, end_,
+                                  NULL, &stat_);
+  }
+
+  const std::string& destination() const { return destination_; }
+  const std::string& fp_dest() const { return fp_dest_; }
+  int result() const { return result_; }
+  const RecordFileStat& stat() const { return stat_; }
+
+ private:
+  RecordMerger* merger_;
+  std::string destination_;
+  std::string fp_dest_;
+  const std::vector<std::string>* sources_;
+  const std::vector<std::string>* tombstones_;
+  time_t cutdown_;
+  UrlFprint begin_;
+  UrlFprint end_;
+  bool throttled_;
+
+  int result_;
+  RecordFileStat stat_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(RangeWorker);
+};
+
 // sources means the temp record files, each file has many records
 // assert the source files are all sorted by the fingerprint (url)
 // 'cutdown' is in unit 'sec'
 int RecordMerger::Merge(const std::string& destination,
                         const std::string& fp_dest,
                         const std::vector<std::string>& sources,
-                        const std::set<UrlFprint>& obsoleted,
+                        const std::vector<std::string>& tombstones,
                         const time_t& cutdown,
                         RecordFileStat* stat) {
-  int n = static_cast<int>(sources.size());
+  std::vector<UrlFprint> splits;
+  GetSplitPoints(sources, &splits);
+  if (splits.empty()) {
+    int result = MergeRange(destination, fp_dest, sources, tombstones,
+                            cutdown, 0, 0, NULL, stat);
+    if (result == 0) {
+      stat->Save(destination);
+    }
+    return result;
+  }
 
-  std::vector<VisitingRecord> records(n);
-  std::vector<RecordFileReader*> readers(n); // NOTE, reader can't be copy constructed.
+  // Range t is [splits[t - 1], splits[t]), and the last one is unbounded.
+  int range_count = static_cast<int>(splits.size()) + 1;
+  std::vector<RangeWorker*> workers(range_count);
+  for (int t = 0; t < range_count; ++t) {
+    char suffix[32];
+    sprintf(suffix, "_part_%d", t);
+    workers[t] = new RangeWorker();
+    workers[t]->Initialize(this, destination + suffix, fp_dest + suffix,
+                           &sources, &tombstones, cutdown,
+                           t == 0 ? 0 : splits[t - 1],
+                           t == range_count - 1 ? 0 : splits[t]);
+  }
 
-  // open the writer
-  UrlFprintWriter fpwriter;
-  if (!fpwriter.Open(fp_dest.c_str())) {
-    return 1;
+  // The first range is always merged by calling thread.
+  for (int t = 1; t < range_count; ++t) {
+    if (!workers[t]->Start()) {
+      workers[t]->Run();
+    }
   }
-  RecordFileWriter* writer = RecordFileIOFactory::CreateWriter(destination);
-  if (writer == NULL) {
-    return 1;
+  workers[0]->Run();
+  for (int t = 1; t < range_count; ++t) {
+    workers[t]->Join();
   }
 
-  // open all the files
-  for (int i = 0, j = 0; i < n; ++i, ++j) {
-    readers[i] = RecordFileIOFactory::CreateReader(sources[j]);
-    if (readers[i] == NULL || readers[i]->Read(&records[i]) != 0) {
-      if (readers[i] != NULL) delete readers[i];
-      records.erase(records.begin() + i);
-      readers.erase(readers.begin() + i);
-      --i; --n;
+  // The parts are in ascending order, so they are simply concatenated.
+  int result = 0;
+  std::vector<std::string> parts;
+  std::vector<int64> counts;
+  stat->Reset();
+  for (int t = 0; t < range_count; ++t) {
+    if (workers[t]->result() != 0) {
+      result = 1;
     }
+    parts.push_back(workers[t]->destination());
+    counts.push_back(workers[t]->stat().GetTotalCount());
+    stat->Merge(workers[t]->stat());
   }
 
-  // start to estimate the record data
-  stat->Reset();
+  if (result == 0
+      && !RecordFileIOFactory::Concatenate(parts, counts, destination)) {
+    result = 1;
+  }
 
-  VisitingRecord record;
-  std::set<UrlFprint>::const_iterator obsoleted_itr = obsoleted.begin();
-
-  // While there leaves only one file, no need to do the merge,
-  // just store the records.
-  while (readers.size() > 1) {
-    // Select the minimum fingerprint from the first records of every file.
-    UrlFprint fingerprint = records[0].fingerprint();
-    for (int i = 1; i < n; ++i) {
-      if (fingerprint > records[i].fingerprint()) {
-        fingerprint = records[i].fingerprint();
-      }
+  if (result == 0) {
+    FILE* file = fopen(fp_dest.c_str(), "wb");
+    SequentialWriter fpwriter;
+    if (file == NULL) {
+      result = 1;
+    } else {
+      fpwriter.Attach(file);
     }
-    
-    bool flag = 0;
-    for (int i = 0; i < n; ++i) {
-      if (fingerprint == records[i].fingerprint()) {
-        const VisitingRecord& another = records[i];
-        if (flag) {
-          // Not the first fingerprint record, merge to the first.
-          RecordMerger::Merge(record, another);
-        } else {
-          // Save first fingerprint record.
-          record = records[i];
-          flag = 1;
-        }
-
-        // Next record from the same file.
-        if (readers[i]->Read(&records[i]) != 0) {
-          // No more data available, we should remove it.
-          delete readers[i];
-          readers.erase(readers.begin() + i);
-          records.erase(records.begin() + i);
-
-          --i;
-          --n;
-        }
+    for (int t = 0; result == 0 && t < range_count; ++t) {
+      if (!AppendFile(&fpwriter, workers[t]->fp_dest())) {
+        result = 1;
       }
     }
+    if (!fpwriter.Close()) {
+      result = 1;
+    }
+  }
 
-    if (record.last_access >= cutdown) {
-      while (obsoleted_itr != obsoleted.end() && *obsoleted_itr < fingerprint) {
-          ++obsoleted_itr;
-      }
-      if (obsoleted_itr != obsoleted.end() && *obsoleted_itr == fingerprint) {
-        continue; // this url is obsoleted, skip it.
-      }
+  if (result == 0) {
+    stat->Save(destination);
+  } else {
+    Logger::Log(EVENT_ERROR, "Failed to merge [%s] in %d ranges.",
+              destination.c_str(), range_count);
+  }
+
+  for (int t = 0; t < range_count; ++t) {
+    RemoveRecordFile(workers[t]->destination());
+    remove(workers[t]->fp_dest().c_str());
+    delete workers[t];
+  }
+  return result;
+}
 
-      writer->Write(record);
-      fpwriter.Write(fingerprint);
-      stat->AddRecord(record);
+void RecordMerger::GetSplitPoints(const std::vector<std::string>& sources,
+                                  std::vector<UrlFprint>* splits) {
+  splits->clear();
+
+  int range_count = FprintSorter::GetProcessorCount();
+  if (range_count > kMaxMergeThreads) {
+    range_count = kMaxMergeThreads;
+  }
+  if (range_count < 2) return;
+
+  // Small merges are not worth the threads and the concatenation.
+  int64 total_size = 0;
+  int64 largest_size = -1;
+  std::string largest;
+  for (size_t i = 0; i < sources.size(); ++i) {
+    FileAttribute attr;
+    if (!FileUtil::GetFileAttribute(sources[i].c_str(), &attr)) continue;
+    total_size += attr.size;
+    if (attr.size > largest_size) {
+      largest_size = attr.size;
+      largest = sources[i];
+    }
+  }
+  if (total_size < kParallelMergeSize) return;
+
+  // The largest source, which is usually the base file, decides most of the
+  // work, so the ranges are its quantiles taken from its index. Finger
+  // prints are hash values, so even splits are fine without the index.
+  RecordFileIndex index;
+  const std::vector<RecordIndexEntry>& entries = index.entries();
+  bool indexed = index.Load(largest)
+    && static_cast<int>(entries.size()) >= range_count;
+
+  UrlFprint previous = 0;
+  for (int t = 1; t < range_count; ++t) {
+    UrlFprint split;
+    if (indexed) {
+      split = entries[entries.size() * t / range_count].fingerprint;
+    } else {
+      split = (~static_cast<UrlFprint>(0) / range_count) * t;
     }
-  }  // End while (readers.size() > 1).
-  
-  if (readers.size() == 1) {
-    do {
-      // Cut down all the records that exceed the max_url_life
-      if (records[0].last_access >= cutdown) {
-        while (obsoleted_itr != obsoleted.end() &&
-          *obsoleted_itr < records[0].fingerprint()) {
-          ++obsoleted_itr;
-        }
-        if (obsoleted_itr != obsoleted.end()
-          && *obsoleted_itr == records[0].fingerprint()) {
-          continue; // this url is obsoleted, skip it.
-        }
-
-        writer->Write(records[0]);
-        fpwriter.Write(records[0].fingerprint());
-        stat->AddRecord(records[0]);
-      }
 
-      // NotifyHandlers(records[0].second);
-    } while (readers[0]->Read(&records[0]) == 0);
+    // Splits must be ascending, and 0 is reserved for unbounded end.
+    if (split > previous) {
+      splits->push_back(split);
+      previous = split;
+    }
+  }
+}
 
-    delete readers[0];
+int RecordMerger::MergeRange(const std::string& destination,
+                             const std::string& fp_dest,
+                             const std::vector<std::string>& sources,
+                             const std::vector<std::string>& tombstones,
+                             const time_t& cutdown,
+                             UrlFprint begin, UrlFprint end,
+                             Observer* observer, RecordFileStat* stat) {
+  // open the writer
+  UrlFprintWriter fpwriter;
+  if (!fpwriter.Open(fp_dest.c_str())) {
+    return 1;
+  }
+  RecordFileWriter* writer =
+    RecordFileIOFactory::CreateIndexedWriter(destination);
+  if (writer == NULL) {
+    return 1;
+  }
+
+  // start to estimate the record data
+  stat->Reset();
+
+  // Records are merged, and obsoleted and too old ones are skipped by the
+  // reader. A source which can't be read fails the merge, otherwise its
+  // records would be lost when the sources are replaced.
+  RecordMergeReader reader;
+  bool result = reader.Open(sources, tombstones, cutdown, begin, end);
+
+  const VisitingRecord* record = NULL;
+  while (result && (record = reader.Next()) != NULL) {
+    if (writer->Write(*record) != 0
+        || !fpwriter.Write(record->fingerprint())) {
+      result = false;
+      break;
+    }
+    stat->AddRecord(*record);
+    if (observer != NULL) {
+      observer->OnRecord(*record);
+    }
   }
 
+  if (!writer->Close()) {
+    result = false;
+  }
   delete writer;
-  return 0;
+  if (!fpwriter.Close()) {
+    result = false;
+  }
+  return result ? 0 : 1;
 }
 
 
 // the record table and the current file must be saved to historical files before this merge() is called
 // so when merging, the record table and the current file can also be used by OnReceive new record.
-// file system should be exclusive accessed.
+// only one merge should run at a time, while readers use snapshots.
 // 'cutdown' is in unit 'sec'
-int RecordMerger::Merge(RecordfileManager* filemanager,  const std::set<UrlFprint>& obsoleted,
+int RecordMerger::Merge(RecordfileManager* filemanager,
+                        const std::vector<std::string>& tombstones,
                         int maxsize, const time_t& cutdown,
-                        RecordFileStat* stat) {
-
-  std::string oldbase = filemanager->GetBaseFile();
-
-  // get all the historical data files
-  std::vector<std::string> files = filemanager->GetTempFiles();
-  if (files.size() == 0) {
-    return RemoveOldRecords(oldbase, filemanager->GetFPFile(),
-                            obsoleted, cutdown, stat);
+                        RecordFileStat* stat, bool* base_merged,
+                        Observer* observer) {
+  *base_merged = false;
+
+  // New data only goes to the levels, which are much smaller than the base.
+  // Without new data, everything is merged into the base, so obsoleted and
+  // too old records are removed from the base.
+  bool merge_base = true;
+  if (filemanager->GetTempFiles().size() != 0) {
+    if (MergeTempFiles(filemanager, tombstones, cutdown) != 0) {
+      return 1;
+    }
+    merge_base = NeedMergeBase(filemanager);
   }
 
-  files.push_back(oldbase);
+  // The saved statistics of the files are combined, so the database is not
+  // read. It is only read if some statistics are missing.
+  if (!merge_base) {
+    std::vector<std::string> files = filemanager->GetDatabaseFiles();
+    if (LoadStat(files, stat)) {
+      return 0;
+    }
+    return ReadMergedStat(files, tombstones, cutdown, stat);
+  }
 
-  // create the new base file name
-  std::string newbase(oldbase);
-  newbase.append("__new_and_unique__");
+  // If the result may exceed "maxsize", the oldest records are cut down in
+  // the same pass. Statistics files count a url once for every file it is
+  // in, so the combined histogram only tells whether the cap may apply.
+  // It is exact for a single file. Otherwise the cut down time is taken
+  // from the merged records, which counts every url once, so no url is
+  // removed while the distinct urls are within "maxsize".
+  std::vector<std::string> files = filemanager->GetDatabaseFiles();
+  time_t oldest = cutdown;
+  RecordFileStat estimate;
+  bool loaded = LoadStat(files, &estimate);
+  int existing = 0;
+  for (int i = 0; i < static_cast<int>(files.size()); ++i) {
+    if (FileUtil::Exists(files[i].c_str())) ++existing;
+  }
+  if ((!loaded || (estimate.GetTotalCount() > maxsize && existing > 1))
+      && ReadMergedStat(files, tombstones, cutdown, &estimate) != 0) {
+    return 1;
+  }
+  if (estimate.GetTotalCount() > maxsize) {
+    // Only records newer than the cut down time are kept.
+    time_t capped = estimate.GetCutDownTime(maxsize) + 1;
+    if (capped > oldest) oldest = capped;
+  }
 
-  // merge all historical data files and base file into new base file
-  if (Merge(newbase, filemanager->GetFPFile(), files, obsoleted, cutdown, stat) != 0) {
+  // Merge all level files and the base file into a new generation of the
+  // base file. Old files are still read by snapshots holding them.
+  if (MergeInto(filemanager, files, filemanager->GetNewBaseFile(),
+                tombstones, oldest, observer, stat) != 0) {
     return 1;
   }
+  *base_merged = true;
+  return 0;
+}
 
-  if (stat->GetTotalCount() > maxsize) {
-    time_t cutdown = stat->GetCutDownTime(maxsize);
-    RemoveOldRecords(newbase, filemanager->GetFPFile(),
-      std::set<UrlFprint>(), cutdown, stat);
+int RecordMerger::MergeTempFiles(RecordfileManager* filemanager,
+                                 const std::vector<std::string>& tombstones,
+                                 const time_t& cutdown) {
+  // Temp files are level 0.
+  std::vector<std::string> files = filemanager->GetTempFiles();
+  if (files.size() != 0) {
+    if (MergeLevel(filemanager, files, 1, tombstones, cutdown) != 0) {
+      return 1;
+    }
   }
-  
-  // remove all the old files
-  for (int i = 0; i < static_cast<int>(files.size()); ++i) {
-    remove(files[i].c_str());
+
+  // A full level is merged into one file of next level, which may make next
+  // level full.
+  for (int level = 1; level < RecordfileManager::kLevelCount; ++level) {
+    files = filemanager->GetLevelFiles(level);
+    if (static_cast<int>(files.size()) < kLevelFanout) continue;
+
+    if (MergeLevel(filemanager, files, level + 1, tombstones, cutdown) != 0) {
+      return 1;
+    }
   }
+  return 0;
+}
 
-  filemanager->RemoveTempFiles(files);
-  // replace old base file with new base file
-  return rename(newbase.c_str(), oldbase.c_str());
+int RecordMerger::MergeLevel(RecordfileManager* filemanager,
+                             const std::vector<std::string>& sources,
+                             int level,
+                             const std::vector<std::string>& tombstones,
+                             const time_t& cutdown) {
+  RecordFileStat stat;
+  return MergeInto(filemanager, sources, filemanager->GetNewLevelFile(level),
+                   tombstones, cutdown, NULL, &stat);
 }
 
-int RecordMerger::RemoveOldRecords(const std::string& recordfile,
-                                   const std::string& fpfile,
-                                   const std::set<UrlFprint>& obsoleted,
-                                   const time_t& cutdown,
-                                   RecordFileStat* stat) {
-  std::string swapfile(recordfile);
-  swapfile.append("_merger_to_swap");
+int RecordMerger::MergeInto(RecordfileManager* filemanager,
+                            const std::vector<std::string>& sources,
+                            const std::string& destination,
+                            const std::vector<std::string>& tombstones,
+                            const time_t& cutdown, Observer* observer,
+                            RecordFileStat* stat) {
+  // The new file is merged with another name, so an incomplete file is
+  // never taken as a database file.
+  std::string swapfile = RecordfileManager::GetSwapFile(destination);
+  std::string fpfile = RecordfileManager::GetRecordFPFile(destination);
+  std::string fpswap = RecordfileManager::GetRecordFPFile(swapfile);
+
+  // Records are passed to the observer in order, so the merge is done by
+  // one thread.
+  int result = 0;
+  if (observer == NULL) {
+    result = Merge(swapfile, fpswap, sources, tombstones, cutdown, stat);
+  } else {
+    result = MergeRange(swapfile, fpswap, sources, tombstones, cutdown,
+                        0, 0, observer, stat);
+    if (result == 0) {
+      stat->Save(swapfile);
+    }
+  }
+  // The sources are recorded as retired before the destination exists, so
+  // they are not read with it again after a restart.
+  if (result == 0 && !filemanager->PrepareMerge(sources, destination)) {
+    result = 1;
+  }
+  if (result == 0) {
+    remove(fpfile.c_str());
+    if (rename(fpswap.c_str(), fpfile.c_str()) != 0
+        || ReplaceRecordFile(swapfile, destination) != 0) {
+      result = 1;
+    }
+  }
 
-  // Open fpfile to write.
-  UrlFprintWriter fpwriter;
-  if (!fpwriter.Open(fpfile.c_str())) {
-    return -1;
+  if (result != 0) {
+    Logger::Log(EVENT_ERROR, "Failed to merge database file [%s].",
+              destination.c_str());
+    RemoveRecordFile(swapfile);
+    remove(fpswap.c_str());
+    remove(fpfile.c_str());
+    return result;
   }
 
-  // Open old record file.
-  RecordFileReader* reader = RecordFileIOFactory::CreateReader(recordfile);
-  if (reader == NULL) {
-    return 1;
+  filemanager->CommitMerge(sources, destination);
+  return 0;
+}
+
+bool RecordMerger::NeedMergeBase(RecordfileManager* filemanager) {
+  int last_level = RecordfileManager::kLevelCount;
+  if (static_cast<int>(filemanager->GetLevelFiles(last_level).size())
+      >= kLevelFanout) {
+    return true;
   }
 
-  // Open new record file.
-  RecordFileWriter* writer = RecordFileIOFactory::CreateWriter(swapfile);
-  if (writer == NULL) {
-    delete reader;
-    return 2;
+  FileAttribute attr;
+  std::string base = filemanager->GetBaseFile();
+  if (!FileUtil::GetFileAttribute(base.c_str(), &attr)) {
+    return true;
   }
+  return filemanager->GetLevelFilesSize() * kBaseRatio >= attr.size;
+}
+
+void RecordMerger::RemoveDatabaseFile(const std::string& recordfile) {
+  RemoveRecordFile(recordfile);
+  remove(RecordfileManager::GetRecordFPFile(recordfile).c_str());
+}
 
-  // do removing
-  VisitingRecord record;
+bool RecordMerger::LoadStat(const std::vector<std::string>& files,
+                            RecordFileStat* stat) {
   stat->Reset();
+  for (int i = 0; i < static_cast<int>(files.size()); ++i) {
+    // A missing file, like the base file of a new site, has no record.
+    if (!FileUtil::Exists(files[i].c_str())) continue;
 
-  std::set<UrlFprint>::const_iterator itr = obsoleted.begin();
-  while (reader->Read(&record) == 0) {
-    while (itr != obsoleted.end() && (*itr) < record.fingerprint()) {
-      ++itr;
-    }
-    if (itr != obsoleted.end() && (*itr) == record.fingerprint()) {
-      ++itr;
-    } else if (record.last_access > cutdown) {
-      stat->AddRecord(record);
-      writer->Write(record);
-      fpwriter.Write(record.fingerprint());
+    RecordFileStat file_stat;
+    if (!file_stat.Load(files[i])) {
+      return false;
     }
+    stat->Merge(file_stat);
   }
+  return true;
+}
 
-  fpwriter.Close();
-  delete reader;
-  delete writer;
+int RecordMerger::ReadMergedStat(const std::vector<std::string>& files,
+                                 const std::vector<std::string>& tombstones,
+                                 const time_t& cutdown,
+                                 RecordFileStat* stat) {
+  RecordMergeReader reader;
+  if (!reader.Open(files, tombstones, cutdown)) {
+    return 1;
+  }
 
-  // replace old file with new file
-  remove(recordfile.c_str());
-  rename(swapfile.c_str(), recordfile.c_str());
+  stat->Reset();
+  const VisitingRecord* record = NULL;
+  while ((record = reader.Next()) != NULL) {
+    stat->AddRecord(*record);
+  }
   return 0;
 }
 
+void RecordMerger::GetSideFiles(const std::string& recordfile,
+                                std::vector<std::string>* sides) {
+  // Side files of a record file are its indexes, columns and statistics.
+  sides->clear();
+  sides->push_back(RecordFileIndex::GetIndexPath(recordfile));
+  sides->push_back(RecordUrlIndex::GetIndexPath(recordfile));
+  sides->push_back(RecordFileStat::GetStatPath(recordfile));
+  for (int i = 0; i < RecordColumn::FIELD_COUNT; ++i) {
+    RecordColumn::Field field = static_cast<RecordColumn::Field>(i);
+    sides->push_back(RecordColumn::GetColumnPath(recordfile, field));
+  }
+}
+
+void RecordMerger::RemoveRecordFile(const std::string& recordfile) {
+  std::vector<std::string> sides;
+  GetSideFiles(recordfile, &sides);
+  for (size_t i = 0; i < sides.size(); ++i) {
+    remove(sides[i].c_str());
+  }
+  remove(recordfile.c_str());
+}
+
+int RecordMerger::ReplaceRecordFile(const std::string& source,
+                                    const std::string& dest) {
+  std::vector<std::string> source_sides, dest_sides;
+  GetSideFiles(source, &source_sides);
+  GetSideFiles(dest, &dest_sides);
+
+  // Old side files are removed first, so they never go with the new file.
+  RemoveRecordFile(dest);
+  int result = rename(source.c_str(), dest.c_str());
+  for (size_t i = 0; result == 0 && i < source_sides.size(); ++i) {
+    if (FileUtil::Exists(source_sides[i].c_str())) {
+      rename(source_sides[i].c_str(), dest_sides[i].c_str());
+    }
+  }
+  return result;
+}
+
 
 bool RecordMerger::MergeUrlFprint(const std::string& dest,
                                   const std::vector<std::string> srcs,
-                                  const std::set<UrlFprint>& obsoleted) {
+                                  const std::vector<std::string>& tombstones) {
   UrlFprintWriter writer;
   if (!writer.Open(dest.c_str())) {
     Logger::Log(EVENT_ERROR, "Failed to open [%s] to write url fprint.",
@@ -264,68 +568,45 @@ bool RecordMerger::MergeUrlFprint(const std::string& dest,
 
   int n = static_cast<int>(srcs.size());
 
-  std::vector<UrlFprint> fprints(n);
   std::vector<UrlFprintReader*> readers(n);
 
-  // open all the files to read.
+  // open all the files to read, and order them by their first finger prints.
+  MergeHeap heap;
+  UrlFprint fingerprint = 0;
   for (int i = 0; i < n; ++i) {
     readers[i] = new UrlFprintReader();
-    if (!readers[i]->Open(srcs[i].c_str()) || !readers[i]->Read(&fprints[i])) {
+    if (!readers[i]->Open(srcs[i].c_str()) || !readers[i]->Read(&fingerprint)) {
       delete readers[i];
-      readers.erase(readers.begin() + i);
-      fprints.erase(fprints.begin() + i);
-      --i;
-      --n;
+      readers[i] = NULL;
+    } else {
+      heap.Push(i, fingerprint);
     }
   }
 
-  UrlFprint fingerprint = 0;
-  std::set<UrlFprint>::const_iterator obsoleted_itr = obsoleted.begin();
-
-  while (readers.size() > 1) {
-    fingerprint = fprints[0];
-    for (int i = 1; i < n; ++i) {
-      if (fingerprint > fprints[i]) {
-        fingerprint = fprints[i];
-      }
-    }
-    
-    for (int i = 0; i < n; ++i) {
-      if (fingerprint == fprints[i]) {
-        // next record from the same file 
-        if (!readers[i]->Read(&fprints[i])) {
-          delete readers[i];
-          readers.erase(readers.begin() + i);
-          fprints.erase(fprints.begin() + i);
-
-          --i, --n;
-        }
+  TombstoneReader obsoleted;
+  obsoleted.Open(tombstones);
+
+  while (!heap.empty()) {
+    UrlFprint minimum = heap.top_key();
+
+    // Skip the same finger print in all files.
+    while (!heap.empty() && heap.top_key() == minimum) {
+      int source = heap.top();
+      if (readers[source]->Read(&fingerprint)) {
+        heap.ReplaceTop(fingerprint);
+      } else {
+        delete readers[source];
+        readers[source] = NULL;
+        heap.Pop();
       }
     }
 
-    while (obsoleted_itr != obsoleted.end() && *obsoleted_itr < fingerprint) {
-        ++obsoleted_itr;
-    }
-    if (obsoleted_itr != obsoleted.end() && *obsoleted_itr == fingerprint) {
+    // There is no access time here, so any tombstone removes the url.
+    if (obsoleted.Contains(minimum, 0)) {
       continue; // this url is obsoleted, skip it.
     }
 
-    writer.Write(fingerprint);
-  }
-  
-  if (readers.size() == 1) {
-    do {
-        while (obsoleted_itr != obsoleted.end() && *obsoleted_itr < fprints[0]) {
-            ++obsoleted_itr;
-        }
-        if (obsoleted_itr != obsoleted.end() && *obsoleted_itr == fprints[0]) {
-          continue; // this url is obsoleted, skip it.
-        }
-
-        writer.Write(fprints[0]);
-    } while (readers[0]->Read(&fprints[0]));
-
-    delete readers[0];
+    writer.Write(minimum);
   }
 
   writer.Close();
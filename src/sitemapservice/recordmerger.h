@@ -15,7 +15,8 @@
 
 // RecordMerger class is used to merge one or more visting record files.
 // It merges records with same fingerprint. Other than that, during merging
-// process, it also removes obsoleted URLs.
+// process, it also removes obsoleted URLs, whose fingerprints are read from
+// tombstone runs (see TombstoneLog).
 // A merging process is to merge two visiting records which belongs the same
 // URL. For example, the visiting count should be added by merging.
 // This class is thread safe as it contains no internal state.
@@ -23,7 +24,6 @@
 #ifndef SITEMAPSERVICE_RECORDMERGER_H__
 #define SITEMAPSERVICE_RECORDMERGER_H__
 
-#include <set>
 #include <string>
 #include <vector>
 
@@ -35,6 +35,30 @@
 
 class RecordMerger {
 public:
+  // Max number of threads merging ranges of finger prints.
+  static const int kMaxMergeThreads = 8;
+
+  // Sources smaller than this in total are merged in calling thread.
+  static const int64 kParallelMergeSize = 16 * 1024 * 1024;
+
+  // Files of a level are merged into next level when there are this many.
+  static const int kLevelFanout = 4;
+
+  // Level files are merged into the base file when their total size is more
+  // than 1 / kBaseRatio of the base file.
+  static const int kBaseRatio = 4;
+
+  // Receives the records of a new base file while it is written by a merge,
+  // so they can be used without reading the file again.
+  class Observer {
+   public:
+    virtual ~Observer() {}
+
+    // Called for every record in the order of finger prints, in the thread
+    // calling Merge.
+    virtual void OnRecord(const VisitingRecord& record) = 0;
+  };
+
   // Empty constructor.
   RecordMerger();
 
@@ -49,53 +73,132 @@ public:
   // "destination" specifies the result record files. "fp_dest" represents the
   // file containing all the URL fingerprints included in "destination".
   // "sources" vector contains all the original record files.
-  // "obsoleted" set contains fingerprints of all obsoleted visiting records,
-  // which shouldn't occur in "destination" file.
+  // "tombstones" contains sorted runs of fingerprints of all obsoleted
+  // visiting records (see TombstoneLog). Records not visited after they are
+  // obsoleted shouldn't occur in "destination" file.
   // "cutdonw" specifies the cut down time of last access value of visiting
   // records. Any visiting record whose last access time is older than that
   // should not occur in "destination" file.
-  // "stat" stores the statistics of all the visting records.
+  // "stat" stores the statistics of all the visting records, which is also
+  // saved with "destination", see RecordFileStat::Save.
+  // Large merges are split into ranges of finger prints, which are merged
+  // by multiple threads into parts of "destination", see MergeRange.
   int Merge(const std::string& destination,
             const std::string& fp_dest,
             const std::vector<std::string>& sources,
-            const std::set<UrlFprint>& obsoleted,
+            const std::vector<std::string>& tombstones,
             const time_t& cutdown,
             RecordFileStat* stat);
 
   // Merge visting record files specifed by given "filemanager"
-  // It merges the old base data file and all temporary data files into a new
-  // base data file. The base data file and temporary files are specified by
-  // "filemanager".
-  // For "obsoleted" "cutdown" and "stat", please see above Merge method.
+  // Temporary data files are merged into level files by MergeTempFiles.
+  // When the level files are large enough, or there is no temporary data
+  // file, they are merged into a new generation of the base data file with
+  // the old one, and "base_merged" is set to true. Merged files are retired
+  // by RecordfileManager::CommitMerge, so readers holding snapshots are not
+  // disturbed. See RecordfileManager for the levels.
+  // Merges of the same "filemanager" should not run concurrently.
+  // For "tombstones" "cutdown" and "stat", please see above Merge method.
+  // "stat" is always the statistics of the whole database. If the base file
+  // is not merged, it is combined from the saved statistics of the files, so
+  // a url in several files is counted several times, see LoadStat.
   // "maxsize" represents the max number of URLs contained in new base data
   // file. If the merging result exceeds "maxsize", the URLs with oldest
   // last_access time are excluded from result.
-  int Merge(RecordfileManager* filemanager, const std::set<UrlFprint>& obsoleted,
-            int maxsize, const time_t& cutdown, RecordFileStat* stat);
+  // If "observer" is not NULL, and the base file is merged, all the records
+  // of the new base file are passed to it while they are written. Such a
+  // merge is not split into ranges. If the merge fails, part of the records
+  // may have been passed.
+  int Merge(RecordfileManager* filemanager,
+            const std::vector<std::string>& tombstones,
+            int maxsize, const time_t& cutdown, RecordFileStat* stat,
+            bool* base_merged, Observer* observer);
+
+  // Merge all temporary data files of "filemanager" into a new level 1 file,
+  // and merge the files of every full level into a file of next level.
+  // The base data file is not changed.
+  // Returns 0 if successful.
+  int MergeTempFiles(RecordfileManager* filemanager,
+                     const std::vector<std::string>& tombstones,
+                     const time_t& cutdown);
 
   // Merge URL fingerprint files.
   // "dest" is the file storing merging result.
   // "srcs" contains all the fingerprint files to be merged.
-  // "obsoleted" contains fingerprints of all URLs which should be excluded
-  // from result.
+  // "tombstones" contains sorted runs of fingerprints of all URLs which
+  // should be excluded from result.
   bool MergeUrlFprint(const std::string& dest,
                       const std::vector<std::string> srcs,
-                      const std::set<UrlFprint>& obsoleted);
+                      const std::vector<std::string>& tombstones);
 
-private:
-
-  // Remove old records from given recordfile.
-  // It is a helper routine for "Merge" method above.
-  // "recordfile" represents the visting record to be processed.
-  // "fpfile" represents file containing fingerprints of all visiting records
-  // contained in "recordfile".
-  // "obsoleted" set contains fingerprints of all obsoleted URLs.
-  // "stat" should return the statistics of new "recordfile".
-  int RemoveOldRecords(const std::string& recordfile,
-                       const std::string& fpfile,
-                       const std::set<UrlFprint>& obsoleted,
-                       const time_t& cutdown,
+  // Combine the saved statistics of "files". A url in several files is
+  // counted several times, so the total count is an upper bound.
+  // Returns false if any file has no valid statistics.
+  static bool LoadStat(const std::vector<std::string>& files,
                        RecordFileStat* stat);
+
+  // Get the exact statistics of the merged records of "files" by reading
+  // them. For "tombstones" and "cutdown", see Merge.
+  // Returns 0 if successful.
+  static int ReadMergedStat(const std::vector<std::string>& files,
+                            const std::vector<std::string>& tombstones,
+                            const time_t& cutdown, RecordFileStat* stat);
+
+  // Remove a level file or a base file with its finger print file and side
+  // files.
+  static void RemoveDatabaseFile(const std::string& recordfile);
+
+  // Whether the level files of "filemanager" should be merged into the base.
+  static bool NeedMergeBase(RecordfileManager* filemanager);
+
+private:
+  class RangeWorker;
+
+  // Merge records with finger prints in range ["begin", "end") of the
+  // sources, where "end" of 0 means no upper bound. Other parameters are the
+  // same as Merge above. "destination" is written by CreateIndexedWriter.
+  // Written records are also passed to "observer" if it is not NULL.
+  int MergeRange(const std::string& destination,
+                 const std::string& fp_dest,
+                 const std::vector<std::string>& sources,
+                 const std::vector<std::string>& tombstones,
+                 const time_t& cutdown,
+                 UrlFprint begin, UrlFprint end,
+                 Observer* observer, RecordFileStat* stat);
+
+  // Merge "sources" into a new file of given level. See MergeInto.
+  int MergeLevel(RecordfileManager* filemanager,
+                 const std::vector<std::string>& sources, int level,
+                 const std::vector<std::string>& tombstones,
+                 const time_t& cutdown);
+
+  // Merge "sources" into database file "destination" with its finger print
+  // file, and commit it to "filemanager", which retires the sources.
+  // For "observer", see Merge.
+  // Returns 0 if successful.
+  int MergeInto(RecordfileManager* filemanager,
+                const std::vector<std::string>& sources,
+                const std::string& destination,
+                const std::vector<std::string>& tombstones,
+                const time_t& cutdown, Observer* observer,
+                RecordFileStat* stat);
+
+  // Get ascending split points of finger prints for a parallel merge of
+  // "sources". "splits" is empty if the merge should not be split.
+  static void GetSplitPoints(const std::vector<std::string>& sources,
+                             std::vector<UrlFprint>* splits);
+
+  // Get paths of all the side files of a record file.
+  static void GetSideFiles(const std::string& recordfile,
+                           std::vector<std::string>* sides);
+
+  // Remove a record file with all its side files.
+  static void RemoveRecordFile(const std::string& recordfile);
+
+  // Replace record file "dest" with "source", together with their indexes.
+  // Returns 0 if successful.
+  static int ReplaceRecordFile(const std::string& source,
+                               const std::string& dest);
 };
 
 #endif // SITEMAPSERVICE_RECORDMERGER_H__
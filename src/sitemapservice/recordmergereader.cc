@@ -0,0 +1,402 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#include "sitemapservice/recordmergereader.h"
+
+#include "common/fileutil.h"
+#include "sitemapservice/recordmerger.h"
+
+namespace {
+
+// Whether a finger print is less than the end of a range, where 0 means the
+// range is not bounded.
+inline bool BeforeEnd(const UrlFprint& fprint, const UrlFprint& end) {
+  return end == 0 || fprint < end;
+}
+
+}  // namespace
+
+RecordMergeReader::RecordMergeReader() {
+  cutdown_ = 0;
+  end_ = 0;
+  pending_ = -1;
+  snapshot_ = NULL;
+  obsoleted_.Close();
+}
+
+RecordMergeReader::~RecordMergeReader() {
+  Close();
+}
+
+bool RecordMergeReader::Open(const std::vector<std::string>& sources,
+                             const std::vector<std::string>& tombstones,
+                             time_t cutdown) {
+  return Open(sources, tombstones, cutdown, 0, 0);
+}
+
+bool RecordMergeReader::Open(RecordfileManager::Snapshot* snapshot,
+                             const std::vector<std::string>& tombstones,
+                             time_t cutdown) {
+  // Temp files are newer than the database files.
+  std::vector<std::string> files = snapshot->GetDatabaseFiles();
+  files.insert(files.end(), snapshot->temp_files().begin(),
+               snapshot->temp_files().end());
+
+  bool result = Open(files, tombstones, cutdown, 0, 0);
+  snapshot->AddRef();
+  snapshot_ = snapshot;
+  return result;
+}
+
+bool RecordMergeReader::Open(const std::vector<std::string>& sources,
+                             const std::vector<std::string>& tombstones,
+                             time_t cutdown, UrlFprint begin, UrlFprint end) {
+  Close();
+
+  cutdown_ = cutdown;
+  end_ = end;
+  // Obsoleted urls are as important as the records.
+  bool result = obsoleted_.Open(tombstones);
+
+  // Open all the files, and order them by their first records in range.
+  int n = static_cast<int>(sources.size());
+  readers_.resize(n, NULL);
+  records_.resize(n, NULL);
+  for (int i = 0; i < n; ++i) {
+    if (!FileUtil::Exists(sources[i].c_str())) continue;
+
+    readers_[i] = RecordFileIOFactory::CreateRangeReader(sources[i], begin);
+    if (readers_[i] == NULL) {
+      result = false;
+      continue;
+    }
+
+    // Range readers may start before "begin".
+    do {
+      records_[i] = readers_[i]->Next();
+    } while (records_[i] != NULL && records_[i]->fingerprint() < begin);
+
+    if (records_[i] != NULL && BeforeEnd(records_[i]->fingerprint(), end_)) {
+      heap_.Push(i, records_[i]->fingerprint());
+    } else {
+      delete readers_[i];
+      readers_[i] = NULL;
+    }
+  }
+  return result;
+}
+
+bool RecordMergeReader::Initialize(FILE* /* file */) {
+  return false;
+}
+
+int RecordMergeReader::Read(VisitingRecord* record) {
+  const VisitingRecord* next = Next();
+  if (next == NULL) {
+    return 1;
+  }
+
+  *record = *next;
+  return 0;
+}
+
+const VisitingRecord* RecordMergeReader::Next() {
+  while (true) {
+    merged_.set_url(NULL);
+    if (pending_ >= 0) {
+      Advance(pending_);
+      pending_ = -1;
+    }
+    if (heap_.empty()) {
+      return NULL;
+    }
+
+    // The first record is taken out of the heap, and it is not moved forward
+    // until next call, so its url can be used without copying.
+    UrlFprint fingerprint = heap_.top_key();
+    pending_ = heap_.top();
+    heap_.Pop();
+
+    // Merge records of the same url from other files.
+    const VisitingRecord* record = records_[pending_];
+    if (!heap_.empty() && heap_.top_key() == fingerprint) {
+      merged_.ShallowCopy(*record);
+      do {
+        int source = heap_.top();
+        RecordMerger::Merge(merged_, *records_[source]);
+
+        // Next record from the same file, which may be out of range.
+        records_[source] = readers_[source]->Next();
+        if (records_[source] != NULL
+            && BeforeEnd(records_[source]->fingerprint(), end_)) {
+          heap_.ReplaceTop(records_[source]->fingerprint());
+        } else {
+          delete readers_[source];
+          readers_[source] = NULL;
+          heap_.Pop();
+        }
+      } while (!heap_.empty() && heap_.top_key() == fingerprint);
+      record = &merged_;
+    }
+
+    // Skip the records that exceed the max_url_life, and the urls obsoleted
+    // after their last access.
+    if (record->last_access >= cutdown_
+        && !obsoleted_.Contains(fingerprint, record->last_access)) {
+      return record;
+    }
+  }
+}
+
+void RecordMergeReader::Advance(int source) {
+  records_[source] = readers_[source]->Next();
+  if (records_[source] != NULL
+      && BeforeEnd(records_[source]->fingerprint(), end_)) {
+    heap_.Push(source, records_[source]->fingerprint());
+  } else {
+    delete readers_[source];
+    readers_[source] = NULL;
+  }
+}
+
+void RecordMergeReader::Close() {
+  merged_.set_url(NULL);
+  for (size_t i = 0; i < readers_.size(); ++i) {
+    if (readers_[i] != NULL) delete readers_[i];
+  }
+  readers_.clear();
+  records_.clear();
+  while (!heap_.empty()) {
+    heap_.Pop();
+  }
+  pending_ = -1;
+
+  if (snapshot_ != NULL) {
+    snapshot_->Release();
+    snapshot_ = NULL;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////
+// Implementation of RecordChangeReader
+
+RecordChangeReader::RecordChangeReader() {
+  next_row_ = 0;
+  base_record_ = NULL;
+  base_order_ = 0;
+  cutdown_ = 0;
+  since_ = 0;
+  pending_ = -1;
+  advance_base_ = false;
+  snapshot_ = NULL;
+}
+
+RecordChangeReader::~RecordChangeReader() {
+  Close();
+}
+
+bool RecordChangeReader::Open(RecordfileManager::Snapshot* snapshot,
+                              const std::vector<std::string>& tombstones,
+                              time_t cutdown, time_t since) {
+  Close();
+
+  cutdown_ = cutdown;
+  since_ = since;
+  snapshot->AddRef();
+  snapshot_ = snapshot;
+
+  const std::string& base = snapshot->base_file();
+  bool result = last_change_.Open(base, RecordColumn::LAST_CHANGE)
+    && changed_.Open(base) && lookup_.Open(base);
+  if (!obsoleted_.Open(tombstones)) {
+    result = false;
+  }
+
+  // The base file follows the level files, and temp files are the newest.
+  std::vector<std::string> newer = snapshot->level_files();
+  base_order_ = static_cast<int>(newer.size());
+  newer.insert(newer.end(), snapshot->temp_files().begin(),
+               snapshot->temp_files().end());
+
+  int n = static_cast<int>(newer.size());
+  readers_.resize(n, NULL);
+  records_.resize(n, NULL);
+  for (int i = 0; i < n; ++i) {
+    if (!FileUtil::Exists(newer[i].c_str())) continue;
+
+    readers_[i] = RecordFileIOFactory::CreateReader(newer[i]);
+    if (readers_[i] == NULL) {
+      result = false;
+      continue;
+    }
+    Advance(i);
+  }
+
+  next_row_ = 0;
+  advance_base_ = true;
+  return result;
+}
+
+bool RecordChangeReader::Initialize(FILE* /* file */) {
+  return false;
+}
+
+int RecordChangeReader::Read(VisitingRecord* record) {
+  const VisitingRecord* next = Next();
+  if (next == NULL) {
+    return 1;
+  }
+
+  *record = *next;
+  return 0;
+}
+
+const VisitingRecord* RecordChangeReader::Next() {
+  while (true) {
+    merged_.set_url(NULL);
+    if (pending_ >= 0) {
+      Advance(pending_);
+      pending_ = -1;
+    }
+    if (advance_base_) {
+      AdvanceBase();
+      advance_base_ = false;
+    }
+    if (heap_.empty() && base_record_ == NULL) {
+      return NULL;
+    }
+
+    // Take the records of the smallest finger print out of the heap, which
+    // are in the order of their files.
+    UrlFprint fingerprint = 0;
+    if (heap_.empty() || (base_record_ != NULL
+                          && base_record_->fingerprint() < heap_.top_key())) {
+      fingerprint = base_record_->fingerprint();
+    } else {
+      fingerprint = heap_.top_key();
+    }
+    bool changed = false;
+    sources_.clear();
+    while (!heap_.empty() && heap_.top_key() == fingerprint) {
+      sources_.push_back(heap_.top());
+      changed = changed || records_[heap_.top()]->last_change > since_;
+      heap_.Pop();
+    }
+
+    const VisitingRecord* base = NULL;
+    if (base_record_ != NULL && base_record_->fingerprint() == fingerprint) {
+      base = base_record_;
+      advance_base_ = true;
+      changed = true;
+    } else if (changed) {
+      base = lookup_.Find(fingerprint);
+    }
+
+    // The merged last_change is one of the records, so nothing is changed
+    // if none of them is.
+    if (!changed) {
+      for (size_t i = 0; i < sources_.size(); ++i) {
+        Advance(sources_[i]);
+      }
+      continue;
+    }
+
+    // Merge the records in the order of RecordMergeReader.
+    ordered_.clear();
+    for (size_t i = 0; i < sources_.size(); ++i) {
+      if (base != NULL && sources_[i] >= base_order_) {
+        ordered_.push_back(base);
+        base = NULL;
+      }
+      ordered_.push_back(records_[sources_[i]]);
+    }
+    if (base != NULL) {
+      ordered_.push_back(base);
+    }
+    const VisitingRecord* record = ordered_[0];
+    if (ordered_.size() > 1) {
+      merged_.ShallowCopy(*record);
+      for (size_t i = 1; i < ordered_.size(); ++i) {
+        RecordMerger::Merge(merged_, *ordered_[i]);
+      }
+      record = &merged_;
+    }
+
+    // Url of the first record is returned, so its file is only moved forward
+    // in next call.
+    for (size_t i = 0; i < sources_.size(); ++i) {
+      if (records_[sources_[i]] == ordered_[0]) {
+        pending_ = sources_[i];
+      } else {
+        Advance(sources_[i]);
+      }
+    }
+
+    // Skip unchanged records, and the records skipped by RecordMergeReader.
+    if (record->last_change > since_
+        && record->last_access >= cutdown_
+        && !obsoleted_.Contains(fingerprint, record->last_access)) {
+      return record;
+    }
+  }
+}
+
+void RecordChangeReader::Advance(int source) {
+  records_[source] = readers_[source]->Next();
+  if (records_[source] != NULL) {
+    heap_.Push(source, records_[source]->fingerprint());
+  } else {
+    delete readers_[source];
+    readers_[source] = NULL;
+  }
+}
+
+void RecordChangeReader::AdvanceBase() {
+  base_record_ = NULL;
+  while (next_row_ < last_change_.row_count()) {
+    int64 row = next_row_++;
+    if (static_cast<time_t>(last_change_.value(row)) > since_) {
+      base_record_ = changed_.Get(row);
+      return;
+    }
+  }
+}
+
+void RecordChangeReader::Close() {
+  merged_.set_url(NULL);
+  last_change_.Close();
+  changed_.Close();
+  lookup_.Close();
+  obsoleted_.Close();
+  next_row_ = 0;
+  base_record_ = NULL;
+
+  for (size_t i = 0; i < readers_.size(); ++i) {
+    if (readers_[i] != NULL) delete readers_[i];
+  }
+  readers_.clear();
+  records_.clear();
+  while (!heap_.empty()) {
+    heap_.Pop();
+  }
+  pending_ = -1;
+  advance_base_ = false;
+
+  if (snapshot_ != NULL) {
+    snapshot_->Release();
+    snapshot_ = NULL;
+  }
+}
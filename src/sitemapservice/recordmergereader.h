@@ -0,0 +1,188 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+// RecordMergeReader reads several record files sorted by finger print as one
+// sorted file. Records of the same url are merged by RecordMerger::Merge, in
+// the order of the sources. Obsoleted urls and records which are too old are
+// skipped, so the result is what a merge of the sources would write.
+// It is used to merge record files, and to read the database, which is the
+// base file together with the level files not merged into it yet.
+// See RecordfileManager::GetDatabaseFiles.
+
+#ifndef SITEMAPSERVICE_RECORDMERGEREADER_H__
+#define SITEMAPSERVICE_RECORDMERGEREADER_H__
+
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "common/basictypes.h"
+#include "common/url.h"
+#include "sitemapservice/mergeheap.h"
+#include "sitemapservice/recordcolumnio.h"
+#include "sitemapservice/recordfileindex.h"
+#include "sitemapservice/recordfileio.h"
+#include "sitemapservice/recordfilemanager.h"
+#include "sitemapservice/tombstonelog.h"
+#include "sitemapservice/visitingrecord.h"
+
+class RecordMergeReader : public RecordFileReader {
+ public:
+  RecordMergeReader();
+  virtual ~RecordMergeReader();
+
+  // Opens the sources, and reads records with finger prints in range
+  // ["begin", "end"), where "end" of 0 means no upper bound.
+  // Urls obsoleted in "tombstones" after their last access (see
+  // TombstoneReader), and records whose last access is before "cutdown" are
+  // skipped.
+  // A missing source has no records, like the base file of a new site.
+  // Returns false if an existing source can't be opened, in which case the
+  // other sources are still read, but they are not all the records.
+  bool Open(const std::vector<std::string>& sources,
+            const std::vector<std::string>& tombstones,
+            time_t cutdown, UrlFprint begin, UrlFprint end);
+
+  // Opens the sources to read all the records.
+  bool Open(const std::vector<std::string>& sources,
+            const std::vector<std::string>& tombstones,
+            time_t cutdown);
+
+  // Opens the database files and temp files of "snapshot" to read all the
+  // records. The snapshot is held until the reader is closed, so the files
+  // are not deleted by merges.
+  bool Open(RecordfileManager::Snapshot* snapshot,
+            const std::vector<std::string>& tombstones,
+            time_t cutdown);
+
+  // Overriden methods. See base class.
+  // A merge reader can't be initialized with a single file, so Initialize
+  // always returns false.
+  virtual bool Initialize(FILE* file);
+
+  virtual int Read(VisitingRecord* record);
+
+  virtual const VisitingRecord* Next();
+
+  virtual void Close();
+
+ private:
+  // Moves a source, which is not in the heap, to its next record in range.
+  // The source is pushed to the heap, or closed if it reaches the end.
+  void Advance(int source);
+
+  std::vector<RecordFileReader*> readers_;
+  std::vector<const VisitingRecord*> records_;
+  MergeHeap heap_;
+
+  TombstoneReader obsoleted_;
+  time_t cutdown_;
+  UrlFprint end_;
+
+  // Result of merging records of the same url.
+  VisitingRecord merged_;
+
+  // The source whose record is returned by last Next. It is only moved
+  // forward in next call, so its url can be returned without copying.
+  int pending_;
+
+  // Snapshot of the sources, which is released by Close. It may be NULL.
+  RecordfileManager::Snapshot* snapshot_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(RecordMergeReader);
+};
+
+// RecordChangeReader reads the records of a snapshot which are changed after
+// a time, which are what a RecordMergeReader of the snapshot returns with
+// last_change after that time.
+// Only a few records of the base file are usually changed, so its last_change
+// column is scanned, and only the changed rows are read. They are merged with
+// the records of the level files and the temp files, which are much fewer.
+// An unchanged base record is only looked up through the index, if a newer
+// record of the url is changed, because the merged last_change may still be
+// the one of the base record.
+class RecordChangeReader : public RecordFileReader {
+ public:
+  RecordChangeReader();
+  virtual ~RecordChangeReader();
+
+  // Opens the files of "snapshot" to read records changed after "since".
+  // For "tombstones" and "cutdown", see RecordMergeReader::Open. The snapshot
+  // is held until the reader is closed.
+  // Returns false if the base file has no valid last_change column or index,
+  // or a file can't be opened, and then the reader should not be used.
+  bool Open(RecordfileManager::Snapshot* snapshot,
+            const std::vector<std::string>& tombstones,
+            time_t cutdown, time_t since);
+
+  // Overriden methods. See base class.
+  // Initialize always returns false, like RecordMergeReader.
+  virtual bool Initialize(FILE* file);
+
+  virtual int Read(VisitingRecord* record);
+
+  virtual const VisitingRecord* Next();
+
+  virtual void Close();
+
+ private:
+  // Moves a newer file to its next record, like RecordMergeReader::Advance.
+  void Advance(int source);
+
+  // Moves to next changed row of the base file. base_record_ is NULL at the
+  // end.
+  void AdvanceBase();
+
+  // Last change times of the base file, and the changed records of it.
+  RecordColumn last_change_;
+  RecordOrdinalReader changed_;
+  int64 next_row_;
+  const VisitingRecord* base_record_;
+
+  // Looks up unchanged base records.
+  RecordOrdinalReader lookup_;
+
+  // The level files and the temp files, in the order of RecordMergeReader.
+  // Records of the base file are merged after the first "base_order_" ones.
+  std::vector<RecordFileReader*> readers_;
+  std::vector<const VisitingRecord*> records_;
+  MergeHeap heap_;
+  int base_order_;
+
+  // Newer files which have a record of current url, and all the records of
+  // it in the order to merge.
+  std::vector<int> sources_;
+  std::vector<const VisitingRecord*> ordered_;
+
+  TombstoneReader obsoleted_;
+  time_t cutdown_;
+  time_t since_;
+
+  // Result of merging records of the same url.
+  VisitingRecord merged_;
+
+  // Sources whose records are returned by last Next. They are only moved
+  // forward in next call, so the url can be returned without copying.
+  int pending_;
+  bool advance_base_;
+
+  // Snapshot of the files, which is released by Close. It may be NULL.
+  RecordfileManager::Snapshot* snapshot_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(RecordChangeReader);
+};
+
+#endif // SITEMAPSERVICE_RECORDMERGEREADER_H__
@@ -15,77 +15,71 @@
 
 #include "sitemapservice/recordtable.h"
 #include "sitemapservice/recordfileio.h"
+#include "sitemapservice/recordfileimageio.h"
+#include "sitemapservice/fprintsorter.h"
+#include "sitemapservice/recordfilestat.h"
 #include "sitemapservice/recordfilemanager.h"
+#include "sitemapservice/recordmerger.h"
 #include "common/port.h"
 
-#include <cassert>
 #include <algorithm>
+#include <cassert>
 
-RecordTable::RecordTable(const std::string& base_url, int max_size) {
-  assert(base_url.length() > 0);
-  assert(max_size > 0);
+///////////////////////////////////////////////////////////////////////////////
+// Implementation of RecordTable::Shard
 
-  base_url_ = base_url;
+RecordTable::Shard::Shard(int max_size, EvictionPolicy policy,
+                          const FprintFilter* filter) {
   max_size_ = max_size;
-
-  // set last_gc_cutdown_ to current time.
-  // Beucause all the visiting record added later will have last-visiting-time
-  // equal to that time, which is of course newer than current time,
-  // so initially, the last_gc_cutdown_ could filter no record.
-  time(&last_gc_cutdown_);
-
-  // ensure there is no ending '/',
-  // because url added in AddRecord is like "/path/page1"
-  if (base_url_[base_url_.length() - 1] == '/') {
-    base_url_.erase(base_url_.length() - 1);
-  }
-
-  // remove protocol.
-  if (base_url_.find("http://") == 0) {
-    base_url_.erase(0, 7);
-  } else if (base_url_.find("https://") == 0) {
-    base_url_.erase(0, 8);
-  }
+  filter_ = filter;
+  eviction_policy_ = policy;
+  journal_records_ = 0;
+  checkpoint_needed_ = false;
+  frozen_ = NULL;
+  merge_frozen_ = false;
+  frozen_copies_ = 0;
 }
 
-RecordTable::~RecordTable() {
-  // does nothing
-}
-
-const VisitingRecord* RecordTable::GetRecord(const char* url) const {
-  UrlFprint fingerprint = Url::FingerPrint(url);
-  HashTable::const_iterator itr = records_.find(fingerprint);
-  return itr == records_.end() ? NULL : itr->second;
+RecordTable::Shard::~Shard() {
+  Clear();
 }
 
+int RecordTable::Shard::AddRecord(const char* url, const UrlFprint& fprint,
+                                  int64 content, const time_t& lastmodified,
+                                  const time_t& filewrite, bool* is_new) {
+  VisitingRecord* record = NULL;
+  time_t current_time = time(NULL);
 
-int RecordTable::AddRecord(const char *url, int64 content,
-                           const time_t& lastmodified,
-                           const time_t& filewrite) {
+  HashTable::iterator itr = records_.find(fprint);
 
-  // ignore null url or too long url
-  if (url == NULL) {
-    return 1;
+  // the record is being saved, copy it back to keep its history.
+  if (itr == records_.end() && merge_frozen_) {
+    const Entry* frozen = FindFrozen(fprint);
+    if (frozen != NULL) {
+      Insert(frozen->record, INSERT_KEEP)->is_new = frozen->is_new;
+      itr = records_.find(fprint);
+      ++frozen_copies_;
+    }
   }
 
-  std::string url_str(url);
-  VisitingRecord* record = NULL;
-
-  time_t current_time = time(NULL);
-  UrlFprint fprint = Url::FingerPrint(url);
-
   // no old record with same url is found
-  if (records_.find(fprint) == records_.end()) {
+  if (itr == records_.end()) {
     // only allow max_size_ entries in table.
-    if (static_cast<int>(records_.size()) >= max_size_) {
+    if (Size() >= max_size_) {
       return 1;
     }
 
     // the url first appears in this table,
-    record = new VisitingRecord();
-    records_[fprint] = record;
+    Entry* entry = NewEntry(url, static_cast<int>(strlen(url)), fprint);
+    records_[fprint] = entry;
+
+    // The url being flushed is not added to filter yet.
+    if (entry->is_new && FindFrozen(fprint) != NULL) {
+      entry->is_new = false;
+    }
+    if (is_new != NULL) *is_new = entry->is_new;
 
-    record->update_url(url);
+    record = &entry->record;
     record->first_appear = record->last_access = current_time;
     record->count_access = record->count_change = 1;
     record->last_content = content;
@@ -96,9 +90,13 @@ int RecordTable::AddRecord(const char *url, int64 content,
     } else {
       record->last_change = (lastmodified != -1 ? lastmodified : current_time);
     }
+
+    LinkEntry(entry);
+    MarkDirty(entry);
   } else {
     // update the old entry.
-    record = records_[fprint];
+    Entry* entry = itr->second;
+    record = &entry->record;
     record->last_access = current_time;
     record->count_access += 1;
 
@@ -118,113 +116,774 @@ int RecordTable::AddRecord(const char *url, int64 content,
         record->last_change = filewrite;
       }
     }
+
+    UpdateBucket(entry);
+    MarkDirty(entry);
   }
 
   return 0;
 }
 
-int RecordTable::HeuristicGC() {
-  time_t current_time = time(NULL);
+int RecordTable::Shard::HeuristicGC() {
   int count = 0;
 
   // ensure at least 10% space is availabe
-  while (records_.size() > 0.9 * max_size_) {
+  // Entries are evicted from the lowest bucket, and every evicted entry is
+  // visited exactly once.
+  while (records_.size() > 0.9 * max_size_ && !buckets_.empty()) {
+    RemoveEntry(buckets_.begin()->second.head);
+    ++count;
+  }
 
-    // try to release 25% space at a time.
-    // But it is really an estimated value.
-    time_t offset = (current_time - last_gc_cutdown_) / 4;
+  CompactArena();
+  return count;
+}
 
-    // ensure offset not zero,
-    // otherwise there would be an infinite loop
-    if (offset == 0) offset = 1;
+int RecordTable::Shard::GC(time_t oldest) {
+  int count = 0;
+
+  if (eviction_policy_ == EVICT_OLDEST_ACCESS) {
+    // Only buckets containing records older than "oldest" are visited.
+    int64 last_key = oldest / kAccessBucketWidth;
+    while (!buckets_.empty() && buckets_.begin()->first <= last_key) {
+      BucketMap::iterator bucket = buckets_.begin();
+      bool is_last = bucket->first == last_key;
+
+      Entry* entry = bucket->second.head;
+      while (entry != NULL) {
+        Entry* next = entry->next;
+        if (entry->record.last_access < oldest) {
+          RemoveEntry(entry);
+          ++count;
+        }
+        entry = next;
+      }
+
+      // The last bucket may contain records newer than "oldest".
+      if (is_last) break;
+    }
+  } else {
+    // iterate through the table to remove out-of-date records.
+    std::vector<Entry*> toremove;
+    HashTable::iterator iterator = records_.begin();
+    while (iterator != records_.end()) {
+      if (iterator->second->record.last_access < oldest) {
+        toremove.push_back(iterator->second);
+      }
+      ++iterator;
+    }
 
-    count += GC(last_gc_cutdown_ + offset);
+    for (std::vector<Entry*>::iterator itr = toremove.begin();
+    itr != toremove.end(); ++itr) {
+      RemoveEntry(*itr);
+      ++count;
+    }
   }
 
+  CompactArena();
   return count;
 }
 
-int RecordTable::GC(time_t oldest) {
-  // no record older than oldest exits.
-  if (oldest <= last_gc_cutdown_) {
-    return 0;
+RecordTable::Entry* RecordTable::Shard::Insert(const VisitingRecord& source,
+                                               InsertMode mode) {
+  HashTable::iterator itr = records_.find(source.fingerprint());
+  if (itr != records_.end()) {
+    if (mode == INSERT_KEEP) return NULL;
+    if (mode == INSERT_NEWER &&
+        itr->second->record.last_access > source.last_access) {
+      return NULL;
+    }
+
+    // Removal here is not a real removal, so checkpoint is not affected.
+    bool checkpoint_needed = checkpoint_needed_;
+    RemoveEntry(itr->second);
+    checkpoint_needed_ = checkpoint_needed;
   }
 
-  // iterate through the table to remove out-of-date records.
-  std::vector<UrlFprint> toremove;
-  HashTable::iterator iterator = records_.begin();
-  while (iterator != records_.end()) {
-    if (iterator->second->last_access < oldest) {
-      VisitingRecord* record = iterator->second;
-      delete record;
-      toremove.push_back(iterator->first);
+  Entry* entry = NewEntry(source.url(), source.url_length(),
+                          source.fingerprint());
+  VisitingRecord* record = &entry->record;
+  record->first_appear = source.first_appear;
+  record->last_access = source.last_access;
+  record->last_change = source.last_change;
+  record->count_access = source.count_access;
+  record->count_change = source.count_change;
+  record->last_content = source.last_content;
+  records_[record->fingerprint()] = entry;
+  LinkEntry(entry);
+  return entry;
+}
+
+void RecordTable::Shard::MoveFrom(Shard* another, bool merge) {
+  HashTable::const_iterator itr = another->records_.begin();
+  for (; itr != another->records_.end(); ++itr) {
+    const Entry* source = itr->second;
+    HashTable::iterator old = records_.find(itr->first);
+
+    Entry* entry = NULL;
+    if (merge && old != records_.end()) {
+      entry = old->second;
+      RecordMerger::Merge(entry->record, source->record);
+      UpdateBucket(entry);
+    } else {
+      entry = Insert(source->record, INSERT_REPLACE);
+      entry->is_new = source->is_new;
     }
+
+    if (source->dirty) MarkDirty(entry);
+  }
+
+  journal_records_ += another->journal_records_;
+  checkpoint_needed_ |= another->checkpoint_needed_;
+  another->Clear();
+}
+
+void RecordTable::Shard::Swap(Shard* another) {
+  records_.swap(another->records_);
+  arena_.Swap(&another->arena_);
+  buckets_.swap(another->buckets_);
+  dirty_.swap(another->dirty_);
+  std::swap(journal_records_, another->journal_records_);
+  std::swap(checkpoint_needed_, another->checkpoint_needed_);
+}
+
+const RecordTable::Entry* RecordTable::Shard::FindFrozen(
+    const UrlFprint& fprint) const {
+  if (frozen_ == NULL) return NULL;
+
+  HashTable::const_iterator itr = frozen_->records_.find(fprint);
+  return itr == frozen_->records_.end() ? NULL : itr->second;
+}
+
+int RecordTable::Shard::Size() const {
+  int size = static_cast<int>(records_.size());
+  if (frozen_ != NULL && merge_frozen_) {
+    size += static_cast<int>(frozen_->records_.size()) - frozen_copies_;
+  }
+  return size;
+}
+
+void RecordTable::Shard::MarkDirty(Entry* entry) {
+  if (!entry->dirty) {
+    entry->dirty = true;
+    dirty_.push_back(entry->record.fingerprint());
+  }
+}
+
+void RecordTable::Shard::CollectDirty(std::vector<VisitingRecord>* records) {
+  for (int i = 0, n = static_cast<int>(dirty_.size()); i < n; ++i) {
+    HashTable::iterator itr = records_.find(dirty_[i]);
+    if (itr == records_.end() || !itr->second->dirty) {
+      continue;
+    }
+
+    itr->second->dirty = false;
+    records->push_back(itr->second->record);
+    ++journal_records_;
+  }
+  dirty_.clear();
+}
+
+void RecordTable::Shard::ClearDirty() {
+  for (int i = 0, n = static_cast<int>(dirty_.size()); i < n; ++i) {
+    HashTable::iterator itr = records_.find(dirty_[i]);
+    if (itr != records_.end()) {
+      itr->second->dirty = false;
+    }
+  }
+  dirty_.clear();
+  journal_records_ = 0;
+  checkpoint_needed_ = false;
+}
+
+void RecordTable::Shard::GetRecords(
+    std::vector<const VisitingRecord*>* records) const {
+  HashTable::const_iterator itr = records_.begin();
+  for (; itr != records_.end(); ++itr) {
+    records->push_back(&itr->second->record);
+  }
+}
+
+void RecordTable::Shard::Clear() {
+  HashTable::const_iterator iterator = records_.begin();
+  while (iterator != records_.end()) {
+    DeleteEntry(iterator->second);
     ++iterator;
   }
+  records_.clear();
+  buckets_.clear();
+  arena_.Clear();
+  dirty_.clear();
+  journal_records_ = 0;
+  checkpoint_needed_ = false;
+}
+
+int64 RecordTable::Shard::MemoryUsage() const {
+  // Hash node is estimated as key, value and two pointers.
+  int64 node_size = sizeof(UrlFprint) + sizeof(Entry*) + 2 * sizeof(void*);
+  int64 usage = arena_.allocated_bytes()
+    + records_.size() * (node_size + sizeof(Entry));
+  if (frozen_ != NULL) {
+    usage += frozen_->MemoryUsage();
+  }
+  return usage;
+}
+
+RecordTable::Entry* RecordTable::Shard::NewEntry(const char* url, int length,
+                                                 const UrlFprint& fprint) {
+  Entry* entry = new Entry();
+  entry->record.set_url(arena_.Allocate(url, length));
+  entry->record.set_url_length(length);
+  entry->record.set_fingerprint(fprint);
+  entry->prev = entry->next = NULL;
+  entry->dirty = false;
+  entry->is_new = !filter_->Contains(fprint);
+  return entry;
+}
+
+void RecordTable::Shard::DeleteEntry(Entry* entry) {
+  arena_.Release(entry->record.url_length());
+
+  // The url string is owned by arena, not by the record.
+  entry->record.set_url(NULL);
+  delete entry;
+}
+
+void RecordTable::Shard::RemoveEntry(Entry* entry) {
+  checkpoint_needed_ = true;
+  UnlinkEntry(entry);
+  records_.erase(entry->record.fingerprint());
+  DeleteEntry(entry);
+}
+
+int64 RecordTable::Shard::GetBucketKey(const VisitingRecord& record) const {
+  if (eviction_policy_ == EVICT_OLDEST_ACCESS) {
+    return record.last_access / kAccessBucketWidth;
+  }
 
+  // Base 2 logarithm of access count.
+  int64 key = 0;
+  for (int count = record.count_access; count > 1; count >>= 1) {
+    ++key;
+  }
+  return key;
+}
+
+void RecordTable::Shard::LinkEntry(Entry* entry) {
+  entry->bucket = GetBucketKey(entry->record);
+
+  BucketMap::iterator itr = buckets_.find(entry->bucket);
+  if (itr == buckets_.end()) {
+    Bucket bucket;
+    bucket.head = bucket.tail = entry;
+    entry->prev = entry->next = NULL;
+    buckets_[entry->bucket] = bucket;
+  } else {
+    entry->prev = itr->second.tail;
+    entry->next = NULL;
+    itr->second.tail->next = entry;
+    itr->second.tail = entry;
+  }
+}
+
+void RecordTable::Shard::UnlinkEntry(Entry* entry) {
+  BucketMap::iterator itr = buckets_.find(entry->bucket);
+  assert(itr != buckets_.end());
+
+  if (entry->prev != NULL) {
+    entry->prev->next = entry->next;
+  } else {
+    itr->second.head = entry->next;
+  }
+  if (entry->next != NULL) {
+    entry->next->prev = entry->prev;
+  } else {
+    itr->second.tail = entry->prev;
+  }
+  entry->prev = entry->next = NULL;
+
+  if (itr->second.head == NULL) {
+    buckets_.erase(itr);
+  }
+}
+
+void RecordTable::Shard::UpdateBucket(Entry* entry) {
+  if (GetBucketKey(entry->record) != entry->bucket) {
+    UnlinkEntry(entry);
+    LinkEntry(entry);
+  }
+}
+
+void RecordTable::Shard::CompactArena() {
+  if (arena_.wasted_bytes() * 2 <= arena_.used_bytes()) {
+    return;
+  }
+
+  // Copy all live url strings to a new arena.
+  UrlArena arena;
+  HashTable::iterator itr = records_.begin();
+  for (; itr != records_.end(); ++itr) {
+    VisitingRecord* record = &itr->second->record;
+    record->set_url(arena.Allocate(record->url(), record->url_length()));
+  }
+  arena_.Swap(&arena);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementation of RecordTable
+
+RecordTable::RecordTable(const std::string& base_url, int max_size,
+                         EvictionPolicy policy, int shard_bits) {
+  assert(base_url.length() > 0);
+  assert(max_size > 0);
+  assert(shard_bits >= 0 && shard_bits <= 16);
+
+  base_url_ = base_url;
+  max_size_ = max_size;
+  eviction_policy_ = policy;
+  shard_bits_ = shard_bits;
+
+  // Every shard gets an equal share of the capacity.
+  int shard_count = 1 << shard_bits_;
+  int shard_size = (max_size_ + shard_count - 1) / shard_count;
+  for (int i = 0; i < shard_count; ++i) {
+    shards_.push_back(new Shard(shard_size, policy, &fprint_filter_));
+  }
+
+  // ensure there is no ending '/',
+  // because url added in AddRecord is like "/path/page1"
+  if (base_url_[base_url_.length() - 1] == '/') {
+    base_url_.erase(base_url_.length() - 1);
+  }
+
+  // remove protocol.
+  if (base_url_.find("http://") == 0) {
+    base_url_.erase(0, 7);
+  } else if (base_url_.find("https://") == 0) {
+    base_url_.erase(0, 8);
+  }
+}
+
+RecordTable::~RecordTable() {
+  for (int i = 0; i < static_cast<int>(shards_.size()); ++i) {
+    delete shards_[i];
+  }
+  shards_.clear();
+}
+
+bool RecordTable::ParseEvictionPolicy(const std::string& value,
+                                      EvictionPolicy* policy) {
+  if (value == "oldest_access") {
+    *policy = EVICT_OLDEST_ACCESS;
+  } else if (value == "least_accessed") {
+    *policy = EVICT_LEAST_ACCESSED;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+int RecordTable::Size() const {
+  int size = 0;
+  for (int i = 0; i < static_cast<int>(shards_.size()); ++i) {
+    shards_[i]->lock_.Enter(true);
+    size += shards_[i]->Size();
+    shards_[i]->lock_.Leave();
+  }
+  return size;
+}
+
+bool RecordTable::IsFull() const {
+  bool is_full = false;
+  for (int i = 0; i < static_cast<int>(shards_.size()) && !is_full; ++i) {
+    shards_[i]->lock_.Enter(true);
+    is_full = shards_[i]->Size() >= shards_[i]->max_size_;
+    shards_[i]->lock_.Leave();
+  }
+  return is_full;
+}
+
+int64 RecordTable::MemoryUsage() const {
+  int64 usage = 0;
+  for (int i = 0; i < static_cast<int>(shards_.size()); ++i) {
+    shards_[i]->lock_.Enter(true);
+    usage += shards_[i]->MemoryUsage();
+    shards_[i]->lock_.Leave();
+  }
+  usage += fprint_filter_.MemoryUsage();
+  return usage;
+}
+
+bool RecordTable::GetRecord(const char* url, VisitingRecord* record,
+                            bool* is_new) const {
+  UrlFprint fingerprint = Url::FingerPrint(url);
+  Shard* shard = GetShard(fingerprint);
+
+  shard->lock_.Enter(true);
+  const Entry* entry = NULL;
+  HashTable::const_iterator itr = shard->records_.find(fingerprint);
+  if (itr != shard->records_.end()) {
+    entry = itr->second;
+  } else {
+    // The record may be being saved.
+    entry = shard->FindFrozen(fingerprint);
+  }
+
+  bool found = entry != NULL;
+  if (found) {
+    *record = entry->record;
+    if (is_new != NULL) *is_new = entry->is_new;
+  }
+  shard->lock_.Leave();
+
+  return found;
+}
+
+int RecordTable::AddRecord(const char *url, int64 content,
+                           const time_t& lastmodified,
+                           const time_t& filewrite, bool* is_new) {
+  if (is_new != NULL) *is_new = false;
+
+  // ignore null url or too long url
+  if (url == NULL) {
+    return 1;
+  }
+
+  UrlFprint fprint = Url::FingerPrint(url);
+  Shard* shard = GetShard(fprint);
+
+  shard->lock_.Enter(true);
+  int result = shard->AddRecord(url, fprint, content, lastmodified, filewrite,
+                                is_new);
+  shard->lock_.Leave();
+
+  return result;
+}
+
+int RecordTable::HeuristicGC() {
+  save_lock_.Enter(true);
   int count = 0;
-  for (std::vector<UrlFprint>::iterator itr = toremove.begin();
-  itr != toremove.end(); ++itr) {
-    records_.erase(*itr);
-    ++count;
+  for (int i = 0; i < static_cast<int>(shards_.size()); ++i) {
+    shards_[i]->lock_.Enter(true);
+    count += shards_[i]->HeuristicGC();
+    shards_[i]->lock_.Leave();
   }
+  save_lock_.Leave();
+  return count;
+}
 
-  last_gc_cutdown_ = oldest;
+int RecordTable::GC(time_t oldest) {
+  save_lock_.Enter(true);
+  int count = 0;
+  for (int i = 0; i < static_cast<int>(shards_.size()); ++i) {
+    shards_[i]->lock_.Enter(true);
+    count += shards_[i]->GC(oldest);
+    shards_[i]->lock_.Leave();
+  }
+  save_lock_.Leave();
   return count;
 }
 
-int RecordTable::Save(const char *path) const {
+void RecordTable::LockAll() const {
+  for (int i = 0; i < static_cast<int>(shards_.size()); ++i) {
+    shards_[i]->lock_.Enter(true);
+  }
+}
+
+void RecordTable::UnlockAll() const {
+  for (int i = static_cast<int>(shards_.size()) - 1; i >= 0; --i) {
+    shards_[i]->lock_.Leave();
+  }
+}
+
+void RecordTable::Freeze(bool merge, std::vector<Shard*>* frozen) {
+  for (int i = 0; i < static_cast<int>(shards_.size()); ++i) {
+    Shard* shard = new Shard(shards_[i]->max_size_, eviction_policy_,
+                             &fprint_filter_);
+
+    // Only pointers are swapped, so the shard is locked for a short time.
+    shards_[i]->lock_.Enter(true);
+    shards_[i]->Swap(shard);
+    shards_[i]->frozen_ = shard;
+    shards_[i]->merge_frozen_ = merge;
+    shards_[i]->frozen_copies_ = 0;
+    shards_[i]->lock_.Leave();
+
+    frozen->push_back(shard);
+  }
+}
+
+void RecordTable::Thaw(const std::vector<Shard*>& frozen, ThawMode mode) {
+  for (int i = 0; i < static_cast<int>(shards_.size()); ++i) {
+    Shard* shard = shards_[i];
+    shard->lock_.Enter(true);
+    if (mode != THAW_FLUSHED) {
+      if (mode == THAW_CHECKPOINTED) {
+        frozen[i]->ClearDirty();
+      }
+
+      // Records added during saving are usually much fewer, so they are
+      // moved to the frozen shard, which is swapped back then.
+      frozen[i]->MoveFrom(shard, mode == THAW_FAILED);
+      shard->Swap(frozen[i]);
+    }
+    shard->frozen_ = NULL;
+    shard->merge_frozen_ = false;
+    shard->frozen_copies_ = 0;
+    shard->lock_.Leave();
+
+    delete frozen[i];
+  }
+}
+
+int RecordTable::WriteShards(const std::vector<Shard*>& shards,
+                             const char *path) {
   // put all records into a vector and sort them by url finger print
-  std::vector<std::pair<UrlFprint, VisitingRecord*> > records(records_.begin(),
-                                                              records_.end());
-  std::sort(records.begin(), records.end());
+  std::vector<const VisitingRecord*> records;
+  for (int i = 0; i < static_cast<int>(shards.size()); ++i) {
+    shards[i]->GetRecords(&records);
+  }
+  FprintSorter sorter(0);
+  sorter.Sort(&records);
+
+  // Write the sorted records as an image, which can be loaded quickly.
+  int result = RecordImage::Write(path, records);
+  if (result != 0) {
+    return result;
+  }
+
+  // Statistics is saved with the image, so it goes to the temp file, and
+  // merges can be planned without reading temp files.
+  RecordFileStat stat;
+  for (int i = 0; i < static_cast<int>(records.size()); ++i) {
+    stat.AddRecord(*records[i]);
+  }
+  if (!stat.Save(path)) {
+    // A stale statistics file must not go with the new image.
+    remove(RecordFileStat::GetStatPath(path).c_str());
+  }
+  return 0;
+}
 
-  // Write the sorted records to file.
-  RecordFileWriter* writer = RecordFileIOFactory::CreateWriter(path);
+int RecordTable::Save(const char *path) {
+  save_lock_.Enter(true);
+  std::vector<Shard*> frozen;
+  Freeze(true, &frozen);
+  int result = WriteShards(frozen, path);
+  Thaw(frozen, THAW_SAVED);
+  save_lock_.Leave();
+  return result;
+}
+
+int RecordTable::Checkpoint(const char *path) {
+  save_lock_.Enter(true);
+  std::vector<Shard*> frozen;
+  Freeze(true, &frozen);
+  int result = WriteShards(frozen, path);
+  Thaw(frozen, result == 0 ? THAW_CHECKPOINTED : THAW_SAVED);
+  save_lock_.Leave();
+  return result;
+}
+
+int RecordTable::SaveJournal(const char *path) {
+  save_lock_.Enter(true);
+  RecordFileWriter* writer = RecordFileIOFactory::CreateAppender(path);
   if (writer == NULL) {
+    save_lock_.Leave();
     return 1;
   }
-  for (int i = 0, n = static_cast<int>(records.size()); i < n; ++i) {
-    writer->Write(*records[i].second);
+
+  // Dirty records are copied out shard by shard, and written without lock.
+  int result = 0;
+  std::vector<VisitingRecord> records;
+  for (int i = 0; i < static_cast<int>(shards_.size()); ++i) {
+    records.clear();
+    shards_[i]->lock_.Enter(true);
+    shards_[i]->CollectDirty(&records);
+    shards_[i]->lock_.Leave();
+
+    for (int j = 0; j < static_cast<int>(records.size()); ++j) {
+      if (writer->Write(records[j]) != 0) {
+        result = 1;
+        break;
+      }
+    }
+
+    // Records not written to journal can only be saved by a checkpoint.
+    if (result != 0) {
+      shards_[i]->lock_.Enter(true);
+      shards_[i]->checkpoint_needed_ = true;
+      shards_[i]->lock_.Leave();
+    }
   }
 
   delete writer;
+  save_lock_.Leave();
+  return result;
+}
+
+bool RecordTable::NeedCheckpoint() const {
+  int size = 0, journal_records = 0;
+  bool checkpoint_needed = false;
+  for (int i = 0; i < static_cast<int>(shards_.size()); ++i) {
+    shards_[i]->lock_.Enter(true);
+    size += shards_[i]->Size();
+    journal_records += shards_[i]->journal_records_
+      + static_cast<int>(shards_[i]->dirty_.size());
+    checkpoint_needed |= shards_[i]->checkpoint_needed_;
+    shards_[i]->lock_.Leave();
+  }
+
+  return checkpoint_needed || journal_records * kJournalRatio > size;
+}
+
+int RecordTable::Flush(const char *path) {
+  save_lock_.Enter(true);
+  std::vector<Shard*> frozen;
+  Freeze(false, &frozen);
+  int result = WriteShards(frozen, path);
+  if (result != 0) {
+    Thaw(frozen, THAW_FAILED);
+    save_lock_.Leave();
+    return result;
+  }
+
+  // Flushed urls are known from now on.
+  std::vector<UrlFprint> fprints;
+  for (int i = 0; i < static_cast<int>(frozen.size()); ++i) {
+    HashTable::const_iterator itr = frozen[i]->records_.begin();
+    for (; itr != frozen[i]->records_.end(); ++itr) {
+      fprints.push_back(itr->first);
+    }
+  }
+  AddToFprintFilterLocked(fprints);
+
+  Thaw(frozen, THAW_FLUSHED);
+  save_lock_.Leave();
   return 0;
 }
 
+void RecordTable::AddToFprintFilter(const std::vector<UrlFprint>& fprints) {
+  save_lock_.Enter(true);
+  AddToFprintFilterLocked(fprints);
+  save_lock_.Leave();
+}
+
+void RecordTable::AddToFprintFilterLocked(
+  const std::vector<UrlFprint>& fprints) {
+  const int kBatchSize = 4096;
+  for (int i = 0; i < static_cast<int>(fprints.size()); i += kBatchSize) {
+    int end = std::min(i + kBatchSize, static_cast<int>(fprints.size()));
+    LockAll();
+    for (int j = i; j < end; ++j) {
+      fprint_filter_.Add(fprints[j]);
+    }
+    UnlockAll();
+  }
+}
+
+void RecordTable::SwapFprintFilter(FprintFilter* filter) {
+  save_lock_.Enter(true);
+  LockAll();
+  fprint_filter_.Swap(filter);
+  for (int i = 0; i < static_cast<int>(shards_.size()); ++i) {
+    HashTable::iterator itr = shards_[i]->records_.begin();
+    for (; itr != shards_[i]->records_.end(); ++itr) {
+      itr->second->is_new = !fprint_filter_.Contains(itr->first);
+    }
+  }
+  UnlockAll();
+  save_lock_.Leave();
+}
+
+bool RecordTable::SaveFprintFilter(const char* path) {
+  // The filter is only modified with save_lock_ held.
+  save_lock_.Enter(true);
+  bool result = fprint_filter_.Save(path);
+  save_lock_.Leave();
+  return result;
+}
+
 int RecordTable::Load(const char *path) {
+  save_lock_.Enter(true);
+
   // clear all the old records
-  Clear();
+  ClearShards();
+
+  // Try to load the file as an image first.
+  int result = 0;
+  RecordImage image;
+  if (image.Open(path, RecordImage::VALIDATE_ALL)) {
+    LoadImage(image);
+  } else {
+    // Duplicated record in file replaces the old one.
+    result = ReadFile(path, INSERT_REPLACE);
+  }
 
+  save_lock_.Leave();
+  return result;
+}
+
+void RecordTable::LoadImage(const RecordImage& image) {
+  LockAll();
+
+  // Url strings are used in place, and copied into the arena by Insert.
+  VisitingRecord record;
+  for (int64 i = 0, n = image.record_count(); i < n; ++i) {
+    const RecordImageEntry& entry = image.entry(i);
+    RecordImage::CopyEntry(entry, &record);
+    record.set_url(const_cast<char*>(image.url(entry)));
+    GetShard(entry.fingerprint)->Insert(record, INSERT_REPLACE);
+  }
+
+  // The url is not owned by the record.
+  record.set_url(NULL);
+  UnlockAll();
+}
+
+int RecordTable::Restore(const char *path) {
+  save_lock_.Enter(true);
+  int result = ReadFile(path, INSERT_KEEP);
+  save_lock_.Leave();
+  return result;
+}
+
+int RecordTable::Replay(const char *path) {
+  save_lock_.Enter(true);
+  int result = ReadFile(path, INSERT_NEWER);
+  save_lock_.Leave();
+  return result;
+}
+
+int RecordTable::ReadFile(const char *path, InsertMode mode) {
   RecordFileReader* reader = RecordFileIOFactory::CreateReader(path);
   if (reader == NULL) {
     return 1;
   }
 
   // read record from file
-  VisitingRecord* record = new VisitingRecord();
-  while (reader->Read(record) == 0) {
-    HashTable::iterator itr = records_.find(record->fingerprint());
-
-    // to avoid duplicated record in file
-    if (itr != records_.end()) {
-      delete itr->second;
-    }
-
-    records_[record->fingerprint()] = record;
-    record = new VisitingRecord();
+  VisitingRecord record;
+  while (reader->Read(&record) == 0) {
+    Shard* shard = GetShard(record.fingerprint());
+    shard->lock_.Enter(true);
+    shard->Insert(record, mode);
+    shard->lock_.Leave();
   }
-  delete record;
 
   delete reader;
   return 0;
 }
 
 void RecordTable::Clear() {
-  HashTable::const_iterator iterator = records_.begin();
-  while (iterator != records_.end()) {
-    delete iterator->second;
-    ++iterator;
+  save_lock_.Enter(true);
+  ClearShards();
+  save_lock_.Leave();
+}
+
+void RecordTable::ClearShards() {
+  for (int i = 0; i < static_cast<int>(shards_.size()); ++i) {
+    shards_[i]->lock_.Enter(true);
+    shards_[i]->Clear();
+    shards_[i]->lock_.Leave();
   }
-  records_.clear();
 }
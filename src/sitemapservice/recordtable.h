@@ -19,59 +19,293 @@
 // provides methods to automatically remove out-of-date records, as well as
 // java style iterator. User can also load/save records from/to a file through
 // methods exposed by this class.
+// Url strings of the records are kept in an UrlArena owned by this table, so
+// they are released in bulk when the table is cleared.
+// Records are also linked into coarse eviction buckets (by last access time,
+// or by access count, according to the eviction policy). GC operations only
+// walk the buckets being dropped instead of the whole table.
 //
-// Note, this class is not thread safe.
+// Records changed since the last checkpoint are marked as dirty, so they can
+// be appended to a journal file instead of rewriting the whole table. A
+// checkpoint (a full save) is only needed when the journal grows too large.
+//
+// The table is split into 2^k shards by the url finger print. Every shard has
+// its own lock and its own share of the capacity, so records can be added
+// from multiple threads concurrently.
+//
+// Saving doesn't block adding of records. Records of every shard are swapped
+// out to a frozen shard under the shard lock, and the frozen shards are
+// sorted and written without any shard lock. Records added meanwhile go to
+// the live shards, and are merged with the frozen ones after saving.
+//
+// All methods are thread safe, except the Iterator, which should not be used
+// while the table is being modified.
 
 #ifndef SITEMAPSERVICE_RECORDTABLE_H__
 #define SITEMAPSERVICE_RECORDTABLE_H__
 
+#include <map>
 #include <string>
+#include <vector>
 #include "common/basictypes.h"
 #include "common/url.h"
 #include "common/hashmap.h"
+#include "common/criticalsection.h"
 #include "sitemapservice/visitingrecord.h"
+#include "sitemapservice/urlarena.h"
+#include "sitemapservice/fprintfilter.h"
 
+class RecordFileWriter;
+class RecordImage;
 
 class RecordTable {
+  // A visiting record together with its links in the eviction bucket.
+  struct Entry {
+    VisitingRecord record;
+
+    // Key of the eviction bucket containing this entry.
+    int64 bucket;
+
+    // Neighbours in the eviction bucket.
+    Entry* prev;
+    Entry* next;
+
+    // Whether the record is changed since it is written to file last time.
+    bool dirty;
+
+    // Whether the url is unknown by the site when the entry is created.
+    bool is_new;
+  };
+
+  // Eviction bucket, which is a double linked list of entries.
+  // Entries are appended to tail, and evicted from head.
+  struct Bucket {
+    Entry* head;
+    Entry* tail;
+  };
+
   // Data structure used to hold visiting records
-  typedef HashMap<UrlFprint, VisitingRecord*>::Type HashTable;
+  typedef HashMap<UrlFprint, Entry*>::Type HashTable;
+
+  // Eviction buckets ordered by key. Lower key is evicted first.
+  typedef std::map<int64, Bucket> BucketMap;
 
  public:
+  // Policy to choose records to evict when the table is full.
+  enum EvictionPolicy {
+    // Records with oldest last_access time are evicted first.
+    EVICT_OLDEST_ACCESS,
+
+    // Records with least count_access value are evicted first.
+    EVICT_LEAST_ACCESSED
+  };
+
+  // Width (in seconds) of the last_access range covered by one bucket, when
+  // EVICT_OLDEST_ACCESS policy is used.
+  static const int kAccessBucketWidth = 300;
+
+  // Default value of k, where 2^k is the number of shards.
+  static const int kDefaultShardBits = 4;
+
+  // A checkpoint is needed when records in journal exceed 1/kJournalRatio of
+  // the records in table.
+  static const int kJournalRatio = 2;
+
   // This is the threshold for change in content length.
   // If the difference in content length between two subsequent visits exceeds
   // this threshold, the page will be treated as having been updated.
   static const int64 kChangeLengthThreshold = 100;
 
+ private:
+  // How to insert a record whose finger print is already in the table.
+  enum InsertMode {
+    INSERT_REPLACE,  // The old record is replaced.
+    INSERT_KEEP,     // The old record is kept.
+    INSERT_NEWER     // The record with newer last_access is kept.
+  };
+
+  // What to do with the frozen records after they are saved.
+  enum ThawMode {
+    THAW_SAVED,         // Frozen records are saved by Save.
+    THAW_CHECKPOINTED,  // Frozen records are saved by Checkpoint.
+    THAW_FLUSHED,       // Frozen records are flushed, so they are dropped.
+    THAW_FAILED         // Failed to flush, and frozen records are merged.
+  };
+
+  // A shard of the table.
+  // It is not thread safe, and lock_ should be held before accessing it.
+  class Shard {
+   public:
+    // "filter" is the table's finger print filter used to determine whether
+    // a new entry is a new url.
+    Shard(int max_size, EvictionPolicy policy, const FprintFilter* filter);
+    ~Shard();
+
+    // See the corresponding methods of RecordTable.
+    int AddRecord(const char* url, const UrlFprint& fprint, int64 content,
+                  const time_t& lastmodified, const time_t& filewrite,
+                  bool* is_new);
+    int GC(time_t oldest);
+    int HeuristicGC();
+    void Clear();
+    int64 MemoryUsage() const;
+
+    // Returns number of records counted against max_size_.
+    // Frozen records are counted if they are merged back after saving.
+    int Size() const;
+
+    // Insert a copy of given record. The inserted record is not dirty.
+    // Returns the inserted entry, or NULL if the old record is kept.
+    Entry* Insert(const VisitingRecord& record, InsertMode mode);
+
+    // Move all entries of another shard into this one. An entry replaces the
+    // one with same finger print in this shard, or is merged with it by
+    // RecordMerger if "merge" is true. Dirty flags are kept.
+    void MoveFrom(Shard* another, bool merge);
+
+    // Swap all records and journal state with another shard.
+    void Swap(Shard* another);
+
+    // Returns the frozen entry for given finger print, or NULL.
+    const Entry* FindFrozen(const UrlFprint& fprint) const;
+
+    // Mark an entry as dirty.
+    void MarkDirty(Entry* entry);
+
+    // Append copies of all dirty records to the vector, and clear their
+    // dirty flags. The records are counted as written to journal.
+    void CollectDirty(std::vector<VisitingRecord>* records);
+
+    // Clear dirty flags and journal state, after the shard is saved.
+    void ClearDirty();
+
+    // Append all records in this shard to the vector.
+    void GetRecords(std::vector<const VisitingRecord*>* records) const;
+
+    // Create a new entry in this shard, whose url is stored in arena_.
+    // The entry is not linked into any bucket.
+    Entry* NewEntry(const char* url, int length, const UrlFprint& fprint);
+
+    // Delete an entry created by NewEntry.
+    // The entry should be already unlinked from its bucket.
+    void DeleteEntry(Entry* entry);
+
+    // Remove an entry from records_ and its bucket, and delete it.
+    void RemoveEntry(Entry* entry);
+
+    // Calculate the bucket key for given record according to eviction policy.
+    int64 GetBucketKey(const VisitingRecord& record) const;
+
+    // Link an entry to the tail of the bucket for its bucket key.
+    void LinkEntry(Entry* entry);
+
+    // Unlink an entry from its current bucket.
+    void UnlinkEntry(Entry* entry);
+
+    // Move an entry to a new bucket if its bucket key is changed.
+    void UpdateBucket(Entry* entry);
+
+    // Rebuild arena_ to drop the url strings of removed records.
+    // It only happens when more than half of the arena is wasted.
+    void CompactArena();
+
+    // Holds the visiting records.
+    HashTable records_;
+
+    // Holds the url strings of all visiting records in records_.
+    UrlArena arena_;
+
+    // Eviction buckets for all entries in records_.
+    BucketMap buckets_;
+
+    // Max size of this->records_ table.
+    int max_size_;
+
+    // Policy used to choose evicted records.
+    EvictionPolicy eviction_policy_;
+
+    // Finger prints of dirty entries.
+    // Entries removed after being marked are skipped when writing journal.
+    std::vector<UrlFprint> dirty_;
+
+    // Number of records written to journal since last checkpoint.
+    int journal_records_;
+
+    // Whether records are removed since last checkpoint.
+    // Removal is not journaled, so a checkpoint is needed in this case.
+    bool checkpoint_needed_;
+
+    // The finger print filter owned by table.
+    const FprintFilter* filter_;
+
+    // Records swapped out from this shard while they are being saved.
+    // It is not modified until the records are saved, so it can be read
+    // without lock_ by the saving thread. NULL if the shard is not frozen.
+    Shard* frozen_;
+
+    // Whether the frozen records are merged back to this shard after saving.
+    // A record being saved is copied back when it is updated, so its history
+    // is kept.
+    bool merge_frozen_;
+
+    // Number of frozen records copied back to this shard, which should not
+    // be counted twice.
+    int frozen_copies_;
+
+    // Lock for this shard.
+    CriticalSection lock_;
+
+    DISALLOW_EVIL_CONSTRUCTORS(Shard);
+  };
+
+ public:
   // A java-style iterator class used to iterate all records in the table.
   // It is used to hide internal implementation details.
   class Iterator {
    public:
-    explicit Iterator(const HashTable& hashtable) 
-        : hashtable_(hashtable) {
-      iterator_ = hashtable_.begin();
+    explicit Iterator(const std::vector<Shard*>& shards)
+        : shards_(shards) {
+      shard_ = 0;
+      iterator_ = shards_[0]->records_.begin();
+      SkipEmptyShards();
     }
 
     bool HasNext() const {
-      return iterator_ != hashtable_.end();
+      return shard_ < static_cast<int>(shards_.size());
     }
 
     const VisitingRecord& Next() {
-      const VisitingRecord& result = *(iterator_->second);
+      const VisitingRecord& result = iterator_->second->record;
       ++iterator_;
+      SkipEmptyShards();
       return result;
     }
 
    private:
+    // Move to the next shard if current shard is exhausted.
+    void SkipEmptyShards() {
+      while (iterator_ == shards_[shard_]->records_.end()) {
+        if (++shard_ == static_cast<int>(shards_.size())) break;
+        iterator_ = shards_[shard_]->records_.begin();
+      }
+    }
+
     HashTable::const_iterator iterator_;
 
-    // The hash table to be iterated.
-    const HashTable& hashtable_;
+    // Index of the shard being iterated.
+    int shard_;
+
+    // The shards to be iterated.
+    const std::vector<Shard*>& shards_;
 
     DISALLOW_EVIL_CONSTRUCTORS(Iterator);
   };
 
   // Constructor. Simply store the params to name-like data members.
-  RecordTable(const std::string& base_url, int max_size);
+  // "shard_bits" is the k, where 2^k shards are created.
+  RecordTable(const std::string& base_url, int max_size,
+              EvictionPolicy policy = EVICT_OLDEST_ACCESS,
+              int shard_bits = kDefaultShardBits);
 
   ~RecordTable();
 
@@ -81,12 +315,27 @@ class RecordTable {
   // Returns the capacity of this record table.
   int max_size() const {return max_size_;}
 
+  // Returns the eviction policy used by HeuristicGC.
+  EvictionPolicy eviction_policy() const { return eviction_policy_; }
+
+  // Parse eviction policy from its setting value, which is "oldest_access" or
+  // "least_accessed". Returns false for unknown value.
+  static bool ParseEvictionPolicy(const std::string& value,
+                                  EvictionPolicy* policy);
+
   // Returns number of records contained in this table.
-  int Size() const { return (int) records_.size(); }
+  int Size() const;
+
+  // Returns whether any shard of this table is full.
+  // A full shard rejects new urls, so the table should be flushed.
+  bool IsFull() const;
 
   // Clears all visiting records contained in this table.
   void Clear();
 
+  // Returns approximate number of bytes used by this table.
+  int64 MemoryUsage() const;
+
   // Adds a url visiting record.
   // lastmodified represents "Last-Modified" field of the HTTP header.
   // filewrite is last write attribute of the static page file.
@@ -105,62 +354,165 @@ class RecordTable {
   // time will be used. Otherwise, contentlength will be used to compare to old
   // contentlength, if the difference exceeds kChangeThreshold, the current time
   // is used as last_change time.
+  //
+  // If "is_new" is not NULL, it returns whether a new entry is created for an
+  // url unknown by the finger print filter.
   int AddRecord(const char* url, int64 contentlength,
-                const time_t& lastmodified, const time_t& filewrite);
+                const time_t& lastmodified, const time_t& filewrite,
+                bool* is_new = NULL);
 
-  // Get the visiting record for the specified url.
-  // or null if there is no visiting record for the url.
-  // Note, the returned pointer is managed by this table.
-  const VisitingRecord* GetRecord(const char* url) const;
+  // Get a copy of the visiting record for the specified url.
+  // If "is_new" is not NULL, it returns whether the url is unknown by the
+  // finger print filter when the record is created.
+  // Returns false if there is no visiting record for the url.
+  bool GetRecord(const char* url, VisitingRecord* record,
+                 bool* is_new = NULL) const;
 
   // Collects gabarge, and removes out of date visiting records.
   // All the visiting records, for which the last visit time is older than given
   // value, will be removed from this table.
+  // With EVICT_OLDEST_ACCESS policy, only the buckets older than given value
+  // are visited. Otherwise, the whole table is scanned.
   // Returns how many records are actually removed during this GC operation.
   int GC(time_t oldest);
 
-  // Do GC operation heuristicly. (See GC(time_t))
-  // The internal implementation "guesses" oldest param for GC(time_t oldest)
-  // automatically.
-  // After this method is invoked, at least 10% space will be availabe for use.
-  // But there is no upper bound.
+  // Do GC operation according to eviction policy.
+  // Records are evicted bucket by bucket, starting from the lowest bucket,
+  // until at least 10% space is availabe for use in every shard.
   // Returns how many records are actually removed during this GC oepration.
   int HeuristicGC();
 
   // Saves this table to a file.
   // Records in the result file will be in ascending order by the record's
-  // finger print value.
+  // finger print value. The file is written in image format, see
+  // recordfileimageio.h.
+  // Shards are frozen instead of locked during saving, so records can still
+  // be added. Records added during saving are not in the file.
+  // Returns 0 if successful, or a non-zero error code.
+  int Save(const char* path);
+
+  // Saves this table to a file, and clears it if saving is successful.
+  // Records are swapped out before saving, so records added during saving
+  // are kept in table, and they are merged back if saving fails.
+  // Finger prints of the saved records are added to the filter, as they are
+  // known by the site from now on.
+  // Returns 0 if successful, or a non-zero error code.
+  int Flush(const char* path);
+
+  // Saves this table to a file as a checkpoint.
+  // It is same as Save, except that all records are not dirty any more, and
+  // the journal (if any) should be discarded by caller after this call.
   // Returns 0 if successful, or a non-zero error code.
-  int Save(const char* path) const;
+  int Checkpoint(const char* path);
+
+  // Appends records changed since last checkpoint or last journal to the
+  // journal file, which is created if not exist.
+  // Returns 0 if successful, or a non-zero error code.
+  int SaveJournal(const char* path);
+
+  // Returns whether the journal has grown too large, or records are removed
+  // since last checkpoint, so Checkpoint should be called instead of
+  // SaveJournal.
+  bool NeedCheckpoint() const;
 
   // Loads visiting records from a file.
+  // An image file written by Save is mapped and used in place. Other files
+  // are read record by record.
   // NOTE, all the existing records will be cleared.
   // Returns 0 if successful, or a non-zero error code.
   int Load(const char* path);
 
+  // Adds visiting records in a file back to this table, which is used to
+  // recover from a failed Flush.
+  // Records already in this table are newer, so they are kept.
+  // Returns 0 if successful, or a non-zero error code.
+  int Restore(const char* path);
+
+  // Replays a journal file over the loaded checkpoint.
+  // A journaled record only replaces the one with older last_access, so it is
+  // safe to replay a journal which is already merged into the checkpoint.
+  // Returns 0 if successful, or a non-zero error code.
+  int Replay(const char* path);
+
+  // Replaces the finger print filter with given one, whose content is
+  // swapped out. The is_new flags of all records are recalculated.
+  void SwapFprintFilter(FprintFilter* filter);
+
+  // Adds finger prints to the filter, like the ones of new database files.
+  void AddToFprintFilter(const std::vector<UrlFprint>& fprints);
+
+  // Saves the finger print filter to a file.
+  bool SaveFprintFilter(const char* path);
+
   // Gets an iterator to walk through this table.
   // NOTE, the returned pointer should be deleted by caller after use.
-  Iterator* GetIterator() const { return new Iterator(records_); }
+  Iterator* GetIterator() const { return new Iterator(shards_); }
 
  private:
-  // Holds the visiting records.
-  HashTable records_;
+  // Get the shard containing given finger print.
+  // Finger print is mixed before taking the highest bits, because the highest
+  // bits of similar urls are often the same.
+  Shard* GetShard(const UrlFprint& fprint) const {
+    if (shard_bits_ == 0) return shards_[0];
+    UrlFprint mixed = fprint * 0x9E3779B97F4A7C15ULL;
+    return shards_[static_cast<int>(mixed >> (64 - shard_bits_))];
+  }
+
+  // Lock or unlock all the shards in index order.
+  void LockAll() const;
+  void UnlockAll() const;
+
+  // Swap out records of every shard to a frozen shard, which is returned in
+  // "frozen". See Shard::merge_frozen_ for "merge".
+  void Freeze(bool merge, std::vector<Shard*>* frozen);
 
-  // Represents max size of this->records_ table.
+  // Release the frozen shards after they are saved. See ThawMode.
+  void Thaw(const std::vector<Shard*>& frozen, ThawMode mode);
+
+  // Write all records in given shards to a file.
+  // The shards should not be modified during writing.
+  static int WriteShards(const std::vector<Shard*>& shards, const char* path);
+
+  // Clears all shards. save_lock_ should be held.
+  void ClearShards();
+
+  // Adds finger prints to the filter in small batches, so records can be
+  // added between batches. save_lock_ should be held.
+  void AddToFprintFilterLocked(const std::vector<UrlFprint>& fprints);
+
+  // Inserts all records in a mapped image into this table.
+  void LoadImage(const RecordImage& image);
+
+  // Reads records from file into this table. See Shard::Insert.
+  int ReadFile(const char* path, InsertMode mode);
+
+  // The shards, indexed by mixed finger print.
+  std::vector<Shard*> shards_;
+
+  // The k, where 2^k is the number of shards.
+  int shard_bits_;
+
+  // Represents max size of this table.
   int max_size_;
 
   // Represents the common prefix for all visited url in this record table.
   // Usually, it would be a host name, like "http://www.example.org"
   std::string base_url_;
 
-  // Represents the cutdown time in last GC operation, including both
-  // GC(time_t) and SupressGC() methods.
-  // All visiting records older than this value were removed from this table
-  // in last GC operation.
-  time_t last_gc_cutdown_;
+  // Policy used to choose evicted records.
+  EvictionPolicy eviction_policy_;
+
+  // Filter of all urls known by the site.
+  // It is read with any shard lock held, and modified with save_lock_ and
+  // all shard locks held.
+  FprintFilter fprint_filter_;
+
+  // Serializes saving, loading and other operations on the whole table, so
+  // only one set of frozen shards exists at a time.
+  // It is always acquired before any shard lock.
+  CriticalSection save_lock_;
 
   DISALLOW_EVIL_CONSTRUCTORS(RecordTable);
 };
 
 #endif // SITEMAPSERVICE_RECORDTABLE_H__
-
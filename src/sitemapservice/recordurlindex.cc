@@ -0,0 +1,599 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "sitemapservice/recordurlindex.h"
+
+#include <algorithm>
+#include <queue>
+
+#include "common/logger.h"
+#include "common/fileutil.h"
+#include "common/sequentialwriter.h"
+
+namespace {
+
+// Append an unsigned varint to "buffer".
+void PutVarint(uint64 value, std::string* buffer) {
+  while (value >= 0x80) {
+    buffer->push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  buffer->push_back(static_cast<char>(value));
+}
+
+// Read an unsigned varint from "*data", which is moved forward.
+// Returns false if there is no valid varint before "end".
+bool GetVarint(const char** data, const char* end, uint64* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (*data >= end) return false;
+
+    uint64 byte = static_cast<unsigned char>(*((*data)++));
+    *value |= (byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) return true;
+  }
+  return false;
+}
+
+// Read a url encoded as (shared length, suffix length, suffix) after
+// "previous" from "*data", which is moved forward.
+bool GetUrl(const char** data, const char* end, const std::string& previous,
+            std::string* url) {
+  uint64 shared, length;
+  if (!GetVarint(data, end, &shared) || !GetVarint(data, end, &length)
+      || shared > previous.size()
+      || length > static_cast<uint64>(end - *data)) {
+    return false;
+  }
+
+  url->assign(previous, 0, static_cast<size_t>(shared));
+  url->append(*data, static_cast<size_t>(length));
+  *data += length;
+  return true;
+}
+
+// Front codes sorted urls to an index file.
+class UrlEncoder {
+ public:
+  UrlEncoder() : url_count_(0), block_count_(0), data_start_(0), added_(0) {}
+
+  bool Open(const std::string& path, int64 url_count) {
+    path_ = path;
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == NULL) {
+      Logger::Log(EVENT_ERROR, "Failed to open [%s] to write.", path.c_str());
+      return false;
+    }
+    writer_.Attach(file);
+
+    // Header and offsets are reserved, and written after the blocks.
+    url_count_ = url_count;
+    block_count_ = (url_count + RecordUrlIndex::kBlockUrls - 1)
+      / RecordUrlIndex::kBlockUrls;
+    offsets_.assign(static_cast<size_t>(block_count_), 0);
+
+    RecordUrlIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    data_start_ = sizeof(header) + block_count_ * sizeof(uint64);
+    return writer_.Write(&header, sizeof(header))
+      && (offsets_.empty()
+          || writer_.Write(&offsets_[0], offsets_.size() * sizeof(uint64)));
+  }
+
+  bool Add(const std::string& url) {
+    if (added_ >= url_count_) return false;
+
+    size_t shared = 0;
+    if (added_ % RecordUrlIndex::kBlockUrls == 0) {
+      offsets_[static_cast<size_t>(added_ / RecordUrlIndex::kBlockUrls)] =
+        static_cast<uint64>(writer_.position() - data_start_);
+    } else {
+      size_t max_shared = std::min(url.size(), previous_.size());
+      while (shared < max_shared && url[shared] == previous_[shared]) {
+        ++shared;
+      }
+    }
+
+    buffer_.clear();
+    PutVarint(shared, &buffer_);
+    PutVarint(url.size() - shared, &buffer_);
+    buffer_.append(url, shared, url.size() - shared);
+
+    previous_ = url;
+    ++added_;
+    return writer_.Write(buffer_.data(), buffer_.size());
+  }
+
+  bool Close(int64 file_size) {
+    RecordUrlIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    header.version = RecordUrlIndex::kVersion;
+    header.file_size = static_cast<uint64>(file_size);
+    header.url_count = static_cast<uint64>(url_count_);
+    header.block_count = static_cast<uint64>(block_count_);
+    header.data_size = static_cast<uint64>(writer_.position() - data_start_);
+
+    bool result = added_ == url_count_
+      && (offsets_.empty()
+          || writer_.WriteAt(sizeof(header), &offsets_[0],
+                             offsets_.size() * sizeof(uint64)))
+      && writer_.WriteAt(0, &header, sizeof(header));
+    if (!writer_.Close()) {
+      result = false;
+    }
+    return result;
+  }
+
+ private:
+  std::string path_;
+  SequentialWriter writer_;
+
+  int64 url_count_;
+  int64 block_count_;
+  int64 data_start_;
+
+  std::vector<uint64> offsets_;
+
+  int64 added_;
+  std::string previous_;
+  std::string buffer_;
+};
+
+}  // namespace
+
+///////////////////////////////////////////////////////////////////////
+// Implementation of RecordUrlIndex
+
+const char* RecordUrlIndex::kIndexSuffix = "_urls";
+
+RecordUrlIndex::RecordUrlIndex() {
+  memset(&header_, 0, sizeof(header_));
+  offsets_ = NULL;
+  data_ = NULL;
+}
+
+std::string RecordUrlIndex::GetIndexPath(const std::string& recordfile) {
+  std::string path(recordfile);
+  path.append(kIndexSuffix);
+  return path;
+}
+
+bool RecordUrlIndex::Open(const std::string& recordfile) {
+  Close();
+
+  std::string path = GetIndexPath(recordfile);
+  FileAttribute attr;
+  if (!FileUtil::Exists(path.c_str())
+      || !FileUtil::GetFileAttribute(recordfile.c_str(), &attr)
+      || !file_.Open(path.c_str())) {
+    return false;
+  }
+
+  // The index is ignored if it belongs to another version of record file.
+  bool result = file_.size() >= static_cast<int64>(sizeof(header_));
+  if (result) {
+    memcpy(&header_, file_.data(), sizeof(header_));
+    uint64 block_count = (header_.url_count + kBlockUrls - 1) / kBlockUrls;
+    result = header_.version == kVersion
+      && header_.file_size == static_cast<uint64>(attr.size)
+      && header_.block_count == block_count
+      && block_count <= static_cast<uint64>(file_.size()) / sizeof(uint64)
+      && sizeof(header_) + block_count * sizeof(uint64) + header_.data_size
+         == static_cast<uint64>(file_.size());
+  }
+
+  if (result) {
+    offsets_ = reinterpret_cast<const uint64*>(file_.data() + sizeof(header_));
+    data_ = reinterpret_cast<const char*>(offsets_ + header_.block_count);
+    for (uint64 i = 0; result && i < header_.block_count; ++i) {
+      result = offsets_[i] < header_.data_size
+        && (i == 0 || offsets_[i - 1] < offsets_[i]);
+    }
+  }
+
+  if (!result) {
+    Logger::Log(EVENT_NORMAL, "Ignore invalid url index [%s].", path.c_str());
+    Close();
+  }
+  return result;
+}
+
+void RecordUrlIndex::Close() {
+  file_.Unmap();
+  memset(&header_, 0, sizeof(header_));
+  offsets_ = NULL;
+  data_ = NULL;
+}
+
+bool RecordUrlIndex::GetFirstUrl(int64 block, std::string* url) const {
+  const char* data = data_ + offsets_[block];
+  const char* end = data_ + header_.data_size;
+  return GetUrl(&data, end, std::string(), url);
+}
+
+bool RecordUrlIndex::DecodeBlock(int64 block, int count,
+                                 const std::string* key,
+                                 std::vector<std::string>* urls) const {
+  const char* data = data_ + offsets_[block];
+  const char* end = data_ + header_.data_size;
+  if (static_cast<uint64>(block) + 1 < header_.block_count) {
+    end = data_ + offsets_[block + 1];
+  }
+
+  int64 left = header_.url_count - block * kBlockUrls;
+  if (count > left) count = static_cast<int>(left);
+
+  std::string url, previous;
+  for (int i = 0; i < count; ++i) {
+    if (!GetUrl(&data, end, previous, &url)) {
+      Logger::Log(EVENT_ERROR, "Url index block [%lld] is corrupted.", block);
+      return false;
+    }
+    urls->push_back(url);
+    if (key != NULL && url >= *key) break;
+    previous.swap(url);
+  }
+  return true;
+}
+
+int64 RecordUrlIndex::LowerBound(const std::string& key) const {
+  // Find the first block whose first url is not less than the key.
+  int64 low = 0, high = static_cast<int64>(header_.block_count);
+  std::string url;
+  while (low < high) {
+    int64 middle = low + (high - low) / 2;
+    if (!GetFirstUrl(middle, &url)) return -1;
+    if (url < key) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  int64 end = std::min(low * kBlockUrls, url_count());
+  if (low == 0) return end;
+
+  // Otherwise the url is in the previous block, or it is the first url of
+  // the found block.
+  std::vector<std::string> urls;
+  if (!DecodeBlock(low - 1, kBlockUrls, &key, &urls)) return -1;
+  if (!urls.empty() && urls.back() >= key) {
+    return (low - 1) * kBlockUrls + static_cast<int64>(urls.size()) - 1;
+  }
+  return end;
+}
+
+int64 RecordUrlIndex::Query(const std::string& prefix, int64 start,
+                            int limit, std::vector<std::string>* urls) const {
+  urls->clear();
+
+  // All urls with the prefix are less than the prefix with its last byte
+  // increased. Trailing 0xFF bytes can't be increased, so they are removed.
+  std::string upper(prefix);
+  while (!upper.empty()
+         && static_cast<unsigned char>(upper[upper.size() - 1]) == 0xFF) {
+    upper.erase(upper.size() - 1);
+  }
+
+  int64 begin = LowerBound(prefix);
+  int64 end = url_count();
+  if (!upper.empty()) {
+    upper[upper.size() - 1] = static_cast<char>(upper[upper.size() - 1] + 1);
+    end = LowerBound(upper);
+  }
+  if (begin < 0 || end < 0) return -1;
+  if (end < begin) end = begin;
+
+  // Decode requested urls block by block.
+  int64 ordinal = begin + (start > 0 ? start : 0);
+  int64 last = std::min(end, ordinal + (limit > 0 ? limit : 0));
+  while (ordinal < last) {
+    int64 block = ordinal / kBlockUrls;
+    int skip = static_cast<int>(ordinal % kBlockUrls);
+    int count = static_cast<int>(std::min<int64>(kBlockUrls,
+                                                 skip + last - ordinal));
+
+    std::vector<std::string> block_urls;
+    if (!DecodeBlock(block, count, NULL, &block_urls)
+        || static_cast<int>(block_urls.size()) != count) {
+      return -1;
+    }
+    urls->insert(urls->end(), block_urls.begin() + skip, block_urls.end());
+    ordinal += count - skip;
+  }
+
+  return end - begin;
+}
+
+int64 RecordUrlIndex::Query(const std::vector<const RecordUrlIndex*>& indexes,
+                            const std::string& prefix, int64 start, int limit,
+                            std::vector<std::string>* urls) {
+  urls->clear();
+  if (indexes.size() == 1) {
+    return indexes[0]->Query(prefix, start, limit, urls);
+  }
+
+  // Urls of every index are read in chunks, and merged in order.
+  const int kChunkSize = 1024;
+  int n = static_cast<int>(indexes.size());
+  std::vector<std::vector<std::string> > chunks(n);
+  std::vector<int> positions(n, 0);
+  std::vector<int64> offsets(n, 0);
+  for (int i = 0; i < n; ++i) {
+    if (indexes[i]->Query(prefix, 0, kChunkSize, &chunks[i]) < 0) return -1;
+  }
+
+  int64 total = 0;
+  while (true) {
+    const std::string* minimum = NULL;
+    for (int i = 0; i < n; ++i) {
+      if (positions[i] < static_cast<int>(chunks[i].size())
+          && (minimum == NULL || chunks[i][positions[i]] < *minimum)) {
+        minimum = &chunks[i][positions[i]];
+      }
+    }
+    if (minimum == NULL) break;
+
+    if (total >= start && total < start + limit) {
+      urls->push_back(*minimum);
+    }
+    ++total;
+
+    // Move all indexes with the same url, and the minimum is copied first
+    // because its chunk may be replaced.
+    std::string url(*minimum);
+    for (int i = 0; i < n; ++i) {
+      if (positions[i] >= static_cast<int>(chunks[i].size())
+          || chunks[i][positions[i]] != url) {
+        continue;
+      }
+      if (++positions[i] == static_cast<int>(chunks[i].size())
+          && static_cast<int>(chunks[i].size()) == kChunkSize) {
+        offsets[i] += kChunkSize;
+        positions[i] = 0;
+        if (indexes[i]->Query(prefix, offsets[i], kChunkSize,
+                              &chunks[i]) < 0) {
+          return -1;
+        }
+      }
+    }
+  }
+  return total;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Implementation of RecordUrlIndexBuilder
+
+// Reads urls from a run file, or the url index of a record file.
+class RecordUrlIndexBuilder::RunReader {
+ public:
+  RunReader() : data_(NULL), end_(NULL) {}
+
+  bool Open(const std::string& path) {
+    if (!file_.Open(path.c_str())) return false;
+    data_ = file_.data();
+    end_ = data_ + file_.size();
+    file_.AdviseSequential();
+    return true;
+  }
+
+  bool OpenIndex(const std::string& recordfile) {
+    if (!index_.Open(recordfile)) return false;
+    data_ = index_.data();
+    end_ = data_ + index_.data_size();
+    return true;
+  }
+
+  // Reads next url to current(). Returns false at the end of the run.
+  bool Next() {
+    if (data_ >= end_ || !GetUrl(&data_, end_, current_, &next_)) {
+      return false;
+    }
+    current_.swap(next_);
+    return true;
+  }
+
+  const std::string& current() const {
+    return current_;
+  }
+
+ private:
+  MappedFile file_;
+  RecordUrlIndex index_;
+
+  const char* data_;
+  const char* end_;
+  std::string current_;
+  std::string next_;
+};
+
+namespace {
+
+// Orders run readers by current url, so the smallest one is on the top.
+struct RunReaderGreater {
+  template <typename Reader>
+  bool operator()(const Reader* left, const Reader* right) const {
+    return left->current() > right->current();
+  }
+};
+
+}  // namespace
+
+RecordUrlIndexBuilder::RecordUrlIndexBuilder() {
+  urls_size_ = 0;
+  url_count_ = 0;
+}
+
+RecordUrlIndexBuilder::~RecordUrlIndexBuilder() {
+  RemoveRuns();
+}
+
+bool RecordUrlIndexBuilder::Open(const std::string& recordfile) {
+  RemoveRuns();
+  indexes_.clear();
+  urls_.clear();
+  urls_size_ = 0;
+  url_count_ = 0;
+
+  path_ = RecordUrlIndex::GetIndexPath(recordfile);
+  return true;
+}
+
+bool RecordUrlIndexBuilder::Add(const char* url, int length) {
+  if (path_.empty()) return false;
+
+  urls_.push_back(std::string(url, length));
+  urls_size_ += length + sizeof(std::string);
+  ++url_count_;
+
+  if (urls_size_ >= kRunSize) {
+    return SaveRun();
+  }
+  return true;
+}
+
+bool RecordUrlIndexBuilder::AddIndex(const std::string& recordfile) {
+  if (path_.empty()) return false;
+
+  RecordUrlIndex index;
+  if (!index.Open(recordfile)) return false;
+
+  url_count_ += index.url_count();
+  indexes_.push_back(recordfile);
+  return true;
+}
+
+bool RecordUrlIndexBuilder::SaveRun() {
+  std::sort(urls_.begin(), urls_.end());
+
+  char suffix[32];
+  sprintf(suffix, "_run_%d", static_cast<int>(runs_.size()));
+  std::string path(path_);
+  path.append(suffix);
+  runs_.push_back(path);
+
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    Logger::Log(EVENT_ERROR, "Failed to open [%s] to write.", path.c_str());
+    return false;
+  }
+
+  SequentialWriter writer;
+  writer.Attach(file);
+  bool result = true;
+  std::string buffer;
+  for (size_t i = 0; result && i < urls_.size(); ++i) {
+    buffer.clear();
+    PutVarint(0, &buffer);
+    PutVarint(urls_[i].size(), &buffer);
+    buffer.append(urls_[i]);
+    result = writer.Write(buffer.data(), buffer.size());
+  }
+  if (!writer.Close()) {
+    result = false;
+  }
+
+  urls_.clear();
+  urls_size_ = 0;
+  if (!result) {
+    Logger::Log(EVENT_ERROR, "Failed to write url run [%s].", path.c_str());
+  }
+  return result;
+}
+
+bool RecordUrlIndexBuilder::WriteIndex(int64 file_size) {
+  UrlEncoder encoder;
+  if (!encoder.Open(path_, url_count_)) {
+    return false;
+  }
+
+  bool result = true;
+  if (runs_.empty() && indexes_.empty()) {
+    // All urls are still in memory.
+    std::sort(urls_.begin(), urls_.end());
+    for (size_t i = 0; result && i < urls_.size(); ++i) {
+      result = encoder.Add(urls_[i]);
+    }
+    urls_.clear();
+  } else {
+    if (!urls_.empty()) {
+      result = SaveRun();
+    }
+
+    // Merge all the runs and indexes.
+    std::vector<RunReader*> readers;
+    std::priority_queue<RunReader*, std::vector<RunReader*>,
+                        RunReaderGreater> heap;
+    for (size_t i = 0; result && i < runs_.size() + indexes_.size(); ++i) {
+      RunReader* reader = new RunReader();
+      readers.push_back(reader);
+      if (i < runs_.size() ? !reader->Open(runs_[i])
+          : !reader->OpenIndex(indexes_[i - runs_.size()])) {
+        result = false;
+      } else if (reader->Next()) {
+        heap.push(reader);
+      }
+    }
+
+    while (result && !heap.empty()) {
+      RunReader* reader = heap.top();
+      heap.pop();
+      result = encoder.Add(reader->current());
+      if (reader->Next()) {
+        heap.push(reader);
+      }
+    }
+
+    for (size_t i = 0; i < readers.size(); ++i) {
+      delete readers[i];
+    }
+  }
+
+  if (!encoder.Close(file_size)) {
+    result = false;
+  }
+  return result;
+}
+
+bool RecordUrlIndexBuilder::Close(int64 file_size, bool success) {
+  if (path_.empty()) return false;
+
+  bool result = success && WriteIndex(file_size);
+  if (success && !result) {
+    Logger::Log(EVENT_ERROR, "Failed to write url index [%s].", path_.c_str());
+  }
+
+  // An incomplete index is removed, so it is never used.
+  if (!result && FileUtil::Exists(path_.c_str())) {
+    FileUtil::DeleteFile(path_.c_str());
+  }
+
+  RemoveRuns();
+  indexes_.clear();
+  urls_.clear();
+  urls_size_ = 0;
+  url_count_ = 0;
+  path_.clear();
+  return result;
+}
+
+void RecordUrlIndexBuilder::RemoveRuns() {
+  for (size_t i = 0; i < runs_.size(); ++i) {
+    if (FileUtil::Exists(runs_[i].c_str())) {
+      FileUtil::DeleteFile(runs_[i].c_str());
+    }
+  }
+  runs_.clear();
+}
@@ -0,0 +1,185 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// RecordUrlIndex holds all urls of a record file in url order, so urls with
+// a prefix, like all urls under "/products/", can be found without scanning
+// the record file, which is sorted by finger print.
+// The urls are front coded in blocks of kBlockUrls urls. Every url is stored
+// as the length of the prefix shared with the previous url, followed by the
+// rest of the url. The first url of every block is stored completely, so a
+// block can be decoded alone, and the blocks can be binary searched by their
+// first urls. The n-th url is always in block n / kBlockUrls.
+// The index of a record file is stored in a side file, whose name is the
+// record file name with kIndexSuffix. It is written by RecordFileBlockWriter
+// when the record file is closed, see RecordFileIOFactory::CreateIndexedWriter.
+// Layout of an index file is:
+//   RecordUrlIndexHeader
+//   uint64[block_count], offset of every block in the block data
+//   block data
+// Like RecordFileIndex, the index records size of the indexed file, so an
+// index is never used with a different record file.
+
+#ifndef SITEMAPSERVICE_RECORDURLINDEX_H__
+#define SITEMAPSERVICE_RECORDURLINDEX_H__
+
+#include <string>
+#include <vector>
+
+#include "common/basictypes.h"
+#include "common/mappedfile.h"
+
+struct RecordUrlIndexHeader {
+  // Version of the file, which is RecordUrlIndex::kVersion.
+  uint64 version;
+
+  // Size of the indexed record file.
+  uint64 file_size;
+
+  uint64 url_count;
+  uint64 block_count;
+
+  // Size of the block data.
+  uint64 data_size;
+};
+
+class RecordUrlIndex {
+ public:
+  static const uint64 kVersion = 200910071200ULL;
+
+  // Number of urls in a block.
+  static const int kBlockUrls = 64;
+
+  // Suffix of the index file name.
+  static const char* kIndexSuffix;
+
+  RecordUrlIndex();
+  ~RecordUrlIndex() {}
+
+  // Get path of the url index file for a record file.
+  static std::string GetIndexPath(const std::string& recordfile);
+
+  // Maps the url index of given record file.
+  // Returns false if there is no index, or it doesn't match the record file.
+  bool Open(const std::string& recordfile);
+
+  void Close();
+
+  int64 url_count() const {
+    return static_cast<int64>(header_.url_count);
+  }
+
+  // Returns the block data, where all the urls can be decoded sequentially.
+  const char* data() const {
+    return data_;
+  }
+
+  int64 data_size() const {
+    return static_cast<int64>(header_.data_size);
+  }
+
+  // Finds urls starting with "prefix". At most "limit" urls are saved to
+  // "urls", after skipping the first "start" ones, so the result can be
+  // paged.
+  // Returns the total number of urls with the prefix, or -1 if the index is
+  // corrupted.
+  int64 Query(const std::string& prefix, int64 start, int limit,
+              std::vector<std::string>* urls) const;
+
+  // Same as above, but finds urls in several indexes, like the ones of the
+  // base file and the level files. A url in more than one index is counted
+  // once, so all the urls with the prefix are walked to get the total.
+  static int64 Query(const std::vector<const RecordUrlIndex*>& indexes,
+                     const std::string& prefix, int64 start, int limit,
+                     std::vector<std::string>* urls);
+
+ private:
+  // Returns ordinal of the first url which is not less than "key", or -1 if
+  // the index is corrupted.
+  int64 LowerBound(const std::string& key) const;
+
+  // Decodes urls of a block, until "count" urls are decoded, or the last url
+  // is not less than "key" if it is not NULL.
+  // Returns false if the block is corrupted.
+  bool DecodeBlock(int64 block, int count, const std::string* key,
+                   std::vector<std::string>* urls) const;
+
+  // Gets the first url of a block.
+  bool GetFirstUrl(int64 block, std::string* url) const;
+
+  MappedFile file_;
+
+  RecordUrlIndexHeader header_;
+  const uint64* offsets_;
+  const char* data_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(RecordUrlIndex);
+};
+
+// Builds the url index of a record file from its urls in any order.
+// Urls are sorted in memory in runs of at most kRunSize bytes. Full runs are
+// saved to temporary files, which are merged when the index is written.
+// Url indexes of other record files can also be merged, which is used when
+// record files are concatenated.
+class RecordUrlIndexBuilder {
+ public:
+  // Max size of urls sorted in memory.
+  static const int kRunSize = 16 * 1024 * 1024;
+
+  RecordUrlIndexBuilder();
+  ~RecordUrlIndexBuilder();
+
+  // Starts to build the url index for given record file.
+  bool Open(const std::string& recordfile);
+
+  // Adds url of next record.
+  bool Add(const char* url, int length);
+
+  // Adds all the urls in the url index of another record file.
+  // Returns false if the other file has no valid url index.
+  bool AddIndex(const std::string& recordfile);
+
+  // Writes the index for a record file with given size.
+  // If "success" is false, nothing is written.
+  bool Close(int64 file_size, bool success);
+
+ private:
+  class RunReader;
+
+  // Sorts urls in memory, and saves them to a new run file.
+  bool SaveRun();
+
+  // Writes all the sorted urls to the index file.
+  bool WriteIndex(int64 file_size);
+
+  // Removes all run files.
+  void RemoveRuns();
+
+  std::string path_;
+
+  std::vector<std::string> urls_;
+  int64 urls_size_;
+
+  // Total number of added urls.
+  int64 url_count_;
+
+  std::vector<std::string> runs_;
+
+  // Record files whose url indexes are added.
+  std::vector<std::string> indexes_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(RecordUrlIndexBuilder);
+};
+
+#endif // SITEMAPSERVICE_RECORDURLINDEX_H__
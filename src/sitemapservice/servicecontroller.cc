@@ -18,10 +18,13 @@
 
 #include "common/logger.h"
 #include "common/util.h"
+#include "common/sequentialwriter.h"
 
 #include "sitemapservice/pagecontroller.h"
 #include "sitemapservice/runtimeinfomanager.h"
 #include "sitemapservice/backupservice.h"
+#include "sitemapservice/memorybudget.h"
+#include "sitemapservice/compactor.h"
 #include "sitemapservice/httpsettingmanager.h"
 
 #ifdef WIN32
@@ -139,6 +142,12 @@ bool ServiceController::Initialize() {
     return false;
   }
 
+  // Databases of loaded sites are compacted in background.
+  if (!Compactor::Start()) {
+    Logger::Log(EVENT_ERROR, "Failed to start compactor.");
+    return false;
+  }
+
   Logger::Log(EVENT_CRITICAL, "Service controller started successfully.");
   return true;
 }
@@ -183,6 +192,13 @@ bool ServiceController::ReloadSetting() {
   // Reload global setting.
   Logger::SetLogLevel(settings.logging_level());
   BackupService::SetBackupDuration(settings.backup_duration());
+  MemoryBudget::SetLimit(settings.max_memory_in_mb() * 1024LL * 1024);
+  SequentialWriter::SetRateLimit(settings.max_disk_write_in_kb() * 1024LL);
+  Compactor::Triggers triggers;
+  triggers.temp_files = settings.compact_temp_files();
+  triggers.temp_bytes = settings.compact_temp_size_in_mb() * 1024LL * 1024;
+  triggers.interval = settings.compact_interval();
+  Compactor::SetTriggers(triggers);
 
   // Create a temporary setting map for new settings.
   std::map<std::string, SiteSetting> new_settings_map;
@@ -312,6 +328,9 @@ void ServiceController::StopService() {
   // Remove all services from waiting queue.
   service_queue_->RemoveAllWaitingServices();
 
+  // No database is compacted any more.
+  Compactor::Stop();
+
   // Unload all sites.
   std::map<std::string, SiteManager*>::iterator itr = site_managers_.begin();
   for (; itr != site_managers_.end(); ++itr) {
@@ -15,22 +15,47 @@
 
 #include "sitemapservice/sitedatamanager.h"
 
+#include <algorithm>
 #include <fstream>
 
 #include "common/logger.h"
 #include "common/fileutil.h"
 #include "sitemapservice/runtimeinfomanager.h"
 #include "sitemapservice/newsdatamanager.h"
+#include "sitemapservice/recordfileimageio.h"
+#include "sitemapservice/recordfileindex.h"
+#include "sitemapservice/recordmergereader.h"
+#include "sitemapservice/urlfprintio.h"
 
 SiteDataManagerImpl::SiteDataManagerImpl() {
   recordtable_ = NULL;
   hosttable_ = NULL;
+  new_url_count_ = 0;
+  unreported_count_ = 0;
+  flushing_ = false;
   recordmerger_ = NULL;
   siteinfo_ = NULL;
   news_data_manager_ = NULL;
+  has_merged_version_ = false;
 }
 
 SiteDataManagerImpl::~SiteDataManagerImpl() {
+  // Wait for the compaction in progress, which also flushes memory.
+  Compactor::Unregister(this);
+
+  // No more flushing is started by memory budget.
+  MemoryBudget::Unregister(this);
+
+  // Keep obsoleted URLs for next database update.
+  if (!tombstones_.Spill()) {
+    Logger::Log(EVENT_ERROR, "%s: Failed to save obsoleted urls.",
+              setting_.site_id().c_str());
+  }
+
+  // Wait for the flushing, which uses the tables below.
+  // No record is added any more, so flush_cs_ is not needed.
+  flush_thread_.Join();
+
   if (recordtable_ != NULL) delete recordtable_;
   if (recordmerger_ != NULL) delete recordmerger_;
   if (hosttable_ != NULL) delete hosttable_;
@@ -69,9 +94,16 @@ bool SiteDataManagerImpl::Initialize(const SiteSetting& setting) {
 
  
   // Create record merger and table.
+  RecordTable::EvictionPolicy policy = RecordTable::EVICT_OLDEST_ACCESS;
+  if (!RecordTable::ParseEvictionPolicy(setting.memory_eviction_policy(),
+                                        &policy)) {
+    Logger::Log(EVENT_ERROR, "%s: Unknown eviction policy [%s], ignore.",
+                setting.site_id().c_str(),
+                setting.memory_eviction_policy().c_str());
+  }
   recordmerger_ = new RecordMerger();
   recordtable_ = new RecordTable(setting.site_id(),
-                                 setting.max_url_in_memory());
+                                 setting.max_url_in_memory(), policy);
   
   int64 max_tempfiles_size = setting_.max_url_in_disk();
   max_tempfiles_size *= (sizeof(VisitingRecord) + sizeof(UrlFprint));
@@ -80,6 +112,17 @@ bool SiteDataManagerImpl::Initialize(const SiteSetting& setting) {
               setting_.site_id().c_str());
     return false;
   }
+  tombstones_.Initialize(&filemanager_);
+
+  // Load filter of known urls, or build it if it is not available.
+  // It should be ready before records are loaded.
+  FprintFilter filter;
+  if (filter.Load(filemanager_.GetFPFilterFile().c_str())) {
+    recordtable_->SwapFprintFilter(&filter);
+  } else if (!RebuildFprintFilter()) {
+    Logger::Log(EVENT_ERROR, "%s: Failed to build url filter.",
+              setting.site_id().c_str());
+  }
 
   // Load old records from current_file, if exist.
   std::string currentfile = filemanager_.GetCurrentFile();
@@ -88,6 +131,20 @@ bool SiteDataManagerImpl::Initialize(const SiteSetting& setting) {
               setting.site_id().c_str());
   }
 
+  // Replay the journal over current file, and make a new checkpoint.
+  std::string journalfile = filemanager_.GetJournalFile();
+  if (FileUtil::Exists(journalfile.c_str())) {
+    if (recordtable_->Replay(journalfile.c_str()) != 0) {
+      Logger::Log(EVENT_ERROR, "%s: Failed to replay journal.",
+                setting.site_id().c_str());
+    } else if (recordtable_->Checkpoint(currentfile.c_str()) == 0) {
+      FileUtil::DeleteFile(journalfile.c_str());
+    } else {
+      Logger::Log(EVENT_ERROR, "%s: Failed to save replayed records.",
+                setting.site_id().c_str());
+    }
+  }
+
   // Load host table from the file.
   hosttable_ = new HostTable(setting.site_id().c_str());
   std::string hostfile = filemanager_.GetHostFile();
@@ -133,6 +190,23 @@ bool SiteDataManagerImpl::Initialize(const SiteSetting& setting) {
 
   last_file_merge_ = time(NULL) - 60 * 60 * 24;
 
+  // Sitemaps may be generated before the database is compacted, so get the
+  // statistics from the saved ones, or else read it.
+  RecordFileStat stat;
+  std::vector<std::string> files = filemanager_.GetDatabaseFiles();
+  if (!RecordMerger::LoadStat(files, &stat)) {
+    RecordMerger::ReadMergedStat(files, tombstones_.GetRuns(),
+                                 GetCutDownTime(), &stat);
+  }
+  recordfile_stat_ = stat;
+
+  // Draw memory from the budget shared by all sites.
+  MemoryBudget::Register(this);
+  ReportMemoryUsage();
+
+  // Database is updated in background from now on.
+  Compactor::Register(this);
+
   return true;
 }
 
@@ -149,25 +223,51 @@ bool SiteDataManagerImpl::SaveMemoryData(bool flush, bool block) {
   }
 
   // If the records exceeds max size, we must force it to flush.
-  if (recordtable_->Size() >= setting_.max_url_in_memory()) {
+  if (recordtable_->IsFull()) {
     flush = true;
   }
 
   // Save host table.
   std::string hostfile = filemanager_.GetHostFile();
-  if (!hosttable_->Save(hostfile.c_str())) {
+  host_cs_.Enter(true);
+  bool host_saved = hosttable_->Save(hostfile.c_str());
+  host_cs_.Leave();
+  if (!host_saved) {
     Logger::Log(EVENT_ERROR, "%s: Save host table failed when flushing data.",
               setting_.site_id().c_str());
     return false;
   }
 
-  // Save current file.
+  // Save current file, or only the changed records to journal file.
+  // The journal is discarded once a full current file is written.
   std::string currentfile = filemanager_.GetCurrentFile();
-  int result = recordtable_->Save(currentfile.c_str());
+  std::string journalfile = filemanager_.GetJournalFile();
+  bool checkpoint = flush || recordtable_->NeedCheckpoint();
+  int result = 0;
+  if (flush) {
+    result = recordtable_->Flush(currentfile.c_str());
+  } else if (checkpoint) {
+    result = recordtable_->Checkpoint(currentfile.c_str());
+  } else {
+    result = recordtable_->SaveJournal(journalfile.c_str());
+  }
+  if (result == 0 && checkpoint) {
+    FileUtil::DeleteFile(journalfile.c_str());
+  }
+
   if (result == 0) {
     if (flush) {
       result = filemanager_.CompleteCurrentFile() ? 0 : 466453;
-      if (result == 0) recordtable_->Clear();
+
+      // Records are cleared by Flush, so put them back to table.
+      if (result != 0) recordtable_->Restore(currentfile.c_str());
+
+      // Flushed urls are added to the filter, so save it.
+      std::string filterfile = filemanager_.GetFPFilterFile();
+      if (result == 0 && !recordtable_->SaveFprintFilter(filterfile.c_str())) {
+        Logger::Log(EVENT_ERROR, "%s: Failed to save url filter.",
+                  setting_.site_id().c_str());
+      }
     }
   }
   else {
@@ -179,11 +279,22 @@ bool SiteDataManagerImpl::SaveMemoryData(bool flush, bool block) {
   // Update status.
   if (result == 0) {
     if (flush) {
-      // A new temp file is generated, we may need to remove old ones.
-      if (filemanager_.GetTempFilesSize() > filemanager_.GetMaxTempFilesSize()) {
-        disk_cs_.Enter(true);
-        filemanager_.CleanUpTempFile();
-        disk_cs_.Leave();
+      // A new temp file is generated, we may need to merge old ones into
+      // level files, which doesn't touch the base file. It is done by the
+      // compactor, or here if the compactor is not running. Old temp files
+      // are only removed if the merge fails.
+      if (filemanager_.GetMaxTempFilesSize() >= 0
+          && filemanager_.GetTempFilesSize() > filemanager_.GetMaxTempFilesSize()
+          && !Compactor::Request(this)) {
+        merge_cs_.Enter(true);
+        if (recordmerger_->MergeTempFiles(&filemanager_,
+                                          std::vector<std::string>(),
+                                          GetCutDownTime()) != 0) {
+          Logger::Log(EVENT_ERROR, "%s: Failed to merge temp files.",
+                    setting_.site_id().c_str());
+          filemanager_.CleanUpTempFile();
+        }
+        merge_cs_.Leave();
       }
 
      // Update runtime info.
@@ -193,6 +304,9 @@ bool SiteDataManagerImpl::SaveMemoryData(bool flush, bool block) {
         siteinfo_->set_url_in_memory(0);
         RuntimeInfoManager::Unlock();
       }
+
+      // Memory is released by flushing.
+      ReportMemoryUsage();
     }
 
     last_table_save_ = time(NULL);
@@ -215,33 +329,103 @@ RecordFileStat SiteDataManagerImpl::GetRecordFileStata() {
 
 
 bool SiteDataManagerImpl::UpdateDatabase() {
+  bool base_merged = false;
+  return MergeDatabase(NULL, &base_merged);
+}
+
+bool SiteDataManagerImpl::ProcessDatabase(RecordMerger::Observer* observer) {
+  // Only a base merge reads the whole database, so records are passed by
+  // the update in that case. Otherwise merging new data is left to regular
+  // updates, and current files are read.
+  if (BaseMergeDue()) {
+    bool base_merged = false;
+    if (!MergeDatabase(observer, &base_merged)) {
+      return false;
+    }
+
+    // Records of the new base file are already passed.
+    if (base_merged) {
+      return true;
+    }
+  }
+
+  RecordFileReader* reader = CreateDatabaseReader();
+  if (reader == NULL) {
+    Logger::Log(EVENT_ERROR, "%s: Failed to open database to read.",
+              setting_.site_id().c_str());
+    return false;
+  }
+
+  const VisitingRecord* record = NULL;
+  while ((record = reader->Next()) != NULL) {
+    observer->OnRecord(*record);
+  }
+  delete reader;
+  return true;
+}
+
+bool SiteDataManagerImpl::MergeDatabase(RecordMerger::Observer* observer,
+                                        bool* base_merged) {
+  *base_merged = false;
+
+  // Callers share an update in progress by waiting for it, after which
+  // there is nothing to merge unless more data comes meanwhile.
+  update_cs_.Enter(true);
+  AutoLeave update_autoleave(&update_cs_);
+  if (!DatabaseChanged()) {
+    return true;
+  }
+
   // First, update news entries.
   if (!news_data_manager_->UpdateData()) {
     Logger::Log(EVENT_ERROR, "Failed to update news data.");
     return false;
   }
 
-  // Copy the oboleted set to ensure thread safe.
-  if (!memory_cs_.Enter(true)) {
-    return false;
+  // Spill all obsoleted urls to disk. Runs created after this point are
+  // kept for next update.
+  if (!tombstones_.Spill()) {
+    Logger::Log(EVENT_ERROR, "%s: Failed to save obsoleted urls.",
+              setting_.site_id().c_str());
   }
-  std::set<UrlFprint> obsoleted_copy(obsoleted_);
-  obsoleted_.clear();
-  memory_cs_.Leave();
+  DataVersion version;
+  GetDataVersion(&version);
+  std::vector<std::string> tombstones = version.tombstones;
 
   // Update the database.
-  if (!disk_cs_.Enter(true)) {
+  if (!merge_cs_.Enter(true)) {
     return false;
   }
   
-  time_t cutdown = time(NULL);
-  cutdown -= setting_.max_url_life() * 24 * 3600;
+  time_t cutdown = GetCutDownTime();
   RecordFileStat tmpstat;
   int mergeresult = recordmerger_->Merge(
-    &filemanager_, obsoleted_copy,
-    setting_.max_url_in_disk(), cutdown, &tmpstat);
-
-  disk_cs_.Leave();
+    &filemanager_, tombstones,
+    setting_.max_url_in_disk(), cutdown, &tmpstat, base_merged, observer);
+
+  // Temp files and obsoleted urls which come during the merge are not
+  // merged, so they are left out, and next update sees them as changes.
+  // Database files can only be changed by merges, so they are taken before
+  // any other merge.
+  DataVersion merged;
+  GetDataVersion(&merged);
+  merge_cs_.Leave();
+
+  std::vector<std::string> old_files;
+  old_files.swap(version.database_files);
+  version.database_files = merged.database_files;
+  for (int i = static_cast<int>(version.temp_files.size()) - 1; i >= 0; --i) {
+    if (std::find(merged.temp_files.begin(), merged.temp_files.end(),
+                  version.temp_files[i]) == merged.temp_files.end()) {
+      version.temp_files.erase(version.temp_files.begin() + i);
+    }
+  }
+  for (int i = static_cast<int>(version.tombstones.size()) - 1; i >= 0; --i) {
+    if (std::find(merged.tombstones.begin(), merged.tombstones.end(),
+                  version.tombstones[i]) == merged.tombstones.end()) {
+      version.tombstones.erase(version.tombstones.begin() + i);
+    }
+  }
 
   // Save current status.
   if (mergeresult != 0) {
@@ -250,12 +434,39 @@ bool SiteDataManagerImpl::UpdateDatabase() {
     return false;
   } else {
     recordfile_stat_ = tmpstat;
+
+    // Obsoleted urls are removed from database once the base is merged.
+    // Before that, they are skipped by database readers.
+    if (*base_merged) {
+      tombstones_.RemoveRuns(tombstones);
+      version.tombstones.clear();
+    }
+    merged_version_ = version;
+    has_merged_version_ = true;
+
+    // Urls are only removed from database when the base is merged, so the
+    // url filter is rebuilt then. Otherwise new level files are added to it.
+    // Memory data is locked, so no temp file is generated meanwhile.
+    memory_cs_.Enter(true);
+    bool filtered = *base_merged ? RebuildFprintFilter()
+                                 : UpdateFprintFilter(old_files);
+    if (!filtered) {
+      Logger::Log(EVENT_ERROR, "%s: Failed to update url filter.",
+                setting_.site_id().c_str());
+    }
+    memory_cs_.Leave();
+    ReportMemoryUsage();
+
+    host_cs_.Enter(true);
+    new_url_count_ = 0;
+    host_cs_.Leave();
     
     // Update runtime info.
     if (siteinfo_ != NULL && RuntimeInfoManager::Lock(true)) {
       siteinfo_->set_url_in_database(tmpstat.GetTotalCount());
       siteinfo_->set_url_in_tempfile(0);
       siteinfo_->set_url_in_memory(0);
+      siteinfo_->set_url_new(0);
       RuntimeInfoManager::Unlock();
     }
   }
@@ -264,14 +475,90 @@ bool SiteDataManagerImpl::UpdateDatabase() {
   return true;
 }
 
+void SiteDataManagerImpl::GetDataVersion(DataVersion* version) {
+  RecordfileManager::Snapshot* snapshot = filemanager_.AcquireSnapshot();
+  version->database_files = snapshot->GetDatabaseFiles();
+  version->temp_files = snapshot->temp_files();
+  snapshot->Release();
+  version->tombstones = tombstones_.GetRuns();
+}
+
+bool SiteDataManagerImpl::BaseMergeDue() {
+  update_cs_.Enter(true);
+  AutoLeave update_autoleave(&update_cs_);
+  if (!DatabaseChanged()) {
+    return false;
+  }
+
+  // Without new data, an update merges the base to remove obsoleted urls.
+  if (recordtable_->Size() == 0 && filemanager_.GetTempFiles().empty()) {
+    return true;
+  }
+  return RecordMerger::NeedMergeBase(&filemanager_);
+}
+
+bool SiteDataManagerImpl::DatabaseChanged() {
+  if (!has_merged_version_ || tombstones_.buffer_size() > 0) {
+    return true;
+  }
+
+  DataVersion version;
+  GetDataVersion(&version);
+  if (!(version == merged_version_)) {
+    return true;
+  }
+
+  // Records in memory are flushed by the update, which is not worth doing
+  // again soon after last one.
+  time_t last_update = last_file_merge_;
+  return recordtable_->Size() > 0
+    && time(NULL) - last_update >= kMinUpdateInterval;
+}
+
+bool SiteDataManagerImpl::NeedCompaction(
+    const Compactor::Triggers& triggers) {
+  int temp_count = static_cast<int>(filemanager_.GetTempFiles().size());
+  if (triggers.temp_files > 0 && temp_count >= triggers.temp_files) {
+    return true;
+  }
+  if (triggers.temp_bytes > 0
+      && filemanager_.GetTempFilesSize() >= triggers.temp_bytes) {
+    return true;
+  }
+
+  // Spilled obsoleted urls are already seen by last update, and they are
+  // skipped by readers until the base is merged.
+  bool changed = temp_count > 0 || tombstones_.buffer_size() > 0;
+  time_t last_update = last_file_merge_;
+  return triggers.interval > 0 && changed
+    && time(NULL) - last_update >= triggers.interval;
+}
+
+bool SiteDataManagerImpl::Compact() {
+  Logger::Log(EVENT_NORMAL, "%s: Compact database in background.",
+            setting_.site_id().c_str());
+  if (!UpdateDatabase()) {
+    Logger::Log(EVENT_ERROR, "%s: Failed to compact database.",
+              setting_.site_id().c_str());
+    return false;
+  }
+  return true;
+}
+
+time_t SiteDataManagerImpl::GetCutDownTime() {
+  time_t cutdown = time(NULL);
+  cutdown -= setting_.max_url_life() * 24 * 3600;
+  return cutdown;
+}
+
 bool SiteDataManagerImpl::GetHostName(std::string* host) {
   *host = setting_.host_url().host_url();
 
   // If host name is not defined in setting, try to determine it automatically.
   if (host->length() == 0) {
-    memory_cs_.Enter(true);
+    host_cs_.Enter(true);
     *host = hosttable_->GetBestHost();
-    memory_cs_.Leave();
+    host_cs_.Leave();
   }
 
   if (host->length() == 0) {
@@ -324,24 +611,24 @@ int SiteDataManagerImpl::ProcessRecord(UrlRecord& record) {
     if (result && siteinfo_ != NULL) {
       time_t now = time(NULL);
       if (now <= last_update_info_ + 60)
-        if (memory_cs_.Enter(true)) {
-          if (RuntimeInfoManager::Lock(true)) {
-            siteinfo_->set_url_in_memory(recordtable_->Size());
-            RuntimeInfoManager::Unlock();
-          }
+        if (RuntimeInfoManager::Lock(true)) {
+          siteinfo_->set_url_in_memory(recordtable_->Size());
+          host_cs_.Enter(true);
+          siteinfo_->set_url_new(new_url_count_);
+          host_cs_.Leave();
           last_update_info_ = now;
-          memory_cs_.Leave();
+          RuntimeInfoManager::Unlock();
         }
     }
 
     return result ? 0 : 1;
   } else if (record.statuscode == 404 || record.statuscode == 301
              || record.statuscode == 302 || record.statuscode == 307) {
-    memory_cs_.Enter(true);
-    if (static_cast<int>(obsoleted_.size()) < kMaxObsoletedUrl) {
-      obsoleted_.insert(Url::FingerPrint(record.url));
+    // Records visited after now are kept, see TombstoneLog.
+    if (!tombstones_.Add(Url::FingerPrint(record.url), time(NULL))) {
+      Logger::Log(EVENT_ERROR, "%s: Failed to save obsoleted urls.",
+                setting_.site_id().c_str());
     }
-    memory_cs_.Leave();
 
     return 0;
   } else {
@@ -354,28 +641,144 @@ bool SiteDataManagerImpl::AddRecord(const char* host, const char *url,
                                 const time_t& lastmodified,
                                 const time_t& filewrite) {
 
-  memory_cs_.Enter(true);
-
+  // Record table is locked by shard, so only the host table needs lock.
+  bool is_new = false;
   bool result = recordtable_->AddRecord(
-    url, contenthash, lastmodified, filewrite) == 0;
-  hosttable_->VisitHost(host, 1);
-  bool is_full = recordtable_->Size() >= setting_.max_url_in_memory();
+    url, contenthash, lastmodified, filewrite, &is_new) == 0;
+  bool is_full = recordtable_->IsFull();
 
-  memory_cs_.Leave();
+  host_cs_.Enter(true);
+  hosttable_->VisitHost(host, 1);
+  if (is_new) ++new_url_count_;
+  bool report = ++unreported_count_ >= kMemoryReportInterval;
+  if (report) unreported_count_ = 0;
+  host_cs_.Leave();
 
   if (is_full) {
-    SaveMemoryData(true, false);
+    StartFlush();
+  } else if (report) {
+    ReportMemoryUsage();
   }
   
   return result;
 }
 
-bool SiteDataManagerImpl::LockDiskData(bool block) {
-  return disk_cs_.Enter(block);
+void SiteDataManagerImpl::StartFlush() {
+  flush_cs_.Enter(true);
+  if (!flushing_) {
+    // The previous flushing is finished, release its thread first.
+    flush_thread_.Join();
+
+    flushing_ = flush_thread_.Start(&FlushThreadEntry, this);
+    if (!flushing_) {
+      Logger::Log(EVENT_ERROR, "%s: Failed to start thread to flush data.",
+                setting_.site_id().c_str());
+      SaveMemoryData(true, false);
+    }
+  }
+  flush_cs_.Leave();
+}
+
+void SiteDataManagerImpl::ReleaseMemory() {
+  Logger::Log(EVENT_NORMAL, "%s: Flush records to release memory.",
+            setting_.site_id().c_str());
+  StartFlush();
+}
+
+void SiteDataManagerImpl::ReportMemoryUsage() {
+  int64 usage = recordtable_->MemoryUsage();
+  MemoryBudget::Update(this, usage);
+
+  if (siteinfo_ != NULL && RuntimeInfoManager::Lock(true)) {
+    siteinfo_->set_memory_used(usage);
+    RuntimeInfoManager::Unlock();
+  }
+}
+
+void* SiteDataManagerImpl::FlushThreadEntry(void* param) {
+  SiteDataManagerImpl* manager = reinterpret_cast<SiteDataManagerImpl*>(param);
+  manager->SaveMemoryData(true, true);
+
+  manager->flush_cs_.Enter(true);
+  manager->flushing_ = false;
+  manager->flush_cs_.Leave();
+  return NULL;
+}
+
+bool SiteDataManagerImpl::RebuildFprintFilter() {
+  FprintFilter filter;
+  RecordfileManager::Snapshot* snapshot = filemanager_.AcquireSnapshot();
+  std::string base_fp =
+    RecordfileManager::GetRecordFPFile(snapshot->base_file());
+  if (!filter.Build(base_fp.c_str(), setting_.max_url_in_disk())) {
+    snapshot->Release();
+    return false;
+  }
+
+  // Urls in level files are in database, but not in the base file yet.
+  const std::vector<std::string>& levelfiles = snapshot->level_files();
+  for (int i = 0; i < static_cast<int>(levelfiles.size()); ++i) {
+    std::string fpfile = RecordfileManager::GetRecordFPFile(levelfiles[i]);
+    UrlFprintReader reader;
+    if (!reader.Open(fpfile.c_str())) continue;
+
+    UrlFprint fprint;
+    while (reader.Read(&fprint)) {
+      filter.Add(fprint);
+    }
+  }
+
+  // Urls in temp files are also known, though not merged into database.
+  const std::vector<std::string>& tempfiles = snapshot->temp_files();
+  for (int i = 0; i < static_cast<int>(tempfiles.size()); ++i) {
+    RecordFileReader* reader = RecordFileIOFactory::CreateReader(tempfiles[i]);
+    if (reader == NULL) continue;
+
+    const VisitingRecord* record = NULL;
+    while ((record = reader->Next()) != NULL) {
+      filter.Add(record->fingerprint());
+    }
+    delete reader;
+  }
+  snapshot->Release();
+
+  recordtable_->SwapFprintFilter(&filter);
+  return recordtable_->SaveFprintFilter(
+    filemanager_.GetFPFilterFile().c_str());
 }
 
-void SiteDataManagerImpl::UnlockDiskData() {
-  disk_cs_.Leave();
+bool SiteDataManagerImpl::UpdateFprintFilter(
+  const std::vector<std::string>& old_files) {
+  // Urls of level files come from temp files, which are added to the filter
+  // when they are flushed. But the filter saved last time may not have them.
+  RecordfileManager::Snapshot* snapshot = filemanager_.AcquireSnapshot();
+  const std::vector<std::string>& levelfiles = snapshot->level_files();
+  const int kBatchSize = 64 * 1024;
+  std::vector<UrlFprint> fprints;
+  for (int i = 0; i < static_cast<int>(levelfiles.size()); ++i) {
+    if (std::find(old_files.begin(), old_files.end(), levelfiles[i])
+        != old_files.end()) {
+      continue;
+    }
+
+    std::string fpfile = RecordfileManager::GetRecordFPFile(levelfiles[i]);
+    UrlFprintReader reader;
+    if (!reader.Open(fpfile.c_str())) continue;
+
+    UrlFprint fprint;
+    while (reader.Read(&fprint)) {
+      fprints.push_back(fprint);
+      if (static_cast<int>(fprints.size()) >= kBatchSize) {
+        recordtable_->AddToFprintFilter(fprints);
+        fprints.clear();
+      }
+    }
+  }
+  snapshot->Release();
+  recordtable_->AddToFprintFilter(fprints);
+
+  return recordtable_->SaveFprintFilter(
+    filemanager_.GetFPFilterFile().c_str());
 }
 
 RecordfileManager* SiteDataManagerImpl::GetFileManager() {
@@ -386,3 +789,100 @@ NewsDataManager* SiteDataManagerImpl::GetNewsDataManager() {
   return news_data_manager_;
 }
 
+RecordFileReader* SiteDataManagerImpl::CreateDatabaseReader() {
+  // Obsoleted urls and too old records may be still in the base file, if it
+  // is not merged in last update.
+  // Temp files are merged in background, so they are read as well.
+  RecordfileManager::Snapshot* snapshot = filemanager_.AcquireSnapshot();
+  // Tombstone runs are not held by the snapshot, and a run removed by a merge
+  // after it is listed is already applied to the new base. So the reader is
+  // still used if some file can't be opened.
+  RecordMergeReader* reader = new RecordMergeReader();
+  if (!reader->Open(snapshot, tombstones_.GetRuns(), GetCutDownTime())) {
+    Logger::Log(EVENT_IMPORTANT, "%s: Some database files can't be read.",
+              setting_.site_id().c_str());
+  }
+  snapshot->Release();
+  return reader;
+}
+
+RecordFileReader* SiteDataManagerImpl::CreateChangeReader(time_t since) {
+  RecordfileManager::Snapshot* snapshot = filemanager_.AcquireSnapshot();
+  RecordChangeReader* reader = new RecordChangeReader();
+  bool opened = reader->Open(snapshot, tombstones_.GetRuns(),
+                             GetCutDownTime(), since);
+  snapshot->Release();
+  if (opened) {
+    return reader;
+  }
+
+  // The base file may be new, or written without columns.
+  delete reader;
+  return CreateDatabaseReader();
+}
+
+bool SiteDataManagerImpl::LookupRecord(const char* url,
+                                       VisitingRecord* record) {
+  UrlFprint fprint = Url::FingerPrint(url);
+  bool found = false;
+  VisitingRecord another;
+
+  // Files on disk are held by a snapshot during lookup.
+  RecordfileManager::Snapshot* snapshot = filemanager_.AcquireSnapshot();
+  found = RecordFileIndex::Lookup(snapshot->base_file(), fprint, record);
+
+  // Level files are also sorted record files with indexes.
+  const std::vector<std::string>& levelfiles = snapshot->level_files();
+  for (int i = 0; i < static_cast<int>(levelfiles.size()); ++i) {
+    if (found) {
+      if (RecordFileIndex::Lookup(levelfiles[i], fprint, &another)) {
+        RecordMerger::Merge(*record, another);
+      }
+    } else {
+      found = RecordFileIndex::Lookup(levelfiles[i], fprint, record);
+    }
+  }
+
+  // Temp files are record images sorted by finger print.
+  const std::vector<std::string>& tempfiles = snapshot->temp_files();
+  for (int i = 0; i < static_cast<int>(tempfiles.size()); ++i) {
+    RecordImage image;
+    // Only the header and the found entry are checked, so a lookup doesn't
+    // read the whole image.
+    if (!image.Open(tempfiles[i].c_str(), RecordImage::VALIDATE_HEADER)) {
+      continue;
+    }
+
+    int64 index = image.Find(fprint);
+    if (index < 0) continue;
+
+    const RecordImageEntry& entry = image.entry(index);
+    if (found) {
+      RecordImage::CopyEntry(entry, &another);
+      RecordMerger::Merge(*record, another);
+    } else {
+      record->update_url(image.url(entry));
+      RecordImage::CopyEntry(entry, record);
+      found = true;
+    }
+  }
+  snapshot->Release();
+
+  // Records in memory are the newest.
+  if (recordtable_->GetRecord(url, &another)) {
+    if (found) {
+      RecordMerger::Merge(*record, another);
+    } else {
+      *record = another;
+      found = true;
+    }
+  }
+
+  // Obsoleted urls are skipped like database readers do, including those
+  // not spilled yet.
+  if (found && tombstones_.Contains(fprint, record->last_access)) {
+    return false;
+  }
+  return found;
+}
+
@@ -28,6 +28,7 @@
 
 #include "common/sitesetting.h"
 #include "common/criticalsection.h"
+#include "common/thread.h"
 #include "common/urlrecord.h"
 #include "common/urlreplacer.h"
 
@@ -39,6 +40,9 @@
 #include "sitemapservice/recordmerger.h"
 #include "sitemapservice/recordfileio.h"
 #include "sitemapservice/siteinfo.h"
+#include "sitemapservice/memorybudget.h"
+#include "sitemapservice/compactor.h"
+#include "sitemapservice/tombstonelog.h"
 
 class NewsDataManager;
 
@@ -51,6 +55,8 @@ class SiteDataManager {
   virtual bool Initialize(const SiteSetting& setting) = 0;
 
   // Update the database.
+  // It returns at once if no data is changed since last update. If another
+  // update is in progress, it waits for that one and shares its result.
   virtual bool UpdateDatabase() = 0;
   // Get last updating time of database.
   virtual time_t GetLastUpdate() = 0;
@@ -68,23 +74,49 @@ class SiteDataManager {
   // Get host name for this site.
   virtual bool GetHostName(std::string* host) = 0;
 
-  // Lock disk data. This should be called before process files on disk.
-  virtual bool LockDiskData(bool block) = 0;
-  // Unlock disk data. This is the inverse method of LockDiskData.
-  virtual void UnlockDiskData() = 0;
-
   // Get the file manager instance used by this data manager.
   virtual RecordfileManager* GetFileManager() = 0;
 
   virtual NewsDataManager* GetNewsDataManager() = 0;
 
+  // Create a reader of all the records in database, which merges the base
+  // file, the level files and the temp files on the fly, so records not
+  // compacted into database yet are also read. The reader holds a snapshot
+  // of the files (see RecordfileManager::Snapshot), so it is not affected by
+  // merges while it is used.
+  // Caller should take care of the returned pointer.
+  virtual RecordFileReader* CreateDatabaseReader() = 0;
+
+  // Create a reader of the records in database changed after "since", like
+  // CreateDatabaseReader without the others. Only changed records of the
+  // base file are read, see RecordChangeReader. If that can't be done, all
+  // the records are read, so caller should still check last_change.
+  // Caller should take care of the returned pointer.
+  virtual RecordFileReader* CreateChangeReader(time_t since) = 0;
+
+  // Pass all the records in database to "observer". The database is only
+  // updated if the base file is due to be merged, and then the records are
+  // passed while the new base file is written, so the database is not read
+  // again. Otherwise they are read like CreateDatabaseReader, after an
+  // update in progress if any.
+  // Returns false if the records can't be passed.
+  virtual bool ProcessDatabase(RecordMerger::Observer* observer) = 0;
+
+  // Look up the visiting record of an url, which merges the record in
+  // database, in temp files, and in memory.
+  // Returns false if the url is unknown.
+  virtual bool LookupRecord(const char* url, VisitingRecord* record) = 0;
+
   // Process a new record.
   // This record will be added into in memory table or on disk database.
   virtual int ProcessRecord(UrlRecord& record) = 0;
 };
 
 
-class SiteDataManagerImpl : public SiteDataManager {
+// The database is updated in background by Compactor.
+class SiteDataManagerImpl : public SiteDataManager,
+                            public MemoryBudget::Consumer,
+                            public Compactor::Database {
  public:
   SiteDataManagerImpl();
   virtual ~SiteDataManagerImpl();
@@ -100,26 +132,95 @@ class SiteDataManagerImpl : public SiteDataManager {
   virtual bool SaveMemoryData(bool flush, bool block);
   virtual time_t GetLastSave();
 
-  virtual bool LockDiskData(bool block);
-  virtual void UnlockDiskData();
-
   virtual bool GetHostName(std::string* host);
 
   virtual RecordfileManager* GetFileManager();
   
   virtual NewsDataManager* GetNewsDataManager();
 
+  virtual RecordFileReader* CreateDatabaseReader();
+
+  virtual RecordFileReader* CreateChangeReader(time_t since);
+
+  virtual bool ProcessDatabase(RecordMerger::Observer* observer);
+
+  virtual bool LookupRecord(const char* url, VisitingRecord* record);
+
   virtual int ProcessRecord(UrlRecord& record);
 
+  // Flush records in memory in background.
+  virtual void ReleaseMemory();
+
+  virtual bool NeedCompaction(const Compactor::Triggers& triggers);
+
+  // Update the database.
+  virtual bool Compact();
+
  private:
-  // Max number of obsoleted URLs, which can be held in memory.
-  static const int kMaxObsoletedUrl = 1000;
+  // Memory usage is reported to MemoryBudget every so many added records.
+  static const int kMemoryReportInterval = 1000;
+
+  // Records only in memory don't make the database out of date within this
+  // many seconds after last update, so services updating the database one
+  // after another share one update.
+  static const int kMinUpdateInterval = 600;
+
+  // Files of the data on disk, which tell whether the database is changed.
+  // See DatabaseChanged.
+  struct DataVersion {
+    std::vector<std::string> database_files;
+    std::vector<std::string> temp_files;
+    std::vector<std::string> tombstones;
+
+    bool operator==(const DataVersion& another) const {
+      return database_files == another.database_files
+        && temp_files == another.temp_files
+        && tombstones == another.tombstones;
+    }
+  };
 
   // Add an status=200 URL to record_table_.
-  // If the record_table_ is full, it will be flushed to disk.
+  // If the record_table_ is full, it will be flushed to disk in background.
   bool AddRecord(const char* host, const char* url, int64 contenthash,
                 const time_t& lastmodified, const time_t& filewrite);
 
+  // Start flush_thread_ to flush memory data, unless it is already running.
+  void StartFlush();
+
+  // Entry point of flush_thread_. "param" is the SiteDataManagerImpl.
+  static void* FlushThreadEntry(void* param);
+
+  // Report memory used by recordtable_ to MemoryBudget and runtime info.
+  void ReportMemoryUsage();
+
+  // Records last accessed before the returned time are removed from
+  // database, according to max_url_life setting.
+  time_t GetCutDownTime();
+
+  // Update the database for UpdateDatabase and ProcessDatabase. For
+  // "observer" and "base_merged", see RecordMerger::Merge.
+  bool MergeDatabase(RecordMerger::Observer* observer, bool* base_merged);
+
+  // Whether next update would merge the base file. It waits for an update
+  // in progress.
+  bool BaseMergeDue();
+
+  // Get current version of data on disk.
+  void GetDataVersion(DataVersion* version);
+
+  // Whether any data is changed since last update. update_cs_ should be
+  // held.
+  bool DatabaseChanged();
+
+  // Build a filter of finger prints in database and temp files, and replace
+  // the finger print filter of record_table_ with it.
+  bool RebuildFprintFilter();
+
+  // Add finger prints of level files which are not in "old_files" to the
+  // filter of record_table_, and save it. It is much cheaper than rebuilding
+  // the filter, and it is enough if no url is removed from database.
+  bool UpdateFprintFilter(const std::vector<std::string>& old_files);
+
   // Last time when record_table_ is saved.
   ThreadSafeVar<time_t> last_table_save_;
 
@@ -135,17 +236,50 @@ class SiteDataManagerImpl : public SiteDataManager {
   ThreadSafeVar<RecordFileStat> recordfile_stat_;
 
   // Table used to hold records in memory.
+  // It is locked by its own shard locks, so url records can be added
+  // without holding memory_cs_.
   RecordTable* recordtable_;
 
   // Table used to hold host names in memory.
+  // It is guarded by host_cs_.
   HostTable* hosttable_;
 
-  // Used to lock data on disk.
-  CriticalSection disk_cs_;
+  // Serializes merges of files on disk. Readers use snapshots instead.
+  CriticalSection merge_cs_;
+
+  // Serializes updates of the database. A caller waiting for an update in
+  // progress usually finds nothing changed after it.
+  CriticalSection update_cs_;
+
+  // Version of data after last successful update, without files which come
+  // during the update. "has_merged_version_" is false before that.
+  // Both of them are guarded by update_cs_.
+  DataVersion merged_version_;
+  bool has_merged_version_;
 
   // Used to lock data in memory.
+  // It serializes saving of memory data.
   CriticalSection memory_cs_;
 
+  // Used to lock hosttable_ and new_url_count_.
+  CriticalSection host_cs_;
+
+  // Number of new urls added since last database update.
+  int64 new_url_count_;
+
+  // Number of records added since memory usage is reported last time.
+  // It is guarded by host_cs_.
+  int unreported_count_;
+
+  // Thread used to flush the full record table, so AddRecord doesn't wait
+  // for the flushing.
+  Thread flush_thread_;
+
+  // Whether flush_thread_ is running.
+  // Both of them are guarded by flush_cs_.
+  bool flushing_;
+  CriticalSection flush_cs_;
+
   // Record file manager for the site.
   // It is used to manage data files on disk.
   RecordfileManager filemanager_;
@@ -159,11 +293,9 @@ class SiteDataManagerImpl : public SiteDataManager {
   // Runtime information for the site.
   SiteInfo* siteinfo_;
 
-  // set is used to hold obsoleted URLs.
-  // 1. Max obsoleted number is limited by memory.
-  // 2. We assume that when iterate through std::set, element value is in
-  //    increasing order. (This is true under both VC8 and GCC).
-  std::set<UrlFprint> obsoleted_;
+  // Log of obsoleted URLs, which are removed when database is updated.
+  // It is thread safe by itself.
+  TombstoneLog tombstones_;
 
   // The filter constructed from robots.txt.
   // All coming URLs will be filtered by it before sent to data manager.
@@ -23,6 +23,7 @@ void SiteInfo::Reset() {
   url_in_database_ = 0;
   url_in_tempfile_ = 0;
   url_in_memory_ = 0;
+  url_new_ = 0;
 
   host_name_ = "Undetermined";
   memory_used_ = 0;
@@ -46,6 +47,7 @@ bool SiteInfo::Save(TiXmlElement* element) {
   SaveAttribute(element, "url_in_database", url_in_database_);
   SaveAttribute(element, "url_in_tempfile", url_in_tempfile_);
   SaveAttribute(element, "url_in_memory", url_in_memory_);
+  SaveAttribute(element, "url_new", url_new_);
   SaveAttribute(element, "host_name", host_name_);
   SaveAttribute(element, "memory_used", memory_used_);
   SaveAttribute(element, "disk_used", disk_used_);
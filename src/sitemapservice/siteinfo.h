@@ -64,6 +64,11 @@ class SiteInfo : public BaseRuntimeInfo {
     url_in_memory_ = url_in_memory;
   }
 
+  // "url_new" represents the number of URLs which are unknown by the site
+  // when they are added to memory, since last database update.
+  int64 url_new() const { return url_new_; }
+  void set_url_new(int64 url_new) { url_new_ = url_new; }
+
   // "host_name" represents the site host name used in sitemap.
   const std::string& host_name() const { return host_name_; }
   void set_host_name(const std::string& host_name) { host_name_ = host_name; }
@@ -162,6 +167,7 @@ class SiteInfo : public BaseRuntimeInfo {
   int64 url_in_database_;
   int64 url_in_tempfile_;
   int64 url_in_memory_;
+  int64 url_new_;
 
   std::string host_name_;
 
@@ -0,0 +1,239 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "sitemapservice/tombstonelog.h"
+
+#include <algorithm>
+
+#include "common/logger.h"
+#include "common/fileutil.h"
+#include "common/sequentialwriter.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementation of TombstoneLog
+
+TombstoneLog::TombstoneLog() {
+  filemanager_ = NULL;
+}
+
+void TombstoneLog::Initialize(RecordfileManager* filemanager) {
+  filemanager_ = filemanager;
+}
+
+bool TombstoneLog::Add(const UrlFprint& fprint, time_t time) {
+  Tombstone tombstone;
+  tombstone.fprint = fprint;
+  tombstone.time = time;
+
+  lock_.Enter(true);
+  buffer_.push_back(tombstone);
+  bool result = true;
+  if (static_cast<int>(buffer_.size()) >= kMaxBufferSize) {
+    result = SpillLocked();
+  }
+  lock_.Leave();
+  return result;
+}
+
+bool TombstoneLog::Spill() {
+  lock_.Enter(true);
+  bool result = SpillLocked();
+  lock_.Leave();
+  return result;
+}
+
+bool TombstoneLog::SpillLocked() {
+  if (buffer_.empty()) {
+    return true;
+  }
+
+  // Same url may be obsoleted many times, and only the latest time is kept.
+  // It is the last one of the url after sorting.
+  std::sort(buffer_.begin(), buffer_.end());
+  int count = 0;
+  for (int i = 0; i < static_cast<int>(buffer_.size()); ++i) {
+    if (count > 0 && buffer_[count - 1].fprint == buffer_[i].fprint) {
+      buffer_[count - 1] = buffer_[i];
+    } else {
+      buffer_[count++] = buffer_[i];
+    }
+  }
+  buffer_.resize(count);
+
+  std::string run = filemanager_->GetNewTombstoneFile();
+  FILE* file = fopen(run.c_str(), "wb");
+  if (file == NULL) {
+    Logger::Log(EVENT_ERROR, "Failed to open tombstone run [%s].",
+              run.c_str());
+    return false;
+  }
+
+  SequentialWriter writer;
+  writer.Attach(file);
+  bool result = writer.Write(&buffer_[0], buffer_.size() * sizeof(Tombstone));
+  result = writer.Close() && result;
+
+  if (!result) {
+    Logger::Log(EVENT_ERROR, "Failed to write tombstone run [%s].",
+              run.c_str());
+    FileUtil::DeleteFile(run.c_str());
+    return false;
+  }
+
+  buffer_.clear();
+  return true;
+}
+
+std::vector<std::string> TombstoneLog::GetRuns() {
+  lock_.Enter(true);
+  std::vector<std::string> runs = filemanager_->GetTombstoneFiles();
+  lock_.Leave();
+  return runs;
+}
+
+void TombstoneLog::RemoveRuns(const std::vector<std::string>& runs) {
+  lock_.Enter(true);
+  for (int i = 0; i < static_cast<int>(runs.size()); ++i) {
+    if (!FileUtil::DeleteFile(runs[i].c_str())) {
+      Logger::Log(EVENT_ERROR, "Failed to delete tombstone run [%s].",
+                runs[i].c_str());
+    }
+  }
+  lock_.Leave();
+}
+
+int TombstoneLog::buffer_size() {
+  lock_.Enter(true);
+  int size = static_cast<int>(buffer_.size());
+  lock_.Leave();
+  return size;
+}
+
+bool TombstoneLog::Contains(const UrlFprint& fprint, time_t since) {
+  // Runs are not removed while the lock is held.
+  lock_.Enter(true);
+  AutoLeave autoleave(&lock_);
+  for (int i = 0; i < static_cast<int>(buffer_.size()); ++i) {
+    if (buffer_[i].fprint == fprint && buffer_[i].time >= since) {
+      return true;
+    }
+  }
+
+  std::vector<std::string> runs = filemanager_->GetTombstoneFiles();
+  for (int i = 0; i < static_cast<int>(runs.size()); ++i) {
+    Tombstone tombstone;
+    if (FindInRun(runs[i], fprint, &tombstone) && tombstone.time >= since) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool TombstoneLog::FindInRun(const std::string& run, const UrlFprint& fprint,
+                             Tombstone* tombstone) {
+  FILE* file = fopen(run.c_str(), "rb");
+  if (file == NULL) {
+    return false;
+  }
+
+  // Each url has one entry in a run, ordered by finger print.
+  bool found = false;
+  if (fseek(file, 0, SEEK_END) == 0) {
+    long low = 0, high = ftell(file) / static_cast<long>(sizeof(Tombstone));
+    while (low < high) {
+      long middle = low + (high - low) / 2;
+      if (fseek(file, middle * sizeof(Tombstone), SEEK_SET) != 0
+          || fread(tombstone, sizeof(Tombstone), 1, file) != 1) {
+        break;
+      }
+      if (tombstone->fprint < fprint) {
+        low = middle + 1;
+      } else if (fprint < tombstone->fprint) {
+        high = middle;
+      } else {
+        found = true;
+        break;
+      }
+    }
+  }
+  fclose(file);
+  return found;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementation of TombstoneReader
+
+TombstoneReader::~TombstoneReader() {
+  Close();
+}
+
+void TombstoneReader::Close() {
+  for (int i = 0; i < static_cast<int>(runs_.size()); ++i) {
+    fclose(runs_[i]);
+  }
+  runs_.clear();
+  heads_.clear();
+}
+
+bool TombstoneReader::Open(const std::vector<std::string>& runs) {
+  bool result = true;
+  for (int i = 0; i < static_cast<int>(runs.size()); ++i) {
+    FILE* run = fopen(runs[i].c_str(), "rb");
+    if (run == NULL) {
+      Logger::Log(EVENT_ERROR, "Failed to open tombstone run [%s].",
+                runs[i].c_str());
+      result = false;
+      continue;
+    }
+
+    Tombstone head;
+    if (!Read(run, &head)) {
+      fclose(run);
+      continue;
+    }
+
+    runs_.push_back(run);
+    heads_.push_back(head);
+  }
+  return result;
+}
+
+bool TombstoneReader::Contains(const UrlFprint& fprint, time_t since) {
+  bool found = false;
+  for (int i = 0; i < static_cast<int>(runs_.size()); ++i) {
+    // Skip smaller finger prints, which are not queried any more.
+    bool eof = false;
+    while (heads_[i].fprint < fprint) {
+      if (!Read(runs_[i], &heads_[i])) {
+        eof = true;
+        break;
+      }
+    }
+
+    if (eof) {
+      fclose(runs_[i]);
+      runs_.erase(runs_.begin() + i);
+      heads_.erase(heads_.begin() + i);
+      --i;
+    } else if (heads_[i].fprint == fprint && heads_[i].time >= since) {
+      found = true;
+    }
+  }
+  return found;
+}
+
+bool TombstoneReader::Read(FILE* run, Tombstone* tombstone) {
+  return fread(tombstone, sizeof(Tombstone), 1, run) == 1;
+}
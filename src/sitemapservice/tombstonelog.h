@@ -0,0 +1,145 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// TombstoneLog holds finger prints of obsoleted urls (404, 301, 302 and 307),
+// which should be removed from database when it is updated.
+// Each finger print is kept with the time the url was obsoleted, and only
+// records not visited since then are removed. So a url which comes back (e.g.
+// returns 200 again after a 404) is kept.
+// Tombstones are buffered in memory, and spilled to disk as sorted runs
+// when the buffer is full, like the temp record files. So there is no limit
+// on number of obsoleted urls, while memory usage is bounded.
+// The runs are consumed by RecordMerger through TombstoneReader, as just
+// another sorted input.
+//
+// TombstoneLog is thread safe. TombstoneReader is not.
+
+#ifndef SITEMAPSERVICE_TOMBSTONELOG_H__
+#define SITEMAPSERVICE_TOMBSTONELOG_H__
+
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "common/basictypes.h"
+#include "common/url.h"
+#include "common/criticalsection.h"
+#include "sitemapservice/recordfilemanager.h"
+
+// An obsoleted url, and when it was obsoleted.
+// The runs are arrays of this struct, ordered by finger print, with one
+// entry for each url.
+struct Tombstone {
+  UrlFprint fprint;
+  time_t time;
+
+  bool operator<(const Tombstone& another) const {
+    return fprint < another.fprint
+      || (fprint == another.fprint && time < another.time);
+  }
+};
+
+class TombstoneLog {
+ public:
+  // Max number of finger prints buffered in memory.
+  static const int kMaxBufferSize = 64 * 1024;
+
+  TombstoneLog();
+  ~TombstoneLog() {}
+
+  // The runs are created in directory managed by "filemanager".
+  void Initialize(RecordfileManager* filemanager);
+
+  // Add finger print of a url obsoleted at "time".
+  // The buffer is spilled to a new run when it is full.
+  // Returns false if spilling fails, in which case the finger prints are
+  // still kept in buffer.
+  bool Add(const UrlFprint& fprint, time_t time);
+
+  // Spill all buffered finger prints to a new run, so all obsoleted urls
+  // added so far are in the runs returned by GetRuns.
+  // Returns whether it is successful.
+  bool Spill();
+
+  // Get all runs on disk.
+  std::vector<std::string> GetRuns();
+
+  // Remove runs which are already merged into database.
+  void RemoveRuns(const std::vector<std::string>& runs);
+
+  // Get number of finger prints in memory.
+  int buffer_size();
+
+  // Returns whether given url is obsoleted at or after "since", in the runs
+  // or in the buffer, like TombstoneReader::Contains. The runs are binary
+  // searched, so it is used to check a single url.
+  bool Contains(const UrlFprint& fprint, time_t since);
+
+ private:
+  // Spill the buffer. lock_ should be held.
+  bool SpillLocked();
+
+  // Binary search a run for given finger print.
+  // Returns false if it is not found, or the run can't be read.
+  static bool FindInRun(const std::string& run, const UrlFprint& fprint,
+                        Tombstone* tombstone);
+
+  // Tombstones not written to runs yet.
+  std::vector<Tombstone> buffer_;
+
+  // Used to manage run files.
+  RecordfileManager* filemanager_;
+
+  // Lock for buffer_, and creating or removing of runs.
+  CriticalSection lock_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(TombstoneLog);
+};
+
+// Reader of the runs of a TombstoneLog.
+// It reads all runs in parallel, and answers whether a url is obsoleted.
+// The finger prints should be queried in ascending order.
+class TombstoneReader {
+ public:
+  TombstoneReader() {}
+  ~TombstoneReader();
+
+  // Open the runs.
+  // Returns false if a run can't be opened, and the other runs are still
+  // read.
+  bool Open(const std::vector<std::string>& runs);
+
+  // Close all the runs.
+  void Close();
+
+  // Returns whether given url is obsoleted at or after "since", which is
+  // usually the last access time of its record. Pass 0 to ignore the time.
+  // "fprint" should not be less than the one in last call.
+  bool Contains(const UrlFprint& fprint, time_t since);
+
+ private:
+  // Read next tombstone of a run. Returns false at the end of the run.
+  static bool Read(FILE* run, Tombstone* tombstone);
+
+  // The runs, and their current tombstones.
+  // A run is closed when it reaches the end.
+  std::vector<FILE*> runs_;
+  std::vector<Tombstone> heads_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(TombstoneReader);
+};
+
+#endif // SITEMAPSERVICE_TOMBSTONELOG_H__
@@ -0,0 +1,84 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "sitemapservice/urlarena.h"
+
+#include <string.h>
+#include <algorithm>
+
+UrlArena::UrlArena() {
+  current_ = NULL;
+  left_ = 0;
+  used_bytes_ = 0;
+  wasted_bytes_ = 0;
+  allocated_bytes_ = 0;
+}
+
+UrlArena::~UrlArena() {
+  Clear();
+}
+
+char* UrlArena::Allocate(const char* url, int length) {
+  int size = length + 1;
+  char* result = NULL;
+
+  if (size > kChunkSize) {
+    // Too long, put it in a dedicated chunk, and keep current chunk as it is.
+    result = new char[size];
+    chunks_.push_back(result);
+    allocated_bytes_ += size;
+  } else {
+    if (size > left_) {
+      current_ = new char[kChunkSize];
+      left_ = kChunkSize;
+      chunks_.push_back(current_);
+      allocated_bytes_ += kChunkSize;
+    }
+    result = current_;
+    current_ += size;
+    left_ -= size;
+  }
+
+  memcpy(result, url, length);
+  result[length] = '\0';
+  used_bytes_ += size;
+  return result;
+}
+
+void UrlArena::Release(int length) {
+  wasted_bytes_ += length + 1;
+}
+
+void UrlArena::Clear() {
+  for (int i = 0; i < static_cast<int>(chunks_.size()); ++i) {
+    delete[] chunks_[i];
+  }
+  chunks_.clear();
+
+  current_ = NULL;
+  left_ = 0;
+  used_bytes_ = 0;
+  wasted_bytes_ = 0;
+  allocated_bytes_ = 0;
+}
+
+void UrlArena::Swap(UrlArena* another) {
+  chunks_.swap(another->chunks_);
+  std::swap(current_, another->current_);
+  std::swap(left_, another->left_);
+  std::swap(used_bytes_, another->used_bytes_);
+  std::swap(wasted_bytes_, another->wasted_bytes_);
+  std::swap(allocated_bytes_, another->allocated_bytes_);
+}
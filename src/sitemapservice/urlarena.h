@@ -0,0 +1,81 @@
+// Copyright 2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// UrlArena is a chunked allocator for url strings held by RecordTable.
+// Instead of allocating every url string on heap separately, url strings are
+// copied one after another into large chunks. There is no way to free a single
+// url string. All the strings are released together when Clear() is called.
+// Bytes occupied by urls which are no longer referenced could be reported by
+// Release(), so that owner can decide when to rebuild the arena.
+//
+// Note, this class is not thread safe.
+
+#ifndef SITEMAPSERVICE_URLARENA_H__
+#define SITEMAPSERVICE_URLARENA_H__
+
+#include <vector>
+
+#include "common/basictypes.h"
+
+class UrlArena {
+ public:
+  // Default size of a chunk.
+  // A url string longer than this value gets a dedicated chunk.
+  static const int kChunkSize = 64 * 1024;
+
+  UrlArena();
+  ~UrlArena();
+
+  // Copy "url" (with "length" chars and the ending '\0') into this arena.
+  // The returned pointer is valid until Clear() is called.
+  char* Allocate(const char* url, int length);
+
+  // Report that "length" url chars (ending '\0' excluded) are not used anymore.
+  // The memory is not actually reclaimed until Clear() is called.
+  void Release(int length);
+
+  // Release all the memory held by this arena.
+  void Clear();
+
+  // Exchange contents with "another" arena.
+  void Swap(UrlArena* another);
+
+  // Bytes occupied by url strings, including released ones.
+  int64 used_bytes() const { return used_bytes_; }
+
+  // Bytes occupied by url strings which are already released.
+  int64 wasted_bytes() const { return wasted_bytes_; }
+
+  // Bytes allocated from heap by this arena.
+  int64 allocated_bytes() const { return allocated_bytes_; }
+
+ private:
+  // All the chunks allocated from heap.
+  std::vector<char*> chunks_;
+
+  // Next available byte in the last regular chunk.
+  char* current_;
+
+  // Number of available bytes starting from "current_".
+  int left_;
+
+  int64 used_bytes_;
+  int64 wasted_bytes_;
+  int64 allocated_bytes_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(UrlArena);
+};
+
+#endif  // SITEMAPSERVICE_URLARENA_H__
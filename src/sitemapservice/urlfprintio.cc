@@ -63,7 +63,6 @@ bool UrlFprintReader::Read(UrlFprint *fprint) {
 // Implementation of RecordFileWriter
 
 UrlFprintWriter::UrlFprintWriter() {
-  file_ = NULL;
 }
 
 UrlFprintWriter::~UrlFprintWriter() {
@@ -72,31 +71,33 @@ UrlFprintWriter::~UrlFprintWriter() {
 
 bool UrlFprintWriter::Open(const char* path) {
   // File is already opened.
-  if (file_ != NULL) {
+  if (file_.is_open()) {
     Logger::Log(EVENT_ERROR, "Failed to open [%s] to write. (%d)",
               path, errno);
     return false;
   }
 
-  file_ = fopen(path, "wb");
-  return file_ != NULL;
-}
-
-void UrlFprintWriter::Close() {
-  if (file_ == NULL) {
-    return;
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) {
+    return false;
   }
 
-  fclose(file_);
-  file_ = NULL;
+  file_.Attach(file);
+  return true;
 }
 
-bool UrlFprintWriter::Write(const UrlFprint& fprint) {
-  if (file_ == NULL) {
-    return false;
+bool UrlFprintWriter::Close() {
+  if (!file_.is_open()) {
+    return true;
   }
 
-  size_t result = fwrite(&fprint, sizeof(UrlFprint), 1, file_);
-  return result == 1;
+  if (!file_.Close()) {
+    Logger::Log(EVENT_ERROR, "Failed to close url fprint file.");
+    return false;
+  }
+  return true;
 }
 
+bool UrlFprintWriter::Write(const UrlFprint& fprint) {
+  return file_.Write(&fprint, sizeof(UrlFprint));
+}
@@ -23,6 +23,7 @@
 
 #include "common/basictypes.h"
 #include "common/url.h"
+#include "common/sequentialwriter.h"
 
 class UrlFprintReader {
  public:
@@ -59,8 +60,8 @@ class UrlFprintWriter {
   bool Open(const char* path);
   
   // Close the writer.
-  // Retruns 0 if operation is successful.
-  void Close();
+  // Returns false if the file can't be written completely.
+  bool Close();
 
   // Write a record to opened writer.
   // If operation is successful, 1 is returned.
@@ -68,7 +69,7 @@ class UrlFprintWriter {
   bool Write(const UrlFprint& fprint);
 
  private:
-  FILE* file_;
+  SequentialWriter file_;
 
   DISALLOW_EVIL_CONSTRUCTORS(UrlFprintWriter);
 };
@@ -57,6 +57,14 @@ class VisitingRecord {
     return another;
   }
 
+  // Copy all the fields, but share url string of "another" instead of
+  // copying it. set_url(NULL) should be called before the shared url string
+  // is released by its owner.
+  void ShallowCopy(const VisitingRecord& another) {
+    if (url_ != NULL) delete[] url_;
+    memcpy(this, &another, sizeof(VisitingRecord));
+  }
+
   // Update url string.
   // Both url finger print and url length are updated.
   void update_url(const char* url) {